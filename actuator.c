@@ -0,0 +1,326 @@
+#include <unistd.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "actuator.h"
+#include "spsc.h"
+#include "hal.h"
+
+/*
+ * Each PTZ channel has its own thread. Movements go to the thread on one
+ * queue and results come back on another, each with a single producer and
+ * a single consumer. Either side only makes a system call to wake the other
+ * one up when it is, or may be, asleep. All threads share the eventfd that
+ * wakes up the main loop.
+ */
+
+struct actuator_worker {
+  gint channel;
+  struct spsc_queue op_queue;
+  struct spsc_queue result_queue;
+  GThread *thread;
+  gint worker_waiting;
+  int worker_fd;
+  guint max_depth;
+};
+
+static struct actuator_worker workers[ACTUATOR_MAX_CHANNELS];
+static guint num_workers = 0;
+
+static gint running = 0;
+static gint results_signaled = 0;
+
+static int result_fd = -1;
+static guint result_source = 0;
+
+static actuator_result_callback result_callback = NULL;
+
+/* Only touched from the main loop */
+static struct actuator_stats stats;
+
+/********************************************/
+
+static void actuator_signal(int fd)
+{
+  guint64 one = 1;
+
+  while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR);
+}
+
+static void actuator_wake_worker(struct actuator_worker *w)
+{
+  if (g_atomic_int_get(&w->worker_waiting)) {
+    actuator_signal(w->worker_fd);
+  }
+}
+
+static gboolean actuator_can_run(struct actuator_worker *w)
+{
+  return spsc_depth(&w->op_queue) > 0 &&
+    spsc_depth(&w->result_queue) < ACTUATOR_QUEUE_SIZE;
+}
+
+/*
+ * Sleep until there is a movement to execute and room for its result.
+ * The flag is set before checking again, so a producer either sees it or
+ * the check sees what was produced.
+ */
+static void actuator_wait(struct actuator_worker *w)
+{
+  guint64 value;
+
+  g_atomic_int_set(&w->worker_waiting, 1);
+
+  if (!actuator_can_run(w) && g_atomic_int_get(&running)) {
+    while (read(w->worker_fd, &value, sizeof(value)) < 0 && errno == EINTR);
+  }
+
+  g_atomic_int_set(&w->worker_waiting, 0);
+}
+
+static gboolean actuator_execute(const struct actuator_op *op, GError **error)
+{
+  switch (op->type) {
+  case ACTUATOR_ABSOLUTE:
+    return hal_ptz_absolute_move(op->channel, op->pan, op->tilt,
+                                 op->pan_tilt_space, op->speed,
+                                 op->pan_tilt_speed_space,
+                                 op->zoom, op->zoom_space, error);
+  case ACTUATOR_RELATIVE:
+    return hal_ptz_relative_move(op->channel, op->pan, op->tilt,
+                                 op->pan_tilt_space, op->speed,
+                                 op->pan_tilt_speed_space,
+                                 op->zoom, op->zoom_space, error);
+  case ACTUATOR_CONTINUOUS_START:
+    return hal_ptz_continuous_start(op->channel, op->pan, op->tilt,
+                                    op->pan_tilt_speed_space, op->zoom,
+                                    op->timeout, error);
+  case ACTUATOR_CONTINUOUS_STOP:
+    return hal_ptz_continuous_stop(op->channel, op->stop_pan_tilt,
+                                   op->stop_zoom, error);
+  case ACTUATOR_HOME:
+    return hal_ptz_goto_home(op->channel, op->speed, error);
+  case ACTUATOR_GOTO_PRESET:
+    return hal_ptz_goto_preset(op->channel, op->preset, op->speed, error);
+  case ACTUATOR_SET_PRESET:
+    return hal_ptz_set_preset(op->channel, op->preset, error);
+  case ACTUATOR_REMOVE_PRESET:
+    return hal_ptz_remove_preset(op->channel, op->preset, error);
+  }
+
+  return FALSE;
+}
+
+static gpointer actuator_thread(gpointer data)
+{
+  struct actuator_worker *w = data;
+  struct actuator_result result;
+
+  while (g_atomic_int_get(&running)) {
+    GError *local_error = NULL;
+
+    if (spsc_depth(&w->result_queue) == ACTUATOR_QUEUE_SIZE ||
+        !spsc_pop(&w->op_queue, &result.op)) {
+      actuator_wait(w);
+      continue;
+    }
+
+    result.start_time = g_get_monotonic_time();
+    result.ok = actuator_execute(&result.op, &local_error);
+    result.end_time = g_get_monotonic_time();
+
+    if (local_error) {
+      g_error_free(local_error);
+    }
+
+    /* Room was checked before popping, only this thread pushes results */
+    spsc_push(&w->result_queue, &result);
+
+    if (g_atomic_int_compare_and_exchange(&results_signaled, 0, 1)) {
+      actuator_signal(result_fd);
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * Deliver results on the main loop. The flag is cleared before draining,
+ * results pushed after that signal again.
+ */
+static gboolean actuator_result_ready(GIOChannel *source,
+                                      GIOCondition cond,
+                                      gpointer data)
+{
+  struct actuator_result result;
+  guint64 value;
+  guint i;
+
+  if (read(result_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+    g_printf("Failed to read actuator results\n");
+  }
+
+  g_atomic_int_set(&results_signaled, 0);
+
+  for (i = 0; i < num_workers; i++) {
+    while (spsc_pop(&workers[i].result_queue, &result)) {
+      stats.completed++;
+      result_callback(&result);
+    }
+
+    /* The thread may be waiting for room in the result queue */
+    actuator_wake_worker(&workers[i]);
+  }
+
+  return TRUE;
+}
+
+static struct actuator_worker *actuator_find_worker(gint channel)
+{
+  guint i;
+
+  for (i = 0; i < num_workers; i++) {
+    if (workers[i].channel == channel) {
+      return &workers[i];
+    }
+  }
+
+  return NULL;
+}
+
+gboolean actuator_submit(struct actuator_op *op)
+{
+  struct actuator_worker *w = actuator_find_worker(op->channel);
+  guint depth;
+
+  op->submit_time = g_get_monotonic_time();
+
+  if (!w || !spsc_push(&w->op_queue, op)) {
+    stats.dropped++;
+    return FALSE;
+  }
+
+  stats.submitted++;
+
+  depth = spsc_depth(&w->op_queue);
+  w->max_depth = MAX(w->max_depth, depth);
+  stats.max_depth = MAX(stats.max_depth, depth);
+
+  actuator_wake_worker(w);
+
+  return TRUE;
+}
+
+void actuator_get_stats(struct actuator_stats *out)
+{
+  guint i;
+
+  g_assert(out);
+
+  *out = stats;
+  out->depth = 0;
+
+  for (i = 0; i < num_workers; i++) {
+    out->depth += spsc_depth(&workers[i].op_queue);
+  }
+}
+
+gboolean actuator_init(const gint *channels, guint count,
+                       actuator_result_callback callback)
+{
+  GError *local_error = NULL;
+  guint i;
+
+  g_assert(callback && channels);
+  g_assert(count > 0 && count <= ACTUATOR_MAX_CHANNELS);
+
+  result_callback = callback;
+
+  result_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+  if (result_fd < 0) {
+    g_printf("Could not create actuator eventfd\n");
+    return FALSE;
+  }
+
+  for (i = 0; i < count; i++) {
+    struct actuator_worker *w = &workers[i];
+
+    w->channel = channels[i];
+    w->worker_fd = eventfd(0, EFD_CLOEXEC);
+
+    if (w->worker_fd < 0) {
+      g_printf("Could not create actuator eventfd\n");
+      actuator_cleanup();
+      return FALSE;
+    }
+
+    spsc_init(&w->op_queue, ACTUATOR_QUEUE_SIZE, sizeof(struct actuator_op));
+    spsc_init(&w->result_queue, ACTUATOR_QUEUE_SIZE,
+              sizeof(struct actuator_result));
+    num_workers++;
+  }
+
+  GIOChannel *channel = g_io_channel_unix_new(result_fd);
+  result_source = g_io_add_watch(channel, G_IO_IN, actuator_result_ready, NULL);
+  g_io_channel_unref(channel);
+
+  g_atomic_int_set(&running, 1);
+
+  for (i = 0; i < num_workers; i++) {
+    if (!(workers[i].thread = g_thread_try_new("actuator", actuator_thread,
+                                               &workers[i], &local_error))) {
+      g_printf("Could not start actuator thread: %s\n", local_error->message);
+      g_error_free(local_error);
+      actuator_cleanup();
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+void actuator_cleanup()
+{
+  guint i;
+
+  /* Movements still queued are dropped */
+  g_atomic_int_set(&running, 0);
+
+  for (i = 0; i < num_workers; i++) {
+    struct actuator_worker *w = &workers[i];
+
+    if (w->thread) {
+      actuator_signal(w->worker_fd);
+      g_thread_join(w->thread);
+      w->thread = NULL;
+    }
+  }
+
+  if (result_source) {
+    g_source_remove(result_source);
+    result_source = 0;
+  }
+
+  for (i = 0; i < num_workers; i++) {
+    struct actuator_worker *w = &workers[i];
+
+    if (w->worker_fd >= 0) {
+      close(w->worker_fd);
+      w->worker_fd = -1;
+    }
+
+    spsc_free(&w->op_queue);
+    spsc_free(&w->result_queue);
+  }
+
+  num_workers = 0;
+
+  if (result_fd >= 0) {
+    close(result_fd);
+    result_fd = -1;
+  }
+}
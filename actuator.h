@@ -0,0 +1,76 @@
+#ifndef INCLUSION_GUARD_ACTUATOR_H
+#define INCLUSION_GUARD_ACTUATOR_H
+
+#include <glib.h>
+#include <fixmath.h>
+#include <axsdk/axptz.h>
+
+#include "metrics.h"
+
+/*
+ * PTZ actuation threads, one per channel. Decoded movements are queued
+ * from the main loop and executed in order through the HAL, results are
+ * handed back to the main loop so no PTZ IPC is done on the network thread.
+ * A slow movement on one channel does not delay the others.
+ */
+
+/* Movements queued per channel before submitting fails, power of two */
+#define ACTUATOR_QUEUE_SIZE (64)
+#define ACTUATOR_MAX_CHANNELS (4)
+
+enum actuator_op_type {
+  ACTUATOR_ABSOLUTE = 0,
+  ACTUATOR_RELATIVE,
+  ACTUATOR_CONTINUOUS_START,
+  ACTUATOR_CONTINUOUS_STOP,
+  ACTUATOR_HOME,
+  ACTUATOR_GOTO_PRESET,
+  ACTUATOR_SET_PRESET,
+  ACTUATOR_REMOVE_PRESET
+};
+
+struct actuator_op {
+  enum actuator_op_type type;
+  enum metrics_class cls;
+  gint channel;
+  fixed_t pan;          /* Position, or speed for continuous movements */
+  fixed_t tilt;
+  fixed_t zoom;
+  fixed_t speed;
+  fixed_t timeout;
+  AXPTZMovementPanTiltSpace pan_tilt_space;
+  AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space;
+  AXPTZMovementZoomSpace zoom_space;
+  gboolean stop_pan_tilt;
+  gboolean stop_zoom;
+  gint preset;
+  gint64 submit_time;
+};
+
+struct actuator_result {
+  struct actuator_op op;
+  gint64 start_time;
+  gint64 end_time;
+  gboolean ok;
+};
+
+struct actuator_stats {
+  guint64 submitted;
+  guint64 completed;
+  guint64 dropped;
+  guint depth;          /* All channels */
+  guint max_depth;      /* Deepest single channel queue */
+};
+
+/* Called on the main loop for every executed movement */
+typedef void (*actuator_result_callback) (const struct actuator_result *result);
+
+gboolean actuator_init(const gint *channels, guint count,
+                       actuator_result_callback callback);
+void actuator_cleanup();
+
+gboolean actuator_submit(struct actuator_op *op); //FALSE if its queue is full
+
+void actuator_get_stats(struct actuator_stats *stats);
+
+#endif // INCLUSION_GUARD_ACTUATOR_H
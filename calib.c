@@ -0,0 +1,166 @@
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "calib.h"
+#include "conv.h"
+
+/********************************************/
+
+void calib_builtin(struct calib_profile *profile)
+{
+  g_assert(profile);
+
+  memset(profile, 0, sizeof(*profile));
+
+  g_strlcpy(profile->name, "builtin", sizeof(profile->name));
+  profile->pan_degrees = 170.0;
+  profile->tilt_degrees = 90.0;
+
+  /* 18x as in the VISCA documentation, any end point gives a line */
+  profile->optical_zoom = 18.0;
+  profile->num_zoom_points = 2;
+  profile->zoom_points[0].visca = 0x0000;
+  profile->zoom_points[0].magnification = 1.0;
+  profile->zoom_points[1].visca = CONV_ZOOM_MAX;
+  profile->zoom_points[1].magnification = 18.0;
+}
+
+/*
+ * Parse "0xVVVV:M" points. Positions must be increasing and cover
+ * 0x0000-0x4000, magnifications must not decrease.
+ */
+static gboolean calib_parse_curve(gchar **points, gsize count,
+                                  struct calib_profile *profile)
+{
+  gsize i;
+
+  if (count < 2 || count > CALIB_MAX_ZOOM_POINTS) {
+    return FALSE;
+  }
+
+  for (i = 0; i < count; i++) {
+    struct calib_zoom_point *point = &profile->zoom_points[i];
+    gchar *end;
+
+    point->visca = g_ascii_strtoull(points[i], &end, 0);
+    if (*end != ':') {
+      return FALSE;
+    }
+
+    point->magnification = g_ascii_strtod(end + 1, &end);
+    if (*end != '\0' || point->magnification < 1.0) {
+      return FALSE;
+    }
+
+    if (i > 0 &&
+        (point->visca <= point[-1].visca ||
+         point->magnification < point[-1].magnification)) {
+      return FALSE;
+    }
+  }
+
+  if (profile->zoom_points[0].visca != 0x0000 ||
+      profile->zoom_points[count - 1].visca != CONV_ZOOM_MAX) {
+    return FALSE;
+  }
+
+  profile->num_zoom_points = count;
+
+  return TRUE;
+}
+
+static gboolean calib_load_group(GKeyFile *file, const gchar *group,
+                                 struct calib_profile *profile)
+{
+  struct calib_profile parsed;
+  GError *local_error = NULL;
+  gchar **points;
+  gsize count;
+  gboolean ok;
+
+  if (!g_key_file_has_group(file, group)) {
+    return FALSE;
+  }
+
+  calib_builtin(&parsed);
+  g_strlcpy(parsed.name, group, sizeof(parsed.name));
+
+  if (g_key_file_has_key(file, group, "PanDegrees", NULL)) {
+    parsed.pan_degrees =
+      g_key_file_get_double(file, group, "PanDegrees", NULL);
+  }
+
+  if (g_key_file_has_key(file, group, "TiltDegrees", NULL)) {
+    parsed.tilt_degrees =
+      g_key_file_get_double(file, group, "TiltDegrees", NULL);
+  }
+
+  if ((points = g_key_file_get_string_list(file, group, "ZoomCurve",
+                                           &count, &local_error))) {
+    ok = calib_parse_curve(points, count, &parsed);
+    g_strfreev(points);
+
+    if (!ok) {
+      g_printf("Invalid zoom curve in calibration profile %s\n", group);
+      return FALSE;
+    }
+
+    parsed.optical_zoom =
+      parsed.zoom_points[parsed.num_zoom_points - 1].magnification;
+  } else {
+    g_error_free(local_error);
+  }
+
+  if (g_key_file_has_key(file, group, "OpticalZoom", NULL)) {
+    parsed.optical_zoom =
+      g_key_file_get_double(file, group, "OpticalZoom", NULL);
+  }
+
+  if (parsed.pan_degrees <= 0.0 || parsed.tilt_degrees <= 0.0 ||
+      parsed.optical_zoom <
+      parsed.zoom_points[parsed.num_zoom_points - 1].magnification) {
+    g_printf("Invalid ranges in calibration profile %s\n", group);
+    return FALSE;
+  }
+
+  *profile = parsed;
+
+  return TRUE;
+}
+
+gboolean calib_load(const gchar *path, const gchar *model,
+                    struct calib_profile *profile)
+{
+  GError *local_error = NULL;
+  GKeyFile *file;
+  gboolean found = FALSE;
+
+  g_assert(path && profile);
+
+  calib_builtin(profile);
+
+  file = g_key_file_new();
+  g_key_file_set_list_separator(file, ',');
+
+  if (!g_key_file_load_from_file(file, path, G_KEY_FILE_NONE, &local_error)) {
+    g_printf("Could not read calibration profiles from %s: %s\n", path,
+             local_error->message);
+    g_error_free(local_error);
+    g_key_file_free(file);
+    return FALSE;
+  }
+
+  if (model && *model) {
+    found = calib_load_group(file, model, profile);
+  }
+
+  if (!found) {
+    found = calib_load_group(file, CALIB_DEFAULT_PROFILE, profile);
+  }
+
+  g_key_file_free(file);
+
+  return found;
+}
@@ -0,0 +1,48 @@
+#ifndef INCLUSION_GUARD_CALIB_H
+#define INCLUSION_GUARD_CALIB_H
+
+#include <glib.h>
+
+/*
+ * Calibration profiles, keyed by camera model (Brand.ProdNbr) and read
+ * from calibration.conf. A profile gives the degrees of the largest VISCA
+ * pan and tilt positions and the zoom curve, VISCA zoom positions to
+ * optical magnification. The unitless axptz zoom is taken to be linear in
+ * magnification from 1x to the optical zoom of the profile.
+ *
+ * Profiles are only looked up at startup and when the selection changes,
+ * conv_init compiles the selected one into lookup tables.
+ */
+
+#define CALIB_FILE "calibration.conf"
+#define CALIB_DEFAULT_PROFILE "default"
+
+/* Points on the zoom curve, the first at 0x0000 and the last at 0x4000 */
+#define CALIB_MAX_ZOOM_POINTS (64)
+
+struct calib_zoom_point {
+  guint visca;
+  gdouble magnification;
+};
+
+struct calib_profile {
+  gchar name[64];
+  gdouble pan_degrees;    /* At VISCA pan 0x09BDE */
+  gdouble tilt_degrees;   /* At VISCA tilt 0x52F8 */
+  gdouble optical_zoom;   /* Magnification at the unitless zoom maximum */
+  guint num_zoom_points;
+  struct calib_zoom_point zoom_points[CALIB_MAX_ZOOM_POINTS];
+};
+
+/*
+ * Fill in the profile for model from path, falling back to the default
+ * profile of the file and then to the built in linear profile. Returns
+ * FALSE if the built in profile was used.
+ */
+gboolean calib_load(const gchar *path, const gchar *model,
+                    struct calib_profile *profile);
+
+/* The linear 170/90 degree, 0x0000-0x4000 zoom mapping */
+void calib_builtin(struct calib_profile *profile);
+
+#endif // INCLUSION_GUARD_CALIB_H
@@ -0,0 +1,251 @@
+#include <glib.h>
+
+#include "conv.h"
+
+/* The number of fractional bits used in fix-point variables */
+#define FIXMATH_FRAC_BITS 16
+
+/* Fractional bits of the VISCA to fixed and fixed to VISCA multipliers */
+#define CONV_MUL_BITS (16)
+#define CONV_INV_BITS (32)
+#define CONV_ZOOM_INV_BITS (40)
+
+/*
+ * VISCA zoom positions index the forward table directly, the reverse table
+ * is indexed by the unitless zoom scaled to segments with
+ * CONV_LUT_FRAC_BITS of fraction and holds VISCA positions with the same
+ * fraction.
+ */
+#define CONV_LUT_FRAC_BITS (8)
+#define CONV_LUT_STEP_BITS (14 - CONV_LUT_BITS)   /* CONV_ZOOM_MAX is 1 << 14 */
+
+/********************************************/
+
+static gint64 conv_div_round(gint64 num, gint64 den)
+{
+  return (num + den / 2) / den;
+}
+
+static void conv_init_angle(struct conv_axis *axis, gdouble degrees,
+                            gint64 steps, fixed_t min, fixed_t max)
+{
+  gint64 fixed_degrees = (gint64) (degrees * (1 << FIXMATH_FRAC_BITS) + 0.5);
+
+  axis->mul = conv_div_round(fixed_degrees << CONV_MUL_BITS, steps);
+  axis->inv = conv_div_round(steps << CONV_INV_BITS, fixed_degrees);
+  axis->min = min;
+  axis->max = max;
+}
+
+/* Unitless zoom of a VISCA position, interpolating the profile curve */
+static gdouble conv_curve_zoom(const struct conv_tables *t,
+                               const struct calib_profile *profile,
+                               gdouble visca)
+{
+  const struct calib_zoom_point *p = profile->zoom_points;
+  gdouble magnification;
+  guint i;
+
+  for (i = 1; i < profile->num_zoom_points - 1 && visca > p[i].visca; i++);
+
+  magnification = p[i - 1].magnification +
+    (visca - p[i - 1].visca) * (p[i].magnification - p[i - 1].magnification) /
+    (p[i].visca - p[i - 1].visca);
+
+  return t->zoom.min + (gdouble) (t->zoom.max - t->zoom.min) *
+    (magnification - 1.0) / MAX(profile->optical_zoom - 1.0, 1e-9);
+}
+
+/* VISCA position of a unitless zoom, the inverse of conv_curve_zoom */
+static gdouble conv_curve_visca(const struct conv_tables *t,
+                                const struct calib_profile *profile,
+                                gdouble zoom)
+{
+  const struct calib_zoom_point *p = profile->zoom_points;
+  gdouble magnification = 1.0 + (profile->optical_zoom - 1.0) *
+    (zoom - t->zoom.min) / MAX(t->zoom.max - t->zoom.min, 1);
+  guint n = profile->num_zoom_points;
+  guint i;
+
+  if (magnification >= p[n - 1].magnification) {
+    return CONV_ZOOM_MAX;
+  }
+
+  for (i = 1; i < n - 1 && magnification > p[i].magnification; i++);
+
+  if (p[i].magnification <= p[i - 1].magnification) {
+    return p[i - 1].visca;
+  }
+
+  return p[i - 1].visca +
+    (magnification - p[i - 1].magnification) * (p[i].visca - p[i - 1].visca) /
+    (p[i].magnification - p[i - 1].magnification);
+}
+
+/*
+ * Sample the profile curve into the zoom tables, all per packet zoom
+ * conversions are table lookups from here on
+ */
+static void conv_init_zoom(struct conv_tables *t,
+                           const struct calib_profile *profile)
+{
+  gint64 range = MAX((gint64) t->zoom.max - t->zoom.min, 1);
+  int i;
+
+  for (i = 0; i <= CONV_LUT_SEGMENTS; i++) {
+    gdouble visca = (gdouble) i * CONV_ZOOM_MAX / CONV_LUT_SEGMENTS;
+    gdouble zoom = t->zoom.min + (gdouble) range * i / CONV_LUT_SEGMENTS;
+
+    t->zoom_lut[i] = (fixed_t) (conv_curve_zoom(t, profile, visca) + 0.5);
+    t->zoom_rev_lut[i] = (gint32) (conv_curve_visca(t, profile, zoom) *
+                                   (1 << CONV_LUT_FRAC_BITS) + 0.5);
+  }
+
+  t->zoom.inv = conv_div_round((gint64) CONV_LUT_SEGMENTS <<
+                               (CONV_LUT_FRAC_BITS + CONV_ZOOM_INV_BITS),
+                               range);
+}
+
+void conv_init(struct conv_tables *t,
+               const AXPTZLimits *unit_limits,
+               const AXPTZLimits *unitless_limits,
+               const struct calib_profile *profile)
+{
+  g_assert(t && unit_limits && unitless_limits && profile);
+
+  conv_init_angle(&t->pan, profile->pan_degrees, CONV_PAN_MAX,
+                  unit_limits->min_pan_value, unit_limits->max_pan_value);
+  conv_init_angle(&t->tilt, profile->tilt_degrees, CONV_TILT_MAX,
+                  unit_limits->min_tilt_value, unit_limits->max_tilt_value);
+
+  t->zoom.min = unitless_limits->min_zoom_value;
+  t->zoom.max = unitless_limits->max_zoom_value;
+
+  conv_init_zoom(t, profile);
+}
+
+/*
+ * Multiply and shift, rounding to nearest. The shift of negative values is
+ * arithmetic with gcc.
+ */
+static gint64 conv_scale(gint64 value, gint64 mul, int bits)
+{
+  return (value * mul + ((gint64) 1 << (bits - 1))) >> bits;
+}
+
+/* Sign extend a two's complement field */
+static gint64 conv_signed(unsigned int value, int bits)
+{
+  gint64 sign = (gint64) 1 << (bits - 1);
+
+  value &= (1u << bits) - 1;
+
+  return ((gint64) value ^ sign) - sign;
+}
+
+fixed_t conv_visca_to_pan(const struct conv_tables *t, unsigned int pan)
+{
+  gint64 steps = CLAMP(conv_signed(pan, 20), -CONV_PAN_MAX, CONV_PAN_MAX);
+
+  return conv_scale(steps, t->pan.mul, CONV_MUL_BITS);
+}
+
+fixed_t conv_visca_to_tilt(const struct conv_tables *t, unsigned int tilt)
+{
+  gint64 steps = CLAMP(conv_signed(tilt, 16), -CONV_TILT_MAX, CONV_TILT_MAX);
+
+  return conv_scale(steps, t->tilt.mul, CONV_MUL_BITS);
+}
+
+fixed_t conv_visca_to_zoom(const struct conv_tables *t, unsigned int zoom)
+{
+  unsigned int z = MIN(zoom, CONV_ZOOM_MAX);
+  unsigned int i = z >> CONV_LUT_STEP_BITS;
+  gint64 frac = z & ((1 << CONV_LUT_STEP_BITS) - 1);
+
+  if (i == CONV_LUT_SEGMENTS) {
+    return t->zoom_lut[i];
+  }
+
+  return t->zoom_lut[i] +
+    conv_scale((gint64) t->zoom_lut[i + 1] - t->zoom_lut[i], frac,
+               CONV_LUT_STEP_BITS);
+}
+
+static gint64 conv_zoom_distance(const struct conv_tables *t,
+                                 unsigned int visca, fixed_t zoom)
+{
+  gint64 d = (gint64) conv_visca_to_zoom(t, visca) - zoom;
+
+  return d < 0 ? -d : d;
+}
+
+unsigned int conv_pan_to_visca(const struct conv_tables *t, fixed_t pan)
+{
+  gint64 steps = conv_scale(pan, t->pan.inv, CONV_INV_BITS);
+
+  return CLAMP(steps, -CONV_PAN_MAX, CONV_PAN_MAX) & 0xFFFFF;
+}
+
+unsigned int conv_tilt_to_visca(const struct conv_tables *t, fixed_t tilt)
+{
+  gint64 steps = conv_scale(tilt, t->tilt.inv, CONV_INV_BITS);
+
+  return CLAMP(steps, -CONV_TILT_MAX, CONV_TILT_MAX) & 0xFFFF;
+}
+
+unsigned int conv_zoom_to_visca(const struct conv_tables *t, fixed_t zoom)
+{
+  gint64 offset = CLAMP((gint64) zoom, t->zoom.min, t->zoom.max) -
+    t->zoom.min;
+  gint64 pos = conv_scale(offset, t->zoom.inv, CONV_ZOOM_INV_BITS);
+  gint64 i = pos >> CONV_LUT_FRAC_BITS;
+  gint64 steps;
+
+  if (i >= CONV_LUT_SEGMENTS) {
+    steps = t->zoom_rev_lut[CONV_LUT_SEGMENTS];
+  } else {
+    steps = t->zoom_rev_lut[i] +
+      conv_scale((gint64) t->zoom_rev_lut[i + 1] - t->zoom_rev_lut[i],
+                 pos & ((1 << CONV_LUT_FRAC_BITS) - 1), CONV_LUT_FRAC_BITS);
+  }
+
+  steps = (steps + (1 << (CONV_LUT_FRAC_BITS - 1))) >> CONV_LUT_FRAC_BITS;
+  steps = CLAMP(steps, 0, CONV_ZOOM_MAX);
+
+  /* Interpolating the reverse table across a knee of the curve can be a
+     few steps off, settle on the position that converts back nearest */
+  while (steps > 0 &&
+         conv_zoom_distance(t, steps - 1, zoom) <
+         conv_zoom_distance(t, steps, zoom)) {
+    steps--;
+  }
+
+  while (steps < CONV_ZOOM_MAX &&
+         conv_zoom_distance(t, steps + 1, zoom) <
+         conv_zoom_distance(t, steps, zoom)) {
+    steps++;
+  }
+
+  return steps;
+}
+
+fixed_t conv_clamp_pan(const struct conv_tables *t, fixed_t pan)
+{
+  return CLAMP(pan, t->pan.min, t->pan.max);
+}
+
+fixed_t conv_clamp_tilt(const struct conv_tables *t, fixed_t tilt)
+{
+  return CLAMP(tilt, t->tilt.min, t->tilt.max);
+}
+
+void conv_put_nibbles(unsigned char *buf, unsigned int value, int count)
+{
+  int i;
+
+  for (i = count - 1; i >= 0; i--) {
+    buf[i] = value & 0x0F;
+    value >>= 4;
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef INCLUSION_GUARD_CONV_H
+#define INCLUSION_GUARD_CONV_H
+
+#include <glib.h>
+#include <fixmath.h>
+#include <axsdk/axptz.h>
+
+#include "calib.h"
+
+/*
+ * Conversions between VISCA position fields and axptz fixed point values,
+ * pan/tilt in degrees and zoom unitless. Scale factors and zoom tables are
+ * computed from a calibration profile by conv_init, conversions are integer
+ * multiplications, shifts and table lookups. Conversions round to nearest,
+ * so VISCA -> fixed -> VISCA gives back the same value.
+ *
+ * Pan is a 20 bit two's complement value where 0x09BDE is the pan degrees
+ * of the profile, tilt is 16 bit where 0x52F8 is the tilt degrees, zoom is
+ * 0x0000 wide to 0x4000 tele along the zoom curve of the profile.
+ *
+ * There is one set of tables per PTZ channel. Only the main loop converts,
+ * conv_init may be called again from there.
+ */
+
+#define CONV_PAN_MAX  (0x09BDE)
+#define CONV_TILT_MAX (0x52F8)
+#define CONV_ZOOM_MAX (0x4000)
+
+/* Zoom lookup tables have CONV_LUT_SEGMENTS linear segments */
+#define CONV_LUT_BITS (12)
+#define CONV_LUT_SEGMENTS (1 << CONV_LUT_BITS)
+
+struct conv_axis {
+  gint64 mul;       /* Fixed point units per VISCA step << CONV_MUL_BITS */
+  gint64 inv;       /* VISCA steps per fixed point unit << inverse bits */
+  fixed_t min;
+  fixed_t max;
+};
+
+struct conv_tables {
+  struct conv_axis pan;
+  struct conv_axis tilt;
+  struct conv_axis zoom;    /* inv scales to reverse table index */
+  fixed_t zoom_lut[CONV_LUT_SEGMENTS + 1];
+  gint32 zoom_rev_lut[CONV_LUT_SEGMENTS + 1];
+};
+
+void conv_init(struct conv_tables *t,
+               const AXPTZLimits *unit_limits,
+               const AXPTZLimits *unitless_limits,
+               const struct calib_profile *profile);
+
+fixed_t conv_visca_to_pan(const struct conv_tables *t, unsigned int pan);
+fixed_t conv_visca_to_tilt(const struct conv_tables *t, unsigned int tilt);
+fixed_t conv_visca_to_zoom(const struct conv_tables *t, unsigned int zoom);
+
+unsigned int conv_pan_to_visca(const struct conv_tables *t, fixed_t pan);
+unsigned int conv_tilt_to_visca(const struct conv_tables *t, fixed_t tilt);
+unsigned int conv_zoom_to_visca(const struct conv_tables *t, fixed_t zoom);
+
+/* Clamp to the pan/tilt limits in degrees */
+fixed_t conv_clamp_pan(const struct conv_tables *t, fixed_t pan);
+fixed_t conv_clamp_tilt(const struct conv_tables *t, fixed_t tilt);
+
+/* Write value as count 0x0n nibbles, most significant first */
+void conv_put_nibbles(unsigned char *buf, unsigned int value, int count);
+
+#endif // INCLUSION_GUARD_CONV_H
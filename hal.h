@@ -0,0 +1,98 @@
+#ifndef INCLUSION_GUARD_HAL_H
+#define INCLUSION_GUARD_HAL_H
+
+#include <glib.h>
+#include <fixmath.h>
+#include <axsdk/axptz.h>
+
+/*
+ * Hardware abstraction of the camera. ptz.c and param.c only talk to the
+ * camera through these functions, implemented by hal_axis.c on the camera
+ * and by hal_sim.c for host builds.
+ *
+ * Movements and presets are called from the actuation threads, one per
+ * channel and possibly at the same time for different channels, so they
+ * must not share unprotected state. Parameter writes are only called from
+ * the parameter writer thread. Status, limits, other parameter calls and
+ * HTTP are only called from the main loop.
+ */
+
+typedef void (*hal_param_callback) (const gchar *name,
+                                    const gchar *value,
+                                    gpointer user_data);
+
+/* Fills in the response body of a GET request to a CGI path */
+typedef void (*hal_http_callback) (GString *response, gpointer user_data);
+
+/* PTZ */
+gboolean hal_ptz_init(GError **error);
+void     hal_ptz_cleanup();
+
+gboolean hal_ptz_get_status(gint channel,
+                            AXPTZMovementPanTiltSpace pan_tilt_space,
+                            AXPTZMovementZoomSpace zoom_space,
+                            AXPTZStatus *status,
+                            GError **error);
+
+gboolean hal_ptz_get_limits(gint channel,
+                            AXPTZMovementPanTiltSpace pan_tilt_space,
+                            AXPTZMovementZoomSpace zoom_space,
+                            AXPTZLimits *limits,
+                            GError **error);
+
+gboolean hal_ptz_absolute_move(gint channel,
+                               fixed_t pan_value,
+                               fixed_t tilt_value,
+                               AXPTZMovementPanTiltSpace pan_tilt_space,
+                               fixed_t speed,
+                               AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                               fixed_t zoom_value,
+                               AXPTZMovementZoomSpace zoom_space,
+                               GError **error);
+
+gboolean hal_ptz_relative_move(gint channel,
+                               fixed_t pan_value,
+                               fixed_t tilt_value,
+                               AXPTZMovementPanTiltSpace pan_tilt_space,
+                               fixed_t speed,
+                               AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                               fixed_t zoom_value,
+                               AXPTZMovementZoomSpace zoom_space,
+                               GError **error);
+
+gboolean hal_ptz_continuous_start(gint channel,
+                                  fixed_t pan_speed,
+                                  fixed_t tilt_speed,
+                                  AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                                  fixed_t zoom_speed,
+                                  fixed_t timeout,
+                                  GError **error);
+
+gboolean hal_ptz_continuous_stop(gint channel,
+                                 gboolean stop_pan_tilt,
+                                 gboolean stop_zoom,
+                                 GError **error);
+
+gboolean hal_ptz_goto_home(gint channel, fixed_t speed, GError **error);
+gboolean hal_ptz_goto_preset(gint channel, gint preset, fixed_t speed,
+                             GError **error);
+gboolean hal_ptz_set_preset(gint channel, gint preset, GError **error);
+gboolean hal_ptz_remove_preset(gint channel, gint preset, GError **error);
+
+/* Parameters */
+gboolean hal_param_init(const gchar *app_name);
+void     hal_param_cleanup();
+
+gboolean hal_param_get(const gchar *name, gchar **value);  //Value is freed by caller
+gboolean hal_param_set(const gchar *name, const gchar *value);
+gboolean hal_param_register_callback(const gchar *name,
+                                     hal_param_callback callback,
+                                     gpointer user_data);
+
+/* HTTP, CGI paths served by the application */
+gboolean hal_http_register(const gchar *name,
+                           hal_http_callback callback,
+                           gpointer user_data);
+void     hal_http_cleanup();
+
+#endif // INCLUSION_GUARD_HAL_H
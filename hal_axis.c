@@ -0,0 +1,538 @@
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+#include <axsdk/axparameter.h>
+#include <axsdk/axhttp.h>
+
+#include "hal.h"
+
+/*
+ * Camera implementation of the hardware abstraction, using the axptz,
+ * axparameter and axhttp libraries of the Axis SDK.
+ */
+
+static AXPTZControlQueueGroup *ax_ptz_control_queue_group = NULL;
+static AXParameter *ax_parameter_handler = NULL;
+static AXHttpHandler *ax_http_handler = NULL;
+
+struct hal_cgi {
+  hal_http_callback callback;
+  gpointer user_data;
+};
+
+static GHashTable *cgi_paths = NULL;
+
+/*
+ * Long-lived movement objects, unit spaces are only sent when changed.
+ * The unit spaces are global to the axptz library and the objects are
+ * shared by the actuation threads of all channels, so setting spaces and
+ * values and starting the movement is done under move_lock.
+ */
+struct hal_spaces {
+  gboolean valid;
+  AXPTZMovementPanTiltSpace pan_tilt_space;
+  AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space;
+  AXPTZMovementZoomSpace zoom_space;
+};
+
+static AXPTZAbsoluteMovement *abs_movement = NULL;
+static AXPTZRelativeMovement *rel_movement = NULL;
+static AXPTZContinuousMovement *cont_movement = NULL;
+static struct hal_spaces abs_spaces;
+static struct hal_spaces rel_spaces;
+static struct hal_spaces cont_spaces;
+static GMutex move_lock;
+
+/********************************************/
+
+/*
+ * Check if the unit spaces of a movement type need to be sent
+ */
+static gboolean spaces_changed(struct hal_spaces *cached,
+                               AXPTZMovementPanTiltSpace pan_tilt_space,
+                               AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                               AXPTZMovementZoomSpace zoom_space)
+{
+  return !cached->valid ||
+    cached->pan_tilt_space != pan_tilt_space ||
+    cached->pan_tilt_speed_space != pan_tilt_speed_space ||
+    cached->zoom_space != zoom_space;
+}
+
+static void spaces_store(struct hal_spaces *cached,
+                         AXPTZMovementPanTiltSpace pan_tilt_space,
+                         AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                         AXPTZMovementZoomSpace zoom_space)
+{
+  cached->valid = TRUE;
+  cached->pan_tilt_space = pan_tilt_space;
+  cached->pan_tilt_speed_space = pan_tilt_speed_space;
+  cached->zoom_space = zoom_space;
+}
+
+gboolean hal_ptz_init(GError **error)
+{
+  /* Create the axptz library */
+  if (!(ax_ptz_create(error))) {
+    return FALSE;
+  }
+
+  /* Get the application group from the PTZ control queue */
+  if (!(ax_ptz_control_queue_group =
+       ax_ptz_control_queue_get_app_group_instance(error))) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void hal_ptz_cleanup()
+{
+  g_mutex_lock(&move_lock);
+
+  if (abs_movement) {
+    ax_ptz_absolute_movement_destroy(abs_movement, NULL);
+    abs_movement = NULL;
+  }
+
+  if (rel_movement) {
+    ax_ptz_relative_movement_destroy(rel_movement, NULL);
+    rel_movement = NULL;
+  }
+
+  if (cont_movement) {
+    ax_ptz_continuous_movement_destroy(cont_movement, NULL);
+    cont_movement = NULL;
+  }
+
+  abs_spaces.valid = FALSE;
+  rel_spaces.valid = FALSE;
+  cont_spaces.valid = FALSE;
+
+  g_mutex_unlock(&move_lock);
+}
+
+gboolean hal_ptz_get_status(gint channel,
+                            AXPTZMovementPanTiltSpace pan_tilt_space,
+                            AXPTZMovementZoomSpace zoom_space,
+                            AXPTZStatus *status,
+                            GError **error)
+{
+  AXPTZStatus *l_status = NULL;
+
+  g_assert(status);
+
+  if (!(ax_ptz_movement_handler_get_ptz_status(channel,
+                                               pan_tilt_space,
+                                               zoom_space,
+                                               &l_status,
+                                               error))) {
+    return FALSE;
+  }
+
+  *status = *l_status;
+  g_free(l_status);
+
+  return TRUE;
+}
+
+gboolean hal_ptz_get_limits(gint channel,
+                            AXPTZMovementPanTiltSpace pan_tilt_space,
+                            AXPTZMovementZoomSpace zoom_space,
+                            AXPTZLimits *limits,
+                            GError **error)
+{
+  AXPTZLimits *l_limits = NULL;
+
+  g_assert(limits);
+
+  if (!(ax_ptz_movement_handler_get_ptz_limits(channel,
+                                               pan_tilt_space,
+                                               zoom_space,
+                                               &l_limits,
+                                               error))) {
+    return FALSE;
+  }
+
+  *limits = *l_limits;
+  g_free(l_limits);
+
+  return TRUE;
+}
+
+static gboolean absolute_move(gint channel,
+                              fixed_t pan_value,
+                              fixed_t tilt_value,
+                              AXPTZMovementPanTiltSpace pan_tilt_space,
+                              fixed_t speed,
+                              AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                              fixed_t zoom_value,
+                              AXPTZMovementZoomSpace zoom_space,
+                              GError **error)
+{
+  /* Set the unit spaces for an absolute movement, if changed */
+  if (spaces_changed(&abs_spaces, pan_tilt_space, pan_tilt_speed_space,
+                     zoom_space)) {
+    if (!(ax_ptz_movement_handler_set_absolute_spaces
+         (pan_tilt_space, pan_tilt_speed_space, zoom_space, error))) {
+      abs_spaces.valid = FALSE;
+      return FALSE;
+    }
+
+    spaces_store(&abs_spaces, pan_tilt_space, pan_tilt_speed_space, zoom_space);
+  }
+
+  /* Create the absolute movement structure once, it is reused */
+  if (!abs_movement &&
+      !(abs_movement = ax_ptz_absolute_movement_create(error))) {
+    return FALSE;
+  }
+
+  /* Set the pan, tilt and zoom values for the absolute movement */
+  if (!(ax_ptz_absolute_movement_set_pan_tilt_zoom(abs_movement,
+                                                   pan_value,
+                                                   tilt_value,
+                                                   speed,
+                                                   zoom_value,
+                                                   AX_PTZ_MOVEMENT_NO_VALUE,
+                                                   error))) {
+    return FALSE;
+  }
+
+  /* Perform the absolute movement */
+  return ax_ptz_movement_handler_absolute_move(ax_ptz_control_queue_group,
+                                               channel,
+                                               abs_movement,
+                                               AX_PTZ_INVOKE_ASYNC, NULL,
+                                               NULL, error);
+}
+
+static gboolean relative_move(gint channel,
+                              fixed_t pan_value,
+                              fixed_t tilt_value,
+                              AXPTZMovementPanTiltSpace pan_tilt_space,
+                              fixed_t speed,
+                              AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                              fixed_t zoom_value,
+                              AXPTZMovementZoomSpace zoom_space,
+                              GError **error)
+{
+  /* Set the unit spaces for a relative movement, if changed */
+  if (spaces_changed(&rel_spaces, pan_tilt_space, pan_tilt_speed_space,
+                     zoom_space)) {
+    if (!(ax_ptz_movement_handler_set_relative_spaces
+         (pan_tilt_space, pan_tilt_speed_space, zoom_space, error))) {
+      rel_spaces.valid = FALSE;
+      return FALSE;
+    }
+
+    spaces_store(&rel_spaces, pan_tilt_space, pan_tilt_speed_space, zoom_space);
+  }
+
+  /* Create the relative movement structure once, it is reused */
+  if (!rel_movement &&
+      !(rel_movement = ax_ptz_relative_movement_create(error))) {
+    return FALSE;
+  }
+
+  /* Set the pan, tilt and zoom values for the relative movement */
+  if (!(ax_ptz_relative_movement_set_pan_tilt_zoom(rel_movement,
+                                                   pan_value,
+                                                   tilt_value,
+                                                   speed,
+                                                   zoom_value,
+                                                   AX_PTZ_MOVEMENT_NO_VALUE,
+                                                   error))) {
+    return FALSE;
+  }
+
+  /* Perform the relative movement */
+  return ax_ptz_movement_handler_relative_move(ax_ptz_control_queue_group,
+                                               channel,
+                                               rel_movement,
+                                               AX_PTZ_INVOKE_ASYNC, NULL,
+                                               NULL, error);
+}
+
+static gboolean continuous_start(gint channel,
+                                 fixed_t pan_speed,
+                                 fixed_t tilt_speed,
+                                 AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                                 fixed_t zoom_speed,
+                                 fixed_t timeout,
+                                 GError **error)
+{
+  /* Set the unit spaces for a continous movement, if changed */
+  if (!cont_spaces.valid ||
+      cont_spaces.pan_tilt_speed_space != pan_tilt_speed_space) {
+    if (!(ax_ptz_movement_handler_set_continuous_spaces
+         (pan_tilt_speed_space, error))) {
+      cont_spaces.valid = FALSE;
+      return FALSE;
+    }
+
+    cont_spaces.valid = TRUE;
+    cont_spaces.pan_tilt_speed_space = pan_tilt_speed_space;
+  }
+
+  /* Create the continous movement structure once, it is reused */
+  if (!cont_movement &&
+      !(cont_movement = ax_ptz_continuous_movement_create(error))) {
+    return FALSE;
+  }
+
+  /* Set the pan, tilt and zoom speeds for the continous movement */
+  if (!(ax_ptz_continuous_movement_set_pan_tilt_zoom(cont_movement,
+                                                     pan_speed,
+                                                     tilt_speed,
+                                                     zoom_speed,
+                                                     timeout,
+                                                     error))) {
+    return FALSE;
+  }
+
+  /* Perform the continous movement */
+  return ax_ptz_movement_handler_continuous_start(ax_ptz_control_queue_group,
+                                                  channel,
+                                                  cont_movement,
+                                                  AX_PTZ_INVOKE_ASYNC, NULL,
+                                                  NULL, error);
+}
+
+gboolean hal_ptz_absolute_move(gint channel,
+                               fixed_t pan_value,
+                               fixed_t tilt_value,
+                               AXPTZMovementPanTiltSpace pan_tilt_space,
+                               fixed_t speed,
+                               AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                               fixed_t zoom_value,
+                               AXPTZMovementZoomSpace zoom_space,
+                               GError **error)
+{
+  gboolean ok;
+
+  g_mutex_lock(&move_lock);
+  ok = absolute_move(channel, pan_value, tilt_value, pan_tilt_space, speed,
+                     pan_tilt_speed_space, zoom_value, zoom_space, error);
+  g_mutex_unlock(&move_lock);
+
+  return ok;
+}
+
+gboolean hal_ptz_relative_move(gint channel,
+                               fixed_t pan_value,
+                               fixed_t tilt_value,
+                               AXPTZMovementPanTiltSpace pan_tilt_space,
+                               fixed_t speed,
+                               AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                               fixed_t zoom_value,
+                               AXPTZMovementZoomSpace zoom_space,
+                               GError **error)
+{
+  gboolean ok;
+
+  g_mutex_lock(&move_lock);
+  ok = relative_move(channel, pan_value, tilt_value, pan_tilt_space, speed,
+                     pan_tilt_speed_space, zoom_value, zoom_space, error);
+  g_mutex_unlock(&move_lock);
+
+  return ok;
+}
+
+gboolean hal_ptz_continuous_start(gint channel,
+                                  fixed_t pan_speed,
+                                  fixed_t tilt_speed,
+                                  AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                                  fixed_t zoom_speed,
+                                  fixed_t timeout,
+                                  GError **error)
+{
+  gboolean ok;
+
+  g_mutex_lock(&move_lock);
+  ok = continuous_start(channel, pan_speed, tilt_speed, pan_tilt_speed_space,
+                        zoom_speed, timeout, error);
+  g_mutex_unlock(&move_lock);
+
+  return ok;
+}
+
+gboolean hal_ptz_continuous_stop(gint channel,
+                                 gboolean stop_pan_tilt,
+                                 gboolean stop_zoom,
+                                 GError **error)
+{
+  return ax_ptz_movement_handler_continuous_stop(ax_ptz_control_queue_group,
+                                                 channel,
+                                                 stop_pan_tilt,
+                                                 stop_zoom,
+                                                 AX_PTZ_INVOKE_ASYNC,
+                                                 NULL, NULL, error);
+}
+
+gboolean hal_ptz_goto_home(gint channel, fixed_t speed, GError **error)
+{
+  return ax_ptz_preset_handler_goto_home(ax_ptz_control_queue_group,
+                                         channel,
+                                         speed,
+                                         AX_PTZ_PRESET_MOVEMENT_UNITLESS,
+                                         AX_PTZ_INVOKE_ASYNC,
+                                         NULL,
+                                         NULL,
+                                         error);
+}
+
+gboolean hal_ptz_goto_preset(gint channel, gint preset, fixed_t speed,
+                             GError **error)
+{
+  return ax_ptz_preset_handler_goto_preset_number(ax_ptz_control_queue_group,
+                                                  channel,
+                                                  preset,
+                                                  speed,
+                                                  AX_PTZ_PRESET_MOVEMENT_UNITLESS,
+                                                  AX_PTZ_INVOKE_ASYNC, NULL,
+                                                  NULL, error);
+}
+
+gboolean hal_ptz_set_preset(gint channel, gint preset, GError **error)
+{
+  /* Set PTZ preset to the current camera position */
+  return ax_ptz_preset_handler_set_preset_number(ax_ptz_control_queue_group,
+                                                 channel, preset,
+                                                 FALSE, error);
+}
+
+gboolean hal_ptz_remove_preset(gint channel, gint preset, GError **error)
+{
+  return ax_ptz_preset_handler_remove_preset_number(ax_ptz_control_queue_group,
+                                                    channel,
+                                                    preset,
+                                                    error);
+}
+
+/********************************************/
+
+gboolean hal_param_init(const gchar *app_name)
+{
+  if (!ax_parameter_handler) {
+    ax_parameter_handler = ax_parameter_new(app_name, NULL);
+  }
+
+  return ax_parameter_handler != NULL;
+}
+
+void hal_param_cleanup()
+{
+  if (ax_parameter_handler) {
+    ax_parameter_free(ax_parameter_handler);
+    ax_parameter_handler = NULL;
+  }
+}
+
+gboolean hal_param_get(const gchar *name, gchar **value)
+{
+  if (!ax_parameter_handler) {
+    return FALSE;
+  }
+
+  return ax_parameter_get(ax_parameter_handler, name, value, NULL);
+}
+
+gboolean hal_param_set(const gchar *name, const gchar *value)
+{
+  if (!ax_parameter_handler) {
+    return FALSE;
+  }
+
+  return ax_parameter_set(ax_parameter_handler, name, value, TRUE, NULL);
+}
+
+gboolean hal_param_register_callback(const gchar *name,
+                                     hal_param_callback callback,
+                                     gpointer user_data)
+{
+  if (!ax_parameter_handler) {
+    return FALSE;
+  }
+
+  return ax_parameter_register_callback(ax_parameter_handler, name,
+                                        callback, user_data, NULL);
+}
+
+/********************************************/
+
+/*
+ * All CGI paths of the application end up here, dispatched on the last
+ * path component, e.g. /local/Axvisca/stats.cgi
+ */
+static void hal_http_request(const gchar *path,
+                             const gchar *method,
+                             const gchar *query,
+                             GHashTable *params,
+                             GOutputStream *output_stream,
+                             gpointer user_data)
+{
+  const gchar *name = strrchr(path, '/');
+  struct hal_cgi *cgi = g_hash_table_lookup(cgi_paths, name ? name + 1 : path);
+  GDataOutputStream *dos = g_data_output_stream_new(output_stream);
+
+  if (!cgi) {
+    g_data_output_stream_put_string(dos, "Status: 404 Not Found\r\n"
+                                    "Content-Type: text/plain\r\n\r\n"
+                                    "Not found\n", NULL, NULL);
+    g_object_unref(dos);
+    return;
+  }
+
+  GString *response = g_string_new(NULL);
+
+  cgi->callback(response, cgi->user_data);
+
+  g_data_output_stream_put_string(dos, "Content-Type: application/json\r\n\r\n",
+                                  NULL, NULL);
+  g_data_output_stream_put_string(dos, response->str, NULL, NULL);
+
+  g_string_free(response, TRUE);
+  g_object_unref(dos);
+}
+
+gboolean hal_http_register(const gchar *name,
+                           hal_http_callback callback,
+                           gpointer user_data)
+{
+  struct hal_cgi *cgi;
+
+  if (!ax_http_handler) {
+    ax_http_handler = ax_http_handler_new(hal_http_request, NULL);
+  }
+
+  if (!ax_http_handler) {
+    return FALSE;
+  }
+
+  if (!cgi_paths) {
+    cgi_paths = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  cgi = g_new0(struct hal_cgi, 1);
+  cgi->callback = callback;
+  cgi->user_data = user_data;
+
+  g_hash_table_replace(cgi_paths, g_strdup(name), cgi);
+
+  return TRUE;
+}
+
+void hal_http_cleanup()
+{
+  if (ax_http_handler) {
+    ax_http_handler_free(ax_http_handler);
+    ax_http_handler = NULL;
+  }
+
+  if (cgi_paths) {
+    g_hash_table_destroy(cgi_paths);
+    cgi_paths = NULL;
+  }
+}
@@ -0,0 +1,943 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "hal.h"
+
+/*
+ * Simulated camera used by the host build. Pan, tilt and zoom move towards
+ * their targets at configurable speeds, every call is delayed by a
+ * configurable IPC latency and parameters are kept in memory. Configured
+ * through the environment:
+ *
+ *   AXVISCA_SIM_LATENCY_US   Delay of every PTZ and parameter call
+ *   AXVISCA_SIM_PAN_SPEED    Max pan speed, degrees/s
+ *   AXVISCA_SIM_TILT_SPEED   Max tilt speed, degrees/s
+ *   AXVISCA_SIM_ZOOM_SPEED   Max zoom speed, unitless/s
+ *   AXVISCA_SIM_PAN_LIMITS   Pan range "min,max" in degrees
+ *   AXVISCA_SIM_TILT_LIMITS  Tilt range "min,max" in degrees
+ *   AXVISCA_SIM_ZOOM_LIMITS  Zoom range "min,max", unitless
+ *   AXVISCA_SIM_PARAMS       Application parameter file, default param.conf
+ *
+ * CGI paths are served on unix sockets, e.g. /tmp/axvisca-stats.cgi, read
+ * with socat - UNIX-CONNECT:/tmp/axvisca-stats.cgi
+ */
+
+/* The number of fractional bits used in fix-point variables */
+#define FIXMATH_FRAC_BITS 16
+
+#define HAL_SIM_MAX_CHANNELS (4)
+#define HAL_SIM_MAX_PRESETS (256)
+
+#define HAL_SIM_PAN_SPEED_DEFAULT (100.0f)
+#define HAL_SIM_TILT_SPEED_DEFAULT (100.0f)
+#define HAL_SIM_ZOOM_SPEED_DEFAULT (5000.0f)
+
+struct sim_axis {
+  float pos;
+  float min;
+  float max;
+  float max_speed;
+  float velocity;  /* Continuous movement, per second */
+  float target;
+  float speed;     /* Movement towards target, per second */
+  gboolean to_target;
+  gint64 stop_time;
+  gint64 time;     /* Time of pos */
+};
+
+struct sim_preset {
+  gboolean valid;
+  float pan;
+  float tilt;
+  float zoom;
+};
+
+struct sim_channel {
+  struct sim_axis pan;
+  struct sim_axis tilt;
+  struct sim_axis zoom;
+  struct sim_preset presets[HAL_SIM_MAX_PRESETS];
+};
+
+struct sim_param_callback {
+  gchar *key;
+  hal_param_callback callback;
+  gpointer user_data;
+};
+
+struct sim_param_update {
+  hal_param_callback callback;
+  gpointer user_data;
+  gchar *name;
+  gchar *value;
+};
+
+static GMutex sim_lock;
+static GMutex sim_param_lock;   /* Written from the parameter writer */
+static struct sim_channel channels[HAL_SIM_MAX_CHANNELS];
+static gulong sim_latency_us = 0;
+
+static gchar *sim_app_name = NULL;
+static GHashTable *sim_params = NULL;
+static GList *sim_param_callbacks = NULL;
+
+struct sim_cgi {
+  gchar *path;
+  int s;
+  guint watch;
+  hal_http_callback callback;
+  gpointer user_data;
+};
+
+static GList *sim_cgis = NULL;
+
+/********************************************/
+
+static GQuark sim_error_quark()
+{
+  return g_quark_from_static_string("hal-sim");
+}
+
+/*
+ * Every call to the camera goes through IPC on the real device
+ */
+static void sim_ipc()
+{
+  if (sim_latency_us > 0) {
+    g_usleep(sim_latency_us);
+  }
+}
+
+static float sim_env_float(const gchar *name, float fallback)
+{
+  const gchar *value = g_getenv(name);
+
+  return value ? (float) g_ascii_strtod(value, NULL) : fallback;
+}
+
+static void sim_env_range(const gchar *name, float *min, float *max)
+{
+  const gchar *value = g_getenv(name);
+  gchar *end = NULL;
+
+  if (!value) {
+    return;
+  }
+
+  float l_min = (float) g_ascii_strtod(value, &end);
+
+  if (!end || *end != ',') {
+    g_printf("Invalid range %s=%s, expected min,max\n", name, value);
+    return;
+  }
+
+  float l_max = (float) g_ascii_strtod(end + 1, NULL);
+
+  if (l_min >= l_max) {
+    g_printf("Invalid range %s=%s, expected min,max\n", name, value);
+    return;
+  }
+
+  *min = l_min;
+  *max = l_max;
+}
+
+static struct sim_channel *sim_channel_get(gint channel, GError **error)
+{
+  if (channel < 1 || channel > HAL_SIM_MAX_CHANNELS) {
+    g_set_error(error, sim_error_quark(), 0, "No such channel %d", channel);
+    return NULL;
+  }
+
+  return &channels[channel - 1];
+}
+
+/*
+ * Move the axis forward to the current time
+ */
+static void sim_axis_update(struct sim_axis *axis, gint64 now)
+{
+  if (axis->velocity != 0.0f) {
+    gint64 end = MIN(now, axis->stop_time);
+
+    if (end > axis->time) {
+      axis->pos += axis->velocity * (end - axis->time) / G_USEC_PER_SEC;
+    }
+
+    if (axis->pos <= axis->min || axis->pos >= axis->max ||
+        now >= axis->stop_time) {
+      axis->velocity = 0.0f;
+    }
+  } else if (axis->to_target) {
+    float step = axis->speed * (now - axis->time) / G_USEC_PER_SEC;
+    float distance = axis->target - axis->pos;
+
+    if (fabsf(distance) <= step) {
+      axis->pos = axis->target;
+      axis->to_target = FALSE;
+    } else {
+      axis->pos += distance > 0 ? step : -step;
+    }
+  }
+
+  axis->pos = CLAMP(axis->pos, axis->min, axis->max);
+  axis->time = now;
+}
+
+static void sim_axis_move_to(struct sim_axis *axis, float target, float speed,
+                             gint64 now)
+{
+  sim_axis_update(axis, now);
+
+  axis->velocity = 0.0f;
+  axis->target = CLAMP(target, axis->min, axis->max);
+  axis->speed = speed > 0.0f ? MIN(speed, axis->max_speed) : axis->max_speed;
+  axis->to_target = TRUE;
+}
+
+static void sim_axis_drive(struct sim_axis *axis, float velocity,
+                           gint64 timeout_us, gint64 now)
+{
+  sim_axis_update(axis, now);
+
+  axis->to_target = FALSE;
+  axis->velocity = CLAMP(velocity, -axis->max_speed, axis->max_speed);
+  axis->stop_time = now + timeout_us;
+}
+
+static void sim_axis_stop(struct sim_axis *axis, gint64 now)
+{
+  sim_axis_update(axis, now);
+
+  axis->velocity = 0.0f;
+  axis->to_target = FALSE;
+}
+
+/*
+ * Pan and tilt are kept in degrees, unitless is -1 to 1 over the limits
+ */
+static float sim_to_degrees(struct sim_axis *axis, fixed_t value,
+                            AXPTZMovementPanTiltSpace space)
+{
+  float f = fx_xtof(value, FIXMATH_FRAC_BITS);
+
+  if (space == AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS) {
+    return axis->min + (f + 1.0f) / 2.0f * (axis->max - axis->min);
+  }
+
+  return f;
+}
+
+static fixed_t sim_from_degrees(struct sim_axis *axis, float degrees,
+                                AXPTZMovementPanTiltSpace space)
+{
+  if (space == AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS) {
+    degrees = (degrees - axis->min) / (axis->max - axis->min) * 2.0f - 1.0f;
+  }
+
+  return fx_ftox(degrees, FIXMATH_FRAC_BITS);
+}
+
+/*
+ * Speed of a pan or tilt axis, unitless is a fraction of the max speed
+ */
+static float sim_speed(struct sim_axis *axis, fixed_t speed,
+                       AXPTZMovementPanTiltSpeedSpace space)
+{
+  float f = fx_xtof(speed, FIXMATH_FRAC_BITS);
+
+  if (space == AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS) {
+    return f * axis->max_speed;
+  }
+
+  return f;
+}
+
+static void sim_axis_init(struct sim_axis *axis, float min, float max,
+                          float max_speed, float pos, gint64 now)
+{
+  memset(axis, 0, sizeof(*axis));
+
+  axis->min = min;
+  axis->max = max;
+  axis->max_speed = max_speed;
+  axis->pos = CLAMP(pos, min, max);
+  axis->time = now;
+}
+
+/********************************************/
+
+gboolean hal_ptz_init(GError **error)
+{
+  float pan_min = -170.0f, pan_max = 170.0f;
+  float tilt_min = -90.0f, tilt_max = 90.0f;
+  float zoom_min = 1.0f, zoom_max = 9999.0f;
+  gint64 now = g_get_monotonic_time();
+  int i;
+
+  sim_latency_us = (gulong) MAX(sim_env_float("AXVISCA_SIM_LATENCY_US", 0.0f), 0.0f);
+
+  sim_env_range("AXVISCA_SIM_PAN_LIMITS", &pan_min, &pan_max);
+  sim_env_range("AXVISCA_SIM_TILT_LIMITS", &tilt_min, &tilt_max);
+  sim_env_range("AXVISCA_SIM_ZOOM_LIMITS", &zoom_min, &zoom_max);
+
+  float pan_speed = sim_env_float("AXVISCA_SIM_PAN_SPEED",
+                                  HAL_SIM_PAN_SPEED_DEFAULT);
+  float tilt_speed = sim_env_float("AXVISCA_SIM_TILT_SPEED",
+                                   HAL_SIM_TILT_SPEED_DEFAULT);
+  float zoom_speed = sim_env_float("AXVISCA_SIM_ZOOM_SPEED",
+                                   HAL_SIM_ZOOM_SPEED_DEFAULT);
+
+  g_mutex_lock(&sim_lock);
+  for (i = 0; i < HAL_SIM_MAX_CHANNELS; i++) {
+    sim_axis_init(&channels[i].pan, pan_min, pan_max, pan_speed, 0.0f, now);
+    sim_axis_init(&channels[i].tilt, tilt_min, tilt_max, tilt_speed, 0.0f, now);
+    sim_axis_init(&channels[i].zoom, zoom_min, zoom_max, zoom_speed, zoom_min,
+                  now);
+    memset(channels[i].presets, 0, sizeof(channels[i].presets));
+  }
+  g_mutex_unlock(&sim_lock);
+
+  g_printf("Simulated PTZ, pan %.1f..%.1f at %.1f/s, tilt %.1f..%.1f at %.1f/s, "
+    "zoom %.1f..%.1f at %.1f/s, latency %lu us\n",
+    pan_min, pan_max, pan_speed, tilt_min, tilt_max, tilt_speed,
+    zoom_min, zoom_max, zoom_speed, sim_latency_us);
+
+  return TRUE;
+}
+
+void hal_ptz_cleanup()
+{
+}
+
+gboolean hal_ptz_get_status(gint channel,
+                            AXPTZMovementPanTiltSpace pan_tilt_space,
+                            AXPTZMovementZoomSpace zoom_space,
+                            AXPTZStatus *status,
+                            GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  gint64 now;
+
+  g_assert(status);
+
+  if (!ch) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_lock);
+  now = g_get_monotonic_time();
+  sim_axis_update(&ch->pan, now);
+  sim_axis_update(&ch->tilt, now);
+  sim_axis_update(&ch->zoom, now);
+
+  status->pan_value = sim_from_degrees(&ch->pan, ch->pan.pos, pan_tilt_space);
+  status->tilt_value = sim_from_degrees(&ch->tilt, ch->tilt.pos, pan_tilt_space);
+  status->zoom_value = fx_ftox(ch->zoom.pos, FIXMATH_FRAC_BITS);
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+gboolean hal_ptz_get_limits(gint channel,
+                            AXPTZMovementPanTiltSpace pan_tilt_space,
+                            AXPTZMovementZoomSpace zoom_space,
+                            AXPTZLimits *limits,
+                            GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+
+  g_assert(limits);
+
+  if (!ch) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_lock);
+  limits->min_pan_value = sim_from_degrees(&ch->pan, ch->pan.min, pan_tilt_space);
+  limits->max_pan_value = sim_from_degrees(&ch->pan, ch->pan.max, pan_tilt_space);
+  limits->min_tilt_value = sim_from_degrees(&ch->tilt, ch->tilt.min, pan_tilt_space);
+  limits->max_tilt_value = sim_from_degrees(&ch->tilt, ch->tilt.max, pan_tilt_space);
+  limits->min_zoom_value = fx_ftox(ch->zoom.min, FIXMATH_FRAC_BITS);
+  limits->max_zoom_value = fx_ftox(ch->zoom.max, FIXMATH_FRAC_BITS);
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+static gboolean sim_move(gint channel,
+                         gboolean relative,
+                         fixed_t pan_value,
+                         fixed_t tilt_value,
+                         AXPTZMovementPanTiltSpace pan_tilt_space,
+                         fixed_t speed,
+                         AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                         fixed_t zoom_value,
+                         GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  gint64 now;
+
+  if (!ch) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_lock);
+  now = g_get_monotonic_time();
+  sim_axis_update(&ch->pan, now);
+  sim_axis_update(&ch->tilt, now);
+  sim_axis_update(&ch->zoom, now);
+
+  if (pan_value != AX_PTZ_MOVEMENT_NO_VALUE) {
+    float pan = relative ?
+      ch->pan.pos + fx_xtof(pan_value, FIXMATH_FRAC_BITS) :
+      sim_to_degrees(&ch->pan, pan_value, pan_tilt_space);
+
+    sim_axis_move_to(&ch->pan, pan,
+                     sim_speed(&ch->pan, speed, pan_tilt_speed_space), now);
+  }
+
+  if (tilt_value != AX_PTZ_MOVEMENT_NO_VALUE) {
+    float tilt = relative ?
+      ch->tilt.pos + fx_xtof(tilt_value, FIXMATH_FRAC_BITS) :
+      sim_to_degrees(&ch->tilt, tilt_value, pan_tilt_space);
+
+    sim_axis_move_to(&ch->tilt, tilt,
+                     sim_speed(&ch->tilt, speed, pan_tilt_speed_space), now);
+  }
+
+  if (zoom_value != AX_PTZ_MOVEMENT_NO_VALUE) {
+    float zoom = fx_xtof(zoom_value, FIXMATH_FRAC_BITS);
+
+    sim_axis_move_to(&ch->zoom, relative ? ch->zoom.pos + zoom : zoom,
+                     ch->zoom.max_speed, now);
+  }
+
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+gboolean hal_ptz_absolute_move(gint channel,
+                               fixed_t pan_value,
+                               fixed_t tilt_value,
+                               AXPTZMovementPanTiltSpace pan_tilt_space,
+                               fixed_t speed,
+                               AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                               fixed_t zoom_value,
+                               AXPTZMovementZoomSpace zoom_space,
+                               GError **error)
+{
+  return sim_move(channel, FALSE, pan_value, tilt_value, pan_tilt_space,
+                  speed, pan_tilt_speed_space, zoom_value, error);
+}
+
+gboolean hal_ptz_relative_move(gint channel,
+                               fixed_t pan_value,
+                               fixed_t tilt_value,
+                               AXPTZMovementPanTiltSpace pan_tilt_space,
+                               fixed_t speed,
+                               AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                               fixed_t zoom_value,
+                               AXPTZMovementZoomSpace zoom_space,
+                               GError **error)
+{
+  /* Relative unitless pan/tilt is a fraction of the full range */
+  if (pan_tilt_space == AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS) {
+    struct sim_channel *ch = sim_channel_get(channel, error);
+
+    if (!ch) {
+      return FALSE;
+    }
+
+    if (pan_value != AX_PTZ_MOVEMENT_NO_VALUE) {
+      pan_value = fx_ftox(fx_xtof(pan_value, FIXMATH_FRAC_BITS) *
+                          (ch->pan.max - ch->pan.min) / 2.0f,
+                          FIXMATH_FRAC_BITS);
+    }
+
+    if (tilt_value != AX_PTZ_MOVEMENT_NO_VALUE) {
+      tilt_value = fx_ftox(fx_xtof(tilt_value, FIXMATH_FRAC_BITS) *
+                           (ch->tilt.max - ch->tilt.min) / 2.0f,
+                           FIXMATH_FRAC_BITS);
+    }
+  }
+
+  return sim_move(channel, TRUE, pan_value, tilt_value, pan_tilt_space,
+                  speed, pan_tilt_speed_space, zoom_value, error);
+}
+
+gboolean hal_ptz_continuous_start(gint channel,
+                                  fixed_t pan_speed,
+                                  fixed_t tilt_speed,
+                                  AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                                  fixed_t zoom_speed,
+                                  fixed_t timeout,
+                                  GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  gint64 timeout_us = (gint64) (fx_xtof(timeout, FIXMATH_FRAC_BITS) *
+                                G_USEC_PER_SEC);
+  gint64 now;
+
+  if (!ch) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_lock);
+  now = g_get_monotonic_time();
+
+  if (pan_speed != AX_PTZ_MOVEMENT_NO_VALUE) {
+    sim_axis_drive(&ch->pan, sim_speed(&ch->pan, pan_speed,
+                                       pan_tilt_speed_space),
+                   timeout_us, now);
+  }
+
+  if (tilt_speed != AX_PTZ_MOVEMENT_NO_VALUE) {
+    sim_axis_drive(&ch->tilt, sim_speed(&ch->tilt, tilt_speed,
+                                        pan_tilt_speed_space),
+                   timeout_us, now);
+  }
+
+  if (zoom_speed != AX_PTZ_MOVEMENT_NO_VALUE) {
+    sim_axis_drive(&ch->zoom, fx_xtof(zoom_speed, FIXMATH_FRAC_BITS) *
+                   ch->zoom.max_speed, timeout_us, now);
+  }
+
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+gboolean hal_ptz_continuous_stop(gint channel,
+                                 gboolean stop_pan_tilt,
+                                 gboolean stop_zoom,
+                                 GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  gint64 now;
+
+  if (!ch) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_lock);
+  now = g_get_monotonic_time();
+
+  if (stop_pan_tilt) {
+    sim_axis_stop(&ch->pan, now);
+    sim_axis_stop(&ch->tilt, now);
+  }
+
+  if (stop_zoom) {
+    sim_axis_stop(&ch->zoom, now);
+  }
+
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+static gboolean sim_goto(gint channel, float pan, float tilt, float zoom,
+                         fixed_t speed, GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  float fraction = fx_xtof(speed, FIXMATH_FRAC_BITS);
+  gint64 now;
+
+  if (!ch) {
+    return FALSE;
+  }
+
+  g_mutex_lock(&sim_lock);
+  now = g_get_monotonic_time();
+  sim_axis_move_to(&ch->pan, pan, fraction * ch->pan.max_speed, now);
+  sim_axis_move_to(&ch->tilt, tilt, fraction * ch->tilt.max_speed, now);
+  sim_axis_move_to(&ch->zoom, zoom, fraction * ch->zoom.max_speed, now);
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+gboolean hal_ptz_goto_home(gint channel, fixed_t speed, GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+
+  if (!ch) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  return sim_goto(channel, 0.0f, 0.0f, ch->zoom.min, speed, error);
+}
+
+static struct sim_preset *sim_preset_get(struct sim_channel *ch, gint preset,
+                                         GError **error)
+{
+  if (preset < 1 || preset > HAL_SIM_MAX_PRESETS) {
+    g_set_error(error, sim_error_quark(), 0, "No such preset %d", preset);
+    return NULL;
+  }
+
+  return &ch->presets[preset - 1];
+}
+
+gboolean hal_ptz_goto_preset(gint channel, gint preset, fixed_t speed,
+                             GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  struct sim_preset *p = ch ? sim_preset_get(ch, preset, error) : NULL;
+
+  if (!p) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  if (!p->valid) {
+    g_set_error(error, sim_error_quark(), 0, "Preset %d not set", preset);
+    return FALSE;
+  }
+
+  return sim_goto(channel, p->pan, p->tilt, p->zoom, speed, error);
+}
+
+gboolean hal_ptz_set_preset(gint channel, gint preset, GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  struct sim_preset *p = ch ? sim_preset_get(ch, preset, error) : NULL;
+  gint64 now;
+
+  if (!p) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_lock);
+  now = g_get_monotonic_time();
+  sim_axis_update(&ch->pan, now);
+  sim_axis_update(&ch->tilt, now);
+  sim_axis_update(&ch->zoom, now);
+
+  p->valid = TRUE;
+  p->pan = ch->pan.pos;
+  p->tilt = ch->tilt.pos;
+  p->zoom = ch->zoom.pos;
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+gboolean hal_ptz_remove_preset(gint channel, gint preset, GError **error)
+{
+  struct sim_channel *ch = sim_channel_get(channel, error);
+  struct sim_preset *p = ch ? sim_preset_get(ch, preset, error) : NULL;
+
+  if (!p) {
+    return FALSE;
+  }
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_lock);
+  p->valid = FALSE;
+  g_mutex_unlock(&sim_lock);
+
+  return TRUE;
+}
+
+/********************************************/
+
+/*
+ * Parameters are stored without "root.", application parameters are
+ * prefixed with the application name like on the camera.
+ */
+static gchar *sim_param_key(const gchar *name)
+{
+  if (g_str_has_prefix(name, "root.")) {
+    name += strlen("root.");
+  }
+
+  if (!strchr(name, '.')) {
+    return g_strdup_printf("%s.%s", sim_app_name, name);
+  }
+
+  return g_strdup(name);
+}
+
+/*
+ * Load application parameter defaults from a param.conf style file,
+ * one Name="value" per line
+ */
+static void sim_param_load(const gchar *path)
+{
+  gchar line[256];
+  FILE *f = fopen(path, "r");
+
+  if (!f) {
+    g_printf("No parameter file %s, using built-in defaults\n", path);
+    return;
+  }
+
+  while (fgets(line, sizeof(line), f)) {
+    gchar *eq = strchr(line, '=');
+    gchar *start = eq ? strchr(eq, '"') : NULL;
+    gchar *end = start ? strchr(start + 1, '"') : NULL;
+
+    if (!end) {
+      continue;
+    }
+
+    *eq = '\0';
+    *end = '\0';
+
+    g_hash_table_replace(sim_params,
+                         g_strdup_printf("%s.%s", sim_app_name, line),
+                         g_strdup(start + 1));
+  }
+
+  fclose(f);
+}
+
+gboolean hal_param_init(const gchar *app_name)
+{
+  const gchar *path = g_getenv("AXVISCA_SIM_PARAMS");
+
+  if (sim_params) {
+    return TRUE;
+  }
+
+  sim_app_name = g_strdup(app_name);
+  sim_params = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  /* Camera parameters read by the application */
+  g_hash_table_replace(sim_params,
+                       g_strdup("ImageSource.I0.Sensor.VideoRotation"),
+                       g_strdup("0"));
+  g_hash_table_replace(sim_params, g_strdup("PTZ.Various.V1.AutoFocus"),
+                       g_strdup("true"));
+  g_hash_table_replace(sim_params, g_strdup("PTZ.BoaProtPTZOperator"),
+                       g_strdup(""));
+  g_hash_table_replace(sim_params, g_strdup("Brand.ProdNbr"),
+                       g_strdup("Simulator"));
+
+  sim_param_load(path ? path : "param.conf");
+
+  return TRUE;
+}
+
+void hal_param_cleanup()
+{
+  while (sim_param_callbacks) {
+    struct sim_param_callback *cb = sim_param_callbacks->data;
+
+    sim_param_callbacks = g_list_delete_link(sim_param_callbacks,
+                                             sim_param_callbacks);
+    g_free(cb->key);
+    g_free(cb);
+  }
+
+  if (sim_params) {
+    g_hash_table_destroy(sim_params);
+    sim_params = NULL;
+  }
+
+  g_free(sim_app_name);
+  sim_app_name = NULL;
+}
+
+gboolean hal_param_get(const gchar *name, gchar **value)
+{
+  gchar *key = sim_param_key(name);
+  const gchar *stored;
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_param_lock);
+  stored = g_hash_table_lookup(sim_params, key);
+  *value = stored ? g_strdup(stored) : NULL;
+  g_mutex_unlock(&sim_param_lock);
+  g_free(key);
+
+  return *value != NULL;
+}
+
+/*
+ * Parameter callbacks are invoked from the main loop, as on the camera
+ */
+static gboolean sim_param_notify(gpointer data)
+{
+  struct sim_param_update *update = data;
+
+  update->callback(update->name, update->value, update->user_data);
+
+  g_free(update->name);
+  g_free(update->value);
+  g_free(update);
+
+  return G_SOURCE_REMOVE;
+}
+
+gboolean hal_param_set(const gchar *name, const gchar *value)
+{
+  gchar *key = sim_param_key(name);
+  GList *it;
+
+  sim_ipc();
+
+  g_mutex_lock(&sim_param_lock);
+
+  for (it = sim_param_callbacks; it; it = it->next) {
+    struct sim_param_callback *cb = it->data;
+
+    if (strcmp(cb->key, key) == 0) {
+      struct sim_param_update *update = g_new0(struct sim_param_update, 1);
+
+      update->callback = cb->callback;
+      update->user_data = cb->user_data;
+      update->name = g_strdup_printf("root.%s", key);
+      update->value = g_strdup(value);
+
+      g_idle_add(sim_param_notify, update);
+    }
+  }
+
+  g_hash_table_replace(sim_params, key, g_strdup(value));
+
+  g_mutex_unlock(&sim_param_lock);
+
+  return TRUE;
+}
+
+gboolean hal_param_register_callback(const gchar *name,
+                                     hal_param_callback callback,
+                                     gpointer user_data)
+{
+  struct sim_param_callback *cb = g_new0(struct sim_param_callback, 1);
+
+  cb->key = sim_param_key(name);
+  cb->callback = callback;
+  cb->user_data = user_data;
+
+  g_mutex_lock(&sim_param_lock);
+  sim_param_callbacks = g_list_append(sim_param_callbacks, cb);
+  g_mutex_unlock(&sim_param_lock);
+
+  return TRUE;
+}
+
+/********************************************/
+
+/*
+ * One request per connection, the response is written and the connection
+ * closed
+ */
+static gboolean sim_cgi_accept(GIOChannel *source,
+                               GIOCondition cond,
+                               gpointer data)
+{
+  struct sim_cgi *cgi = data;
+  int c = accept(cgi->s, NULL, NULL);
+
+  if (c < 0) {
+    return TRUE;
+  }
+
+  GString *response = g_string_new(NULL);
+  gsize offset = 0;
+
+  cgi->callback(response, cgi->user_data);
+
+  while (offset < response->len) {
+    ssize_t sent = write(c, response->str + offset, response->len - offset);
+
+    if (sent < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    offset += sent;
+  }
+
+  g_string_free(response, TRUE);
+  close(c);
+
+  return TRUE;
+}
+
+gboolean hal_http_register(const gchar *name,
+                           hal_http_callback callback,
+                           gpointer user_data)
+{
+  struct sockaddr_un addr;
+  gchar *path = g_strdup_printf("%s/axvisca-%s", g_get_tmp_dir(), name);
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  g_strlcpy(addr.sun_path, path, sizeof(addr.sun_path));
+  unlink(path);
+
+  if (s < 0 || bind(s, (const struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(s, 4) < 0) {
+    g_printf("Could not serve %s on %s: %s\n", name, path, strerror(errno));
+    if (s >= 0) {
+      close(s);
+    }
+    g_free(path);
+    return FALSE;
+  }
+
+  struct sim_cgi *cgi = g_new0(struct sim_cgi, 1);
+  GIOChannel *channel = g_io_channel_unix_new(s);
+
+  cgi->path = path;
+  cgi->s = s;
+  cgi->callback = callback;
+  cgi->user_data = user_data;
+  cgi->watch = g_io_add_watch(channel, G_IO_IN, sim_cgi_accept, cgi);
+  g_io_channel_unref(channel);
+
+  sim_cgis = g_list_append(sim_cgis, cgi);
+
+  g_printf("Serving %s on %s\n", name, path);
+
+  return TRUE;
+}
+
+void hal_http_cleanup()
+{
+  while (sim_cgis) {
+    struct sim_cgi *cgi = sim_cgis->data;
+
+    sim_cgis = g_list_delete_link(sim_cgis, sim_cgis);
+    g_source_remove(cgi->watch);
+    close(cgi->s);
+    unlink(cgi->path);
+    g_free(cgi->path);
+    g_free(cgi);
+  }
+}
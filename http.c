@@ -0,0 +1,530 @@
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "http.h"
+
+/*
+ * Minimal HTTP/1.1 client used for the local VAPIX endpoints. One connection
+ * is kept alive and requests are sent one at a time from the main loop.
+ * Requests to the same parameter that have not been sent yet are coalesced,
+ * only the latest value is sent.
+ */
+
+#define HTTP_MAX_QUEUED (32)
+#define HTTP_RX_CHUNK_SIZE (1024)
+
+enum http_state {
+  HTTP_DISCONNECTED,
+  HTTP_CONNECTING,
+  HTTP_SENDING,
+  HTTP_RECEIVING,
+  HTTP_CONNECTED
+};
+
+struct http_request {
+  gchar *path;
+  gint64 queued_time;
+  gboolean retried;
+};
+
+static gchar *http_host = NULL;
+static struct sockaddr_in http_addr;
+
+static int http_fd = -1;
+static GIOChannel *http_channel = NULL;
+static guint http_watch = 0;
+static enum http_state http_state = HTTP_DISCONNECTED;
+
+static GQueue http_queue;
+static struct http_request *http_current = NULL;
+
+static GString *http_tx = NULL;
+static gsize http_tx_offset = 0;
+static GString *http_rx = NULL;
+
+static struct http_stats stats;
+
+static void http_kick();
+static void http_send_some();
+static gboolean http_io_callback(GIOChannel *source,
+                                 GIOCondition cond,
+                                 gpointer data);
+
+/********************************************/
+
+static void http_request_free(struct http_request *request)
+{
+  g_free(request->path);
+  g_free(request);
+}
+
+static void http_watch_fd(GIOCondition cond)
+{
+  if (http_watch) {
+    g_source_remove(http_watch);
+  }
+
+  http_watch = g_io_add_watch(http_channel, cond | G_IO_ERR | G_IO_HUP,
+                              http_io_callback, NULL);
+}
+
+static void http_close()
+{
+  if (http_watch) {
+    g_source_remove(http_watch);
+    http_watch = 0;
+  }
+
+  if (http_channel) {
+    g_io_channel_unref(http_channel);
+    http_channel = NULL;
+  }
+
+  if (http_fd >= 0) {
+    close(http_fd);
+    http_fd = -1;
+  }
+
+  http_state = HTTP_DISCONNECTED;
+}
+
+/*
+ * Finish the request in flight, keep the connection if allowed
+ */
+static void http_finish(gboolean success, int status, gboolean keep_alive)
+{
+  struct http_request *request = http_current;
+  gint64 latency = g_get_monotonic_time() - request->queued_time;
+
+  http_current = NULL;
+
+  if (success) {
+    stats.requests++;
+    stats.last_latency_us = latency;
+    stats.total_latency_us += latency;
+    stats.max_latency_us = MAX(stats.max_latency_us, latency);
+  } else {
+    stats.failures++;
+    g_printf("HTTP request %s failed, status %d\n", request->path, status);
+  }
+
+#ifdef VERBOSE
+  g_printf("HTTP request %s done in %lld us, status %d\n", request->path,
+    (long long) latency, status);
+#endif
+
+  http_request_free(request);
+
+  if (keep_alive && http_state != HTTP_DISCONNECTED) {
+    /* Watch for the server closing the idle connection */
+    http_state = HTTP_CONNECTED;
+    http_watch_fd(G_IO_IN);
+  } else {
+    http_close();
+  }
+
+  http_kick();
+}
+
+/*
+ * Connection failed or was closed by the server. A request on a reused
+ * connection that got no response at all is retried once on a new one.
+ */
+static void http_fail()
+{
+  http_close();
+
+  if (http_current && !http_current->retried && http_rx->len == 0) {
+    http_current->retried = TRUE;
+    g_queue_push_head(&http_queue, http_current);
+    http_current = NULL;
+    http_kick();
+    return;
+  }
+
+  if (http_current) {
+    http_finish(FALSE, 0, FALSE);
+  }
+}
+
+static void http_connect()
+{
+  http_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+  if (http_fd < 0) {
+    g_printf("Could not create HTTP socket!\n");
+    http_fail();
+    return;
+  }
+
+  int one = 1;
+  setsockopt(http_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  fcntl(http_fd, F_SETFL, fcntl(http_fd, F_GETFL) | O_NONBLOCK);
+
+  http_channel = g_io_channel_unix_new(http_fd);
+  stats.connects++;
+
+  if (connect(http_fd, (const struct sockaddr *) &http_addr,
+              sizeof(http_addr)) == 0) {
+    http_send_some();
+  } else if (errno == EINPROGRESS) {
+    http_state = HTTP_CONNECTING;
+    http_watch_fd(G_IO_OUT);
+  } else {
+    g_printf("Failed to connect to HTTP server: %s\n", strerror(errno));
+    http_fail();
+  }
+}
+
+static void http_send_some()
+{
+  http_state = HTTP_SENDING;
+
+  while (http_tx_offset < http_tx->len) {
+    ssize_t sent = send(http_fd, http_tx->str + http_tx_offset,
+                        http_tx->len - http_tx_offset, MSG_NOSIGNAL);
+
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        http_watch_fd(G_IO_OUT);
+        return;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      http_fail();
+      return;
+    }
+
+    http_tx_offset += sent;
+  }
+
+  http_state = HTTP_RECEIVING;
+  g_string_truncate(http_rx, 0);
+  http_watch_fd(G_IO_IN);
+}
+
+/*
+ * Start the next queued request if none is in flight
+ */
+static void http_kick()
+{
+  if (http_current || g_queue_is_empty(&http_queue)) {
+    return;
+  }
+
+  http_current = g_queue_pop_head(&http_queue);
+
+  g_string_truncate(http_tx, 0);
+  g_string_append_printf(http_tx,
+                         "GET %s HTTP/1.1\r\n"
+                         "Host: %s\r\n"
+                         "Connection: keep-alive\r\n"
+                         "\r\n",
+                         http_current->path, http_host);
+  http_tx_offset = 0;
+  g_string_truncate(http_rx, 0);
+
+  if (http_state == HTTP_CONNECTED) {
+    http_send_some();
+  } else {
+    http_connect();
+  }
+}
+
+/*
+ * Parse received data. Returns 1 when the full response is received, 0 if
+ * more data is needed and -1 on malformed responses. Bodies without length
+ * are complete when the server closes the connection (at_eof).
+ */
+static int http_parse_response(gboolean at_eof, int *status,
+                               gboolean *keep_alive)
+{
+  gchar *rx = http_rx->str;
+  gchar *header_end = g_strstr_len(rx, http_rx->len, "\r\n\r\n");
+  int minor_version;
+
+  if (!header_end) {
+    return at_eof ? -1 : 0;
+  }
+
+  if (sscanf(rx, "HTTP/1.%d %d", &minor_version, status) != 2) {
+    return -1;
+  }
+
+  gsize header_len = (header_end - rx) + 4;
+  gssize content_length = -1;
+  gboolean chunked = FALSE;
+
+  *keep_alive = (minor_version >= 1);
+
+  gchar *line = strstr(rx, "\r\n") + 2;
+  while (line < header_end) {
+    gchar *eol = strstr(line, "\r\n");
+
+    if (g_ascii_strncasecmp(line, "Content-Length:", 15) == 0) {
+      content_length = g_ascii_strtoll(line + 15, NULL, 10);
+    } else if (g_ascii_strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+      chunked = (g_strstr_len(line, eol - line, "chunked") != NULL);
+    } else if (g_ascii_strncasecmp(line, "Connection:", 11) == 0) {
+      if (g_strstr_len(line, eol - line, "close")) {
+        *keep_alive = FALSE;
+      } else if (g_strstr_len(line, eol - line, "keep-alive")) {
+        *keep_alive = TRUE;
+      }
+    }
+
+    line = eol + 2;
+  }
+
+  /* No body */
+  if (*status == 204 || *status == 304 || *status / 100 == 1) {
+    return 1;
+  }
+
+  if (chunked) {
+    gsize pos = header_len;
+
+    for (;;) {
+      gchar *size_end = g_strstr_len(rx + pos, http_rx->len - pos, "\r\n");
+      if (!size_end) {
+        return at_eof ? -1 : 0;
+      }
+
+      gsize chunk_size = g_ascii_strtoull(rx + pos, NULL, 16);
+      pos = (size_end - rx) + 2;
+
+      if (chunk_size == 0) {
+        /* Last chunk, wait for end of (empty) trailer */
+        if (g_strstr_len(rx + pos - 2, http_rx->len - pos + 2, "\r\n\r\n")) {
+          return 1;
+        }
+        return at_eof ? -1 : 0;
+      }
+
+      pos += chunk_size + 2;
+      if (pos > http_rx->len) {
+        return at_eof ? -1 : 0;
+      }
+    }
+  }
+
+  if (content_length >= 0) {
+    if (http_rx->len >= header_len + content_length) {
+      return 1;
+    }
+    return at_eof ? -1 : 0;
+  }
+
+  /* Body delimited by connection close */
+  *keep_alive = FALSE;
+  return at_eof ? 1 : 0;
+}
+
+static void http_receive()
+{
+  gboolean at_eof = FALSE;
+  gchar chunk[HTTP_RX_CHUNK_SIZE];
+
+  for (;;) {
+    ssize_t received = recv(http_fd, chunk, sizeof(chunk), 0);
+
+    if (received > 0) {
+      g_string_append_len(http_rx, chunk, received);
+      continue;
+    }
+
+    if (received == 0) {
+      at_eof = TRUE;
+      break;
+    }
+
+    if (errno == EINTR) {
+      continue;
+    }
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    }
+
+    http_fail();
+    return;
+  }
+
+  /* Server closed idle connection, nothing in flight */
+  if (!http_current) {
+    if (at_eof) {
+      http_close();
+    }
+    return;
+  }
+
+  if (at_eof && http_rx->len == 0) {
+    http_fail();
+    return;
+  }
+
+  int status = 0;
+  gboolean keep_alive = TRUE;
+  int ret = http_parse_response(at_eof, &status, &keep_alive);
+
+  if (ret == 0) {
+    return;
+  }
+
+  if (ret < 0) {
+    g_printf("Malformed HTTP response\n");
+    http_close();
+    http_finish(FALSE, 0, FALSE);
+    return;
+  }
+
+  http_finish(status / 100 == 2, status, keep_alive && !at_eof);
+}
+
+static gboolean http_io_callback(GIOChannel *source,
+                                 GIOCondition cond,
+                                 gpointer data)
+{
+  int error = 0;
+  socklen_t error_len = sizeof(error);
+
+  /* Watch is always re-armed by the state handlers below */
+  http_watch = 0;
+
+  switch (http_state) {
+  case HTTP_CONNECTING:
+    if (getsockopt(http_fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 ||
+        error != 0) {
+      g_printf("Failed to connect to HTTP server: %s\n", strerror(error));
+      http_fail();
+    } else {
+      http_send_some();
+    }
+    break;
+  case HTTP_SENDING:
+    http_send_some();
+    break;
+  case HTTP_RECEIVING:
+  case HTTP_CONNECTED:
+    http_receive();
+    if (http_state == HTTP_RECEIVING || http_state == HTTP_CONNECTED) {
+      if (!http_watch) {
+        http_watch_fd(G_IO_IN);
+      }
+    }
+    break;
+  default:
+    break;
+  }
+
+  return FALSE;
+}
+
+/********************************************/
+
+int http_init(const char *host, int port)
+{
+  memset(&http_addr, 0, sizeof(http_addr));
+
+  http_addr.sin_family = AF_INET;
+  http_addr.sin_port = htons(port);
+
+  if (inet_pton(AF_INET, host, &http_addr.sin_addr) != 1) {
+    g_printf("Invalid HTTP server address %s\n", host);
+    return -1;
+  }
+
+  http_host = g_strdup(host);
+  http_tx = g_string_new(NULL);
+  http_rx = g_string_new(NULL);
+  g_queue_init(&http_queue);
+
+  return 0;
+}
+
+void http_get(const char *path)
+{
+  g_assert(path);
+
+  /* Drop a queued request for the same parameter, latest value wins. The
+     new one goes to the tail so it stays ordered after requests queued in
+     between. The parameter is the last one of the query, earlier ones such
+     as the camera are part of the key. */
+  const char *value = strrchr(path, '=');
+  gsize key_len = value ? (gsize) (value - path) : strlen(path);
+  GList *it;
+
+  for (it = http_queue.head; it; it = it->next) {
+    struct http_request *queued = it->data;
+
+    if (strncmp(queued->path, path, key_len) == 0 &&
+        (queued->path[key_len] == '=' || queued->path[key_len] == '\0')) {
+      g_queue_delete_link(&http_queue, it);
+      http_request_free(queued);
+      stats.coalesced++;
+      break;
+    }
+  }
+
+  if (http_queue.length >= HTTP_MAX_QUEUED) {
+    g_printf("HTTP queue full, dropping request %s\n", path);
+    stats.failures++;
+    return;
+  }
+
+  struct http_request *request = g_new0(struct http_request, 1);
+  request->path = g_strdup(path);
+  request->queued_time = g_get_monotonic_time();
+
+  g_queue_push_tail(&http_queue, request);
+
+  http_kick();
+}
+
+void http_get_stats(struct http_stats *out)
+{
+  g_assert(out);
+
+  *out = stats;
+}
+
+void http_cleanup()
+{
+  http_close();
+
+  if (http_current) {
+    http_request_free(http_current);
+    http_current = NULL;
+  }
+
+  struct http_request *request;
+  while ((request = g_queue_pop_head(&http_queue))) {
+    http_request_free(request);
+  }
+
+  if (http_tx) {
+    g_string_free(http_tx, TRUE);
+    http_tx = NULL;
+  }
+
+  if (http_rx) {
+    g_string_free(http_rx, TRUE);
+    http_rx = NULL;
+  }
+
+  g_free(http_host);
+  http_host = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef INCLUSION_GUARD_HTTP_H
+#define INCLUSION_GUARD_HTTP_H
+
+#include <glib.h>
+
+struct http_stats {
+  guint64 requests;
+  guint64 failures;
+  guint64 coalesced;
+  guint64 connects;
+  gint64 last_latency_us;
+  gint64 max_latency_us;
+  gint64 total_latency_us;
+};
+
+int  http_init(const char *host, int port);
+void http_get(const char *path); //Queues request, sent asynchronously from the main loop
+void http_get_stats(struct http_stats *stats);
+void http_cleanup();
+
+#endif // INCLUSION_GUARD_HTTP_H
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include "logring.h"
+
+/*
+ * Entries are claimed with an atomic increment of the head, so any thread
+ * may record. The sequence number is cleared while an entry is written and
+ * set to its position plus one afterwards, readers skip entries that are
+ * being written or have been overwritten while they were read.
+ */
+
+#define LOGRING_MASK (LOGRING_SIZE - 1)
+#define LOGRING_LINE_SIZE (256)
+
+struct logring_entry {
+  guint seq;
+  guint8 level;
+  guint8 num_args;
+  guint8 types[LOGRING_MAX_ARGS];
+  gint64 time;
+  const char *fmt;
+  union {
+    gint64 i;
+    gdouble d;
+    const char *s;
+    const void *p;
+  } args[LOGRING_MAX_ARGS];
+};
+
+static struct logring_entry ring[LOGRING_SIZE];
+static guint head = 0;
+
+static guint usr1_source = 0;
+
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+static const char level_chars[] = { 'E', 'W', 'I', 'D', 'T' };
+
+static gboolean logring_read(guint pos, struct logring_entry *copy);
+static int logring_format(const struct logring_entry *entry,
+                          char *line, size_t size);
+
+/********************************************/
+
+void logring_record(int level, const char *fmt,
+                    int num_args, const struct logring_arg *args)
+{
+  guint pos = (guint) g_atomic_int_add((gint *) &head, 1);
+  struct logring_entry *entry = &ring[pos & LOGRING_MASK];
+  int i;
+
+  g_atomic_int_set((gint *) &entry->seq, 0);
+
+  entry->level = level;
+  entry->num_args = MIN(num_args, LOGRING_MAX_ARGS);
+  entry->time = g_get_monotonic_time();
+  entry->fmt = fmt;
+
+  for (i = 0; i < entry->num_args; i++) {
+    entry->types[i] = args[i].type;
+    entry->args[i].i = args[i].v.i;
+  }
+
+  g_atomic_int_set((gint *) &entry->seq, pos + 1);
+
+  /* Errors and warnings are rare, they are also printed right away */
+  if (level <= LOGRING_LEVEL_WARN) {
+    struct logring_entry copy;
+    char line[LOGRING_LINE_SIZE];
+
+    if (logring_read(pos, &copy) &&
+        write(STDOUT_FILENO, line,
+              logring_format(&copy, line, sizeof(line))) < 0) {
+      return;
+    }
+  }
+}
+
+/*
+ * Format one entry, converting the arguments to what each conversion
+ * asks for. Length modifiers of the format are not needed since all
+ * integers are stored as 64 bits.
+ */
+static int logring_format(const struct logring_entry *entry,
+                          char *line, size_t size)
+{
+  const char *f = entry->fmt;
+  size_t len;
+  int arg = 0;
+
+  len = snprintf(line, size, "[%6lld.%06lld] %c ",
+                 (long long) (entry->time / G_USEC_PER_SEC),
+                 (long long) (entry->time % G_USEC_PER_SEC),
+                 level_chars[MIN(entry->level, LOGRING_LEVEL_TRACE)]);
+
+  while (*f && len < size - 1) {
+    char spec[32];
+    size_t n = 0;
+    int ret;
+
+    if (*f != '%') {
+      line[len++] = *f++;
+      continue;
+    }
+
+    if (f[1] == '%') {
+      line[len++] = '%';
+      f += 2;
+      continue;
+    }
+
+    /* Flags, width and precision are kept */
+    spec[n++] = *f++;
+    while (*f && strchr("-+ #0123456789.", *f) && n < sizeof(spec) - 4) {
+      spec[n++] = *f++;
+    }
+
+    while (*f && strchr("hlLqjzt", *f)) {
+      f++;
+    }
+
+    if (!*f) {
+      break;
+    }
+
+    gint64 i = arg < entry->num_args ? entry->args[arg].i : 0;
+    guint8 type = arg < entry->num_args ?
+      entry->types[arg] : LOGRING_ARG_INT;
+    gdouble d = type == LOGRING_ARG_DOUBLE ? entry->args[arg].d : (gdouble) i;
+    char conv = *f++;
+
+    arg++;
+
+    switch (conv) {
+    case 'd':
+    case 'i':
+      memcpy(&spec[n], "ll", 2);
+      spec[n + 2] = conv;
+      spec[n + 3] = '\0';
+      ret = snprintf(&line[len], size - len, spec,
+                     type == LOGRING_ARG_DOUBLE ? (long long) d : (long long) i);
+      break;
+    case 'u':
+    case 'x':
+    case 'X':
+    case 'o':
+      memcpy(&spec[n], "ll", 2);
+      spec[n + 2] = conv;
+      spec[n + 3] = '\0';
+      ret = snprintf(&line[len], size - len, spec,
+                     type == LOGRING_ARG_DOUBLE ?
+                     (unsigned long long) d : (unsigned long long) i);
+      break;
+    case 'c':
+      spec[n] = conv;
+      spec[n + 1] = '\0';
+      ret = snprintf(&line[len], size - len, spec, (int) i);
+      break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      spec[n] = conv;
+      spec[n + 1] = '\0';
+      ret = snprintf(&line[len], size - len, spec, d);
+      break;
+    case 's':
+      spec[n] = conv;
+      spec[n + 1] = '\0';
+      ret = snprintf(&line[len], size - len, spec,
+                     type == LOGRING_ARG_STRING && entry->args[arg - 1].s ?
+                     entry->args[arg - 1].s : "(?)");
+      break;
+    case 'p':
+      ret = snprintf(&line[len], size - len, "%p",
+                     type == LOGRING_ARG_POINTER ?
+                     entry->args[arg - 1].p : NULL);
+      break;
+    default:
+      ret = snprintf(&line[len], size - len, "%%%c", conv);
+      break;
+    }
+
+    if (ret < 0) {
+      break;
+    }
+    len = MIN(len + ret, size - 1);
+  }
+
+  /* Always one line per entry */
+  len = MIN(len, size - 2);
+  while (len > 0 && line[len - 1] == '\n') {
+    len--;
+  }
+  line[len++] = '\n';
+  line[len] = '\0';
+
+  return len;
+}
+
+/*
+ * Copy an entry if it is still the one at position pos
+ */
+static gboolean logring_read(guint pos, struct logring_entry *copy)
+{
+  const struct logring_entry *entry = &ring[pos & LOGRING_MASK];
+
+  if ((guint) g_atomic_int_get((gint *) &entry->seq) != pos + 1) {
+    return FALSE;
+  }
+
+  memcpy(copy, entry, sizeof(*copy));
+
+  return (guint) g_atomic_int_get((gint *) &entry->seq) == pos + 1;
+}
+
+static guint logring_first(guint end)
+{
+  return end > LOGRING_SIZE ? end - LOGRING_SIZE : 0;
+}
+
+void logring_dump(GString *out)
+{
+  struct logring_entry entry;
+  char line[LOGRING_LINE_SIZE];
+  guint end = (guint) g_atomic_int_get((gint *) &head);
+  guint pos;
+
+  for (pos = logring_first(end); pos != end; pos++) {
+    if (logring_read(pos, &entry)) {
+      logring_format(&entry, line, sizeof(line));
+      g_string_append(out, line);
+    }
+  }
+}
+
+void logring_dump_fd(int fd)
+{
+  struct logring_entry entry;
+  char line[LOGRING_LINE_SIZE];
+  guint end = (guint) g_atomic_int_get((gint *) &head);
+  guint pos;
+
+  for (pos = logring_first(end); pos != end; pos++) {
+    if (logring_read(pos, &entry)) {
+      int len = logring_format(&entry, line, sizeof(line));
+
+      if (write(fd, line, len) < 0) {
+        return;
+      }
+    }
+  }
+}
+
+static void logring_crash_handler(int signo)
+{
+  static const char msg[] = "---- Crashed, dumping log ring ----\n";
+
+  if (write(STDERR_FILENO, msg, sizeof(msg) - 1) >= 0) {
+    logring_dump_fd(STDERR_FILENO);
+  }
+
+  /* Handler was reset, let the default action take place */
+  raise(signo);
+}
+
+static gboolean logring_usr1_callback(gpointer data)
+{
+  logring_dump_fd(STDOUT_FILENO);
+
+  return G_SOURCE_CONTINUE;
+}
+
+void logring_init()
+{
+  struct sigaction sa;
+  unsigned int i;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_RESETHAND;
+  sa.sa_handler = logring_crash_handler;
+  sigemptyset(&sa.sa_mask);
+
+  for (i = 0; i < G_N_ELEMENTS(crash_signals); i++) {
+    sigaction(crash_signals[i], &sa, NULL);
+  }
+
+  usr1_source = g_unix_signal_add(SIGUSR1, logring_usr1_callback, NULL);
+}
+
+void logring_cleanup()
+{
+  unsigned int i;
+
+  if (usr1_source) {
+    g_source_remove(usr1_source);
+    usr1_source = 0;
+  }
+
+  for (i = 0; i < G_N_ELEMENTS(crash_signals); i++) {
+    signal(crash_signals[i], SIG_DFL);
+  }
+}
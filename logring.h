@@ -0,0 +1,159 @@
+#ifndef INCLUSION_GUARD_LOGRING_H
+#define INCLUSION_GUARD_LOGRING_H
+
+#include <glib.h>
+
+/*
+ * In-memory log ring. Recording stores the format string pointer and the
+ * raw arguments, formatting happens only when the ring is dumped. Levels
+ * above LOGRING_LEVEL are compiled out.
+ *
+ * The format string must be a literal and %s arguments must be static
+ * strings, they are only read at dump time. At most LOGRING_MAX_ARGS
+ * arguments are supported, '*' widths are not.
+ */
+
+#define LOGRING_LEVEL_ERROR (0)
+#define LOGRING_LEVEL_WARN  (1)
+#define LOGRING_LEVEL_INFO  (2)
+#define LOGRING_LEVEL_DEBUG (3)
+#define LOGRING_LEVEL_TRACE (4)
+
+#ifndef LOGRING_LEVEL
+#define LOGRING_LEVEL LOGRING_LEVEL_DEBUG
+#endif
+
+/* Entries kept, must be a power of two */
+#define LOGRING_SIZE (2048)
+#define LOGRING_MAX_ARGS (6)
+
+enum logring_arg_type {
+  LOGRING_ARG_INT = 0,
+  LOGRING_ARG_DOUBLE,
+  LOGRING_ARG_STRING,
+  LOGRING_ARG_POINTER
+};
+
+struct logring_arg {
+  guint8 type;
+  union {
+    gint64 i;
+    gdouble d;
+    const char *s;
+    const void *p;
+  } v;
+};
+
+static inline struct logring_arg logring_arg_int(gint64 i)
+{
+  struct logring_arg arg = { LOGRING_ARG_INT, { .i = i } };
+  return arg;
+}
+
+static inline struct logring_arg logring_arg_double(gdouble d)
+{
+  struct logring_arg arg = { LOGRING_ARG_DOUBLE, { .d = d } };
+  return arg;
+}
+
+static inline struct logring_arg logring_arg_string(const char *s)
+{
+  struct logring_arg arg = { LOGRING_ARG_STRING, { .s = s } };
+  return arg;
+}
+
+static inline struct logring_arg logring_arg_pointer(const void *p)
+{
+  struct logring_arg arg = { LOGRING_ARG_POINTER, { .p = p } };
+  return arg;
+}
+
+#define LOGRING_ARG(x) _Generic((x),                   \
+  float: logring_arg_double,                           \
+  double: logring_arg_double,                          \
+  long double: logring_arg_double,                     \
+  char *: logring_arg_string,                          \
+  const char *: logring_arg_string,                    \
+  void *: logring_arg_pointer,                         \
+  const void *: logring_arg_pointer,                   \
+  default: logring_arg_int)(x)
+
+void logring_record(int level, const char *fmt,
+                    int num_args, const struct logring_arg *args);
+
+/* Argument counting and encoding, the format is the first argument */
+#define LOGRING_NARGS(...) \
+  LOGRING_NARGS_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define LOGRING_NARGS_(f, a, b, c, d, e, g, n, ...) n
+
+#define LOGRING_CAT(a, b) LOGRING_CAT_(a, b)
+#define LOGRING_CAT_(a, b) a##b
+
+#define LOGRING_ARGS_0()
+#define LOGRING_ARGS_1(a) LOGRING_ARG(a)
+#define LOGRING_ARGS_2(a, b) LOGRING_ARG(a), LOGRING_ARG(b)
+#define LOGRING_ARGS_3(a, b, c) LOGRING_ARGS_2(a, b), LOGRING_ARG(c)
+#define LOGRING_ARGS_4(a, b, c, d) LOGRING_ARGS_3(a, b, c), LOGRING_ARG(d)
+#define LOGRING_ARGS_5(a, b, c, d, e) \
+  LOGRING_ARGS_4(a, b, c, d), LOGRING_ARG(e)
+#define LOGRING_ARGS_6(a, b, c, d, e, g) \
+  LOGRING_ARGS_5(a, b, c, d, e), LOGRING_ARG(g)
+
+#define LOGRING_RECORD_0(level, fmt) \
+  logring_record(level, fmt, 0, NULL)
+#define LOGRING_RECORD_N(n, level, fmt, ...)                           \
+  logring_record(level, fmt, n, (const struct logring_arg[]) {         \
+    LOGRING_CAT(LOGRING_ARGS_, n)(__VA_ARGS__) })
+
+#define LOGRING_RECORD_1(l, f, ...) LOGRING_RECORD_N(1, l, f, __VA_ARGS__)
+#define LOGRING_RECORD_2(l, f, ...) LOGRING_RECORD_N(2, l, f, __VA_ARGS__)
+#define LOGRING_RECORD_3(l, f, ...) LOGRING_RECORD_N(3, l, f, __VA_ARGS__)
+#define LOGRING_RECORD_4(l, f, ...) LOGRING_RECORD_N(4, l, f, __VA_ARGS__)
+#define LOGRING_RECORD_5(l, f, ...) LOGRING_RECORD_N(5, l, f, __VA_ARGS__)
+#define LOGRING_RECORD_6(l, f, ...) LOGRING_RECORD_N(6, l, f, __VA_ARGS__)
+
+#define LOGRING_RECORD(level, ...) \
+  LOGRING_CAT(LOGRING_RECORD_, LOGRING_NARGS(__VA_ARGS__))(level, __VA_ARGS__)
+
+/* Disabled levels still type check their arguments but generate no code */
+#define LOGRING_DISABLED(...) \
+  do { if (0) { LOGRING_RECORD(LOGRING_LEVEL_TRACE, __VA_ARGS__); } } while (0)
+
+#if LOGRING_LEVEL >= LOGRING_LEVEL_ERROR
+#define LOGR_ERR(...) LOGRING_RECORD(LOGRING_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define LOGR_ERR(...) LOGRING_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOGRING_LEVEL >= LOGRING_LEVEL_WARN
+#define LOGR_WARN(...) LOGRING_RECORD(LOGRING_LEVEL_WARN, __VA_ARGS__)
+#else
+#define LOGR_WARN(...) LOGRING_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOGRING_LEVEL >= LOGRING_LEVEL_INFO
+#define LOGR_INFO(...) LOGRING_RECORD(LOGRING_LEVEL_INFO, __VA_ARGS__)
+#else
+#define LOGR_INFO(...) LOGRING_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOGRING_LEVEL >= LOGRING_LEVEL_DEBUG
+#define LOGR_DEBUG(...) LOGRING_RECORD(LOGRING_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define LOGR_DEBUG(...) LOGRING_DISABLED(__VA_ARGS__)
+#endif
+
+#if LOGRING_LEVEL >= LOGRING_LEVEL_TRACE
+#define LOGR_TRACE(...) LOGRING_RECORD(LOGRING_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define LOGR_TRACE(...) LOGRING_DISABLED(__VA_ARGS__)
+#endif
+
+/* Installs the crash handlers and SIGUSR1 dump to stdout */
+void logring_init();
+void logring_cleanup();
+
+void logring_dump(GString *out);  //Appends all entries, oldest first
+void logring_dump_fd(int fd);     //Only uses the stack, for crash handlers
+
+#endif // INCLUSION_GUARD_LOGRING_H
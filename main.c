@@ -5,6 +5,9 @@
 #include "ptz.h"
 #include "param.h"
 #include "vip.h"
+#include "http.h"
+#include "metrics.h"
+#include "logring.h"
 
 
 //#define LOG(fmt, args...)   { syslog(LOG_INFO, fmt, ## args); printf(fmt, ## args); }
@@ -43,20 +46,32 @@ int
 main(int argc, char *argv[])
 {
     openlog(APP_ID, LOG_PID | LOG_CONS, LOG_USER);
+    logring_init();
     init_signals();
     loop = g_main_loop_new(NULL, FALSE);
 
     param_init(APP_ID);
 
+    /* Focus and iris are controlled through the local VAPIX endpoint */
+    if (http_init("127.0.0.1", 80) < 0) {
+        return -1;
+    }
+
     ptz_init(); 
 
     if (vip_init() < 0) {
         return -1;
     }
 
+    metrics_init();
+
     g_main_loop_run(loop);
     g_main_loop_unref(loop);  
+    metrics_cleanup();
+    ptz_cleanup();
+    http_cleanup();
     param_cleanup();
+    logring_cleanup();
     closelog();
 
     return 0;
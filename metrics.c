@@ -0,0 +1,265 @@
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include "metrics.h"
+#include "ptz.h"
+#include "vip.h"
+#include "http.h"
+#include "actuator.h"
+#include "param.h"
+#include "hal.h"
+#include "logring.h"
+
+/*
+ * Counters and log-bucketed latency histograms per VISCA command class.
+ * Recording is a few increments on the main loop, snapshots are served as
+ * JSON on the stats.cgi path of the application. The log ring is served
+ * as text on log.cgi.
+ */
+
+#define METRICS_CGI_PATH "stats.cgi"
+#define METRICS_LOG_CGI_PATH "log.cgi"
+
+struct metrics_class_stats {
+  guint64 count;
+  guint64 errors;
+  struct metrics_histogram histograms[METRICS_NUM_EVENTS];
+};
+
+static struct metrics_class_stats class_stats[METRICS_NUM_CLASSES];
+static gint64 metrics_start_time = 0;
+
+static const char *class_names[METRICS_NUM_CLASSES] = {
+  [METRICS_OTHER]       = "other",
+  [METRICS_DRIVE]       = "drive",
+  [METRICS_ABSOLUTE]    = "absolute",
+  [METRICS_RELATIVE]    = "relative",
+  [METRICS_ZOOM_DIRECT] = "zoom_direct",
+  [METRICS_PRESET]      = "preset",
+  [METRICS_FOCUS_IRIS]  = "focus_iris",
+  [METRICS_INQ_VERSION] = "inq_version",
+  [METRICS_INQ_FLIP]    = "inq_flip",
+  [METRICS_INQ_AF]      = "inq_af",
+  [METRICS_INQ_PT]      = "inq_pt",
+  [METRICS_INQ_ZOOM]    = "inq_zoom",
+  [METRICS_STATUS]      = "ptz_status",
+};
+
+static const char *event_names[METRICS_NUM_EVENTS] = {
+  [METRICS_EVENT_ACK]        = "ack_us",
+  [METRICS_EVENT_COMPLETION] = "completion_us",
+  [METRICS_EVENT_AXPTZ]      = "axptz_us",
+  [METRICS_EVENT_QUEUE]      = "queue_us",
+};
+
+/********************************************/
+
+void metrics_count(enum metrics_class cls)
+{
+  class_stats[cls].count++;
+}
+
+void metrics_count_error(enum metrics_class cls)
+{
+  class_stats[cls].errors++;
+}
+
+void metrics_record(enum metrics_class cls, enum metrics_event event,
+                    gint64 duration_us)
+{
+  struct metrics_histogram *h = &class_stats[cls].histograms[event];
+  guint64 us = duration_us > 0 ? (guint64) duration_us : 0;
+  guint bucket = us ? g_bit_storage(us) : 0;
+
+  h->count++;
+  h->total_us += us;
+  h->max_us = MAX(h->max_us, us);
+  h->buckets[MIN(bucket, METRICS_NUM_BUCKETS - 1)]++;
+}
+
+void metrics_record_since(enum metrics_class cls, enum metrics_event event,
+                          gint64 start)
+{
+  metrics_record(cls, event, g_get_monotonic_time() - start);
+}
+
+static void metrics_report_histogram(GString *out, const char *name,
+                                     struct metrics_histogram *h)
+{
+  int last = METRICS_NUM_BUCKETS - 1;
+  int i;
+
+  /* Trailing empty buckets are left out */
+  while (last > 0 && h->buckets[last] == 0) {
+    last--;
+  }
+
+  g_string_append_printf(out, "\"%s\": { \"count\": %llu, \"total\": %llu, "
+                         "\"max\": %llu, \"buckets\": [", name,
+                         (unsigned long long) h->count,
+                         (unsigned long long) h->total_us,
+                         (unsigned long long) h->max_us);
+
+  for (i = 0; i <= last; i++) {
+    g_string_append_printf(out, "%s%llu", i ? ", " : "",
+                           (unsigned long long) h->buckets[i]);
+  }
+
+  g_string_append(out, "] }");
+}
+
+void metrics_report(GString *out)
+{
+  struct vip_batch_stats batch;
+  struct vip_tcp_stats tcp;
+  struct vip_telemetry_stats telemetry;
+  struct vip_pool_stats pool;
+  struct http_stats http;
+  struct actuator_stats actuator;
+  guint64 hits, misses, estimates, received, actuated, duplicates, resets;
+  guint64 param_hits, param_misses;
+  struct param_writer_stats writer;
+  int i, e;
+
+  vip_get_batch_stats(&batch);
+  vip_get_sequence_stats(&duplicates, &resets);
+  vip_get_tcp_stats(&tcp);
+  vip_get_telemetry_stats(&telemetry);
+  vip_get_pool_stats(&pool);
+  ptz_get_status_cache_stats(&hits, &misses, &estimates);
+  ptz_get_drive_stats(&received, &actuated);
+  http_get_stats(&http);
+  actuator_get_stats(&actuator);
+  param_get_mirror_stats(&param_hits, &param_misses);
+  param_get_writer_stats(&writer);
+
+  g_string_append_printf(out, "{\n  \"uptime_us\": %lld,\n",
+                         (long long) (g_get_monotonic_time() - metrics_start_time));
+  g_string_append_printf(out, "  \"bucket_limits\": \"bucket i < 2^i us\",\n");
+
+  g_string_append(out, "  \"classes\": {\n");
+  for (i = 0; i < METRICS_NUM_CLASSES; i++) {
+    struct metrics_class_stats *st = &class_stats[i];
+
+    g_string_append_printf(out, "    \"%s\": { \"count\": %llu, "
+                           "\"errors\": %llu", class_names[i],
+                           (unsigned long long) st->count,
+                           (unsigned long long) st->errors);
+
+    for (e = METRICS_EVENT_ACK; e < METRICS_NUM_EVENTS; e++) {
+      if (st->histograms[e].count == 0) {
+        continue;
+      }
+      g_string_append(out, ",\n      ");
+      metrics_report_histogram(out, event_names[e], &st->histograms[e]);
+    }
+
+    g_string_append_printf(out, " }%s\n", i < METRICS_NUM_CLASSES - 1 ? "," : "");
+  }
+  g_string_append(out, "  },\n");
+
+  g_string_append_printf(out, "  \"udp\": { \"wakeups\": %llu, "
+                         "\"datagrams\": %llu, \"tx_batches\": %llu, "
+                         "\"tx_datagrams\": %llu, \"tx_errors\": %llu, "
+                         "\"duplicates\": %llu, \"resets\": %llu },\n",
+                         (unsigned long long) batch.wakeups,
+                         (unsigned long long) batch.datagrams,
+                         (unsigned long long) batch.tx_batches,
+                         (unsigned long long) batch.tx_datagrams,
+                         (unsigned long long) batch.tx_errors,
+                         (unsigned long long) duplicates,
+                         (unsigned long long) resets);
+  g_string_append_printf(out, "  \"packets\": { \"size\": %llu, "
+                         "\"in_use\": %llu, \"max_in_use\": %llu, "
+                         "\"exhausted\": %llu },\n",
+                         (unsigned long long) pool.size,
+                         (unsigned long long) pool.in_use,
+                         (unsigned long long) pool.max_in_use,
+                         (unsigned long long) pool.exhausted);
+  g_string_append_printf(out, "  \"tcp\": { \"connections\": %llu, "
+                         "\"accepted\": %llu, \"refused\": %llu, "
+                         "\"messages\": %llu, \"errors\": %llu, "
+                         "\"overflows\": %llu },\n",
+                         (unsigned long long) tcp.connections,
+                         (unsigned long long) tcp.accepted,
+                         (unsigned long long) tcp.refused,
+                         (unsigned long long) tcp.messages,
+                         (unsigned long long) tcp.errors,
+                         (unsigned long long) tcp.overflows);
+  g_string_append_printf(out, "  \"telemetry\": { \"subscribers\": %llu, "
+                         "\"refused\": %llu, \"samples\": %llu, "
+                         "\"frames\": %llu, \"datagrams\": %llu, "
+                         "\"suppressed\": %llu },\n",
+                         (unsigned long long) telemetry.subscribers,
+                         (unsigned long long) telemetry.refused,
+                         (unsigned long long) telemetry.samples,
+                         (unsigned long long) telemetry.frames,
+                         (unsigned long long) telemetry.datagrams,
+                         (unsigned long long) telemetry.suppressed);
+  g_string_append_printf(out, "  \"status_cache\": { \"hits\": %llu, "
+                         "\"misses\": %llu, \"estimates\": %llu },\n",
+                         (unsigned long long) hits,
+                         (unsigned long long) misses,
+                         (unsigned long long) estimates);
+  g_string_append_printf(out, "  \"params\": { \"hits\": %llu, "
+                         "\"misses\": %llu, \"writes\": %llu, "
+                         "\"coalesced\": %llu, \"written\": %llu, "
+                         "\"failed\": %llu },\n",
+                         (unsigned long long) param_hits,
+                         (unsigned long long) param_misses,
+                         (unsigned long long) writer.queued,
+                         (unsigned long long) writer.coalesced,
+                         (unsigned long long) writer.written,
+                         (unsigned long long) writer.failed);
+  g_string_append_printf(out, "  \"drives\": { \"received\": %llu, "
+                         "\"actuated\": %llu },\n",
+                         (unsigned long long) received,
+                         (unsigned long long) actuated);
+  g_string_append_printf(out, "  \"actuator\": { \"submitted\": %llu, "
+                         "\"completed\": %llu, \"dropped\": %llu, "
+                         "\"depth\": %u, \"max_depth\": %u },\n",
+                         (unsigned long long) actuator.submitted,
+                         (unsigned long long) actuator.completed,
+                         (unsigned long long) actuator.dropped,
+                         actuator.depth, actuator.max_depth);
+  g_string_append_printf(out, "  \"http\": { \"requests\": %llu, "
+                         "\"failures\": %llu, \"coalesced\": %llu, "
+                         "\"max_latency_us\": %lld }\n}\n",
+                         (unsigned long long) http.requests,
+                         (unsigned long long) http.failures,
+                         (unsigned long long) http.coalesced,
+                         (long long) http.max_latency_us);
+}
+
+static void metrics_http_callback(GString *response, gpointer user_data)
+{
+  metrics_report(response);
+}
+
+static void metrics_log_http_callback(GString *response, gpointer user_data)
+{
+  logring_dump(response);
+}
+
+void metrics_init()
+{
+  metrics_start_time = g_get_monotonic_time();
+
+  if (!hal_http_register(METRICS_CGI_PATH, metrics_http_callback, NULL)) {
+    g_printf("Could not register %s, statistics not available\n",
+      METRICS_CGI_PATH);
+  }
+
+  if (!hal_http_register(METRICS_LOG_CGI_PATH, metrics_log_http_callback,
+                         NULL)) {
+    g_printf("Could not register %s, log ring not available\n",
+      METRICS_LOG_CGI_PATH);
+  }
+}
+
+void metrics_cleanup()
+{
+  hal_http_cleanup();
+}
@@ -0,0 +1,57 @@
+#ifndef INCLUSION_GUARD_METRICS_H
+#define INCLUSION_GUARD_METRICS_H
+
+#include <glib.h>
+
+/* VISCA command classes that are measured separately */
+enum metrics_class {
+  METRICS_OTHER = 0,
+  METRICS_DRIVE,
+  METRICS_ABSOLUTE,
+  METRICS_RELATIVE,
+  METRICS_ZOOM_DIRECT,
+  METRICS_PRESET,
+  METRICS_FOCUS_IRIS,
+  METRICS_INQ_VERSION,
+  METRICS_INQ_FLIP,
+  METRICS_INQ_AF,
+  METRICS_INQ_PT,
+  METRICS_INQ_ZOOM,
+  METRICS_STATUS,   /* PTZ status refresh, shared by inquiries */
+  METRICS_NUM_CLASSES
+};
+
+enum metrics_event {
+  METRICS_EVENT_NONE = 0,
+  METRICS_EVENT_ACK,        /* Receive to ACK sent */
+  METRICS_EVENT_COMPLETION, /* Receive to completion or inquiry reply sent */
+  METRICS_EVENT_AXPTZ,      /* Duration of a PTZ backend call */
+  METRICS_EVENT_QUEUE,      /* Wait in the actuation queue */
+  METRICS_NUM_EVENTS
+};
+
+/* Bucket i counts durations of less than 2^i us, the last one the rest */
+#define METRICS_NUM_BUCKETS (25)
+
+struct metrics_histogram {
+  guint64 count;
+  guint64 total_us;
+  guint64 max_us;
+  guint64 buckets[METRICS_NUM_BUCKETS];
+};
+
+void metrics_init();
+void metrics_cleanup();
+
+void metrics_count(enum metrics_class cls);
+void metrics_count_error(enum metrics_class cls);
+void metrics_record(enum metrics_class cls, enum metrics_event event,
+                    gint64 duration_us);
+
+/* Record time since start, i.e. a receive time or a call start */
+void metrics_record_since(enum metrics_class cls, enum metrics_event event,
+                          gint64 start);
+
+void metrics_report(GString *out); //Appends a JSON snapshot of all counters
+
+#endif // INCLUSION_GUARD_METRICS_H
@@ -1,6 +1,8 @@
 #include <syslog.h>
 #include <stdio.h>
+#include <string.h>
 #include "param.h"
+#include "hal.h"
 
 #include <glib/gprintf.h>
 
@@ -8,9 +10,57 @@
 #define LOG_ERROR(fmt, args...)    { syslog(LOG_CRIT, fmt, ## args); printf(fmt, ## args); }
 
 gchar          *string_application_id = 0;
-AXParameter    *handler_application_param = 0;
+gboolean        handler_application_param = FALSE;
 GHashTable     *table_application_param = 0; 
 
+/*
+ * Mirror of the parameters read by the application, name as passed to
+ * param_get to value. A parameter is fetched over IPC on its first read and
+ * kept up to date by its change callback from then on, so later reads never
+ * leave the process. Names that the callback cannot be registered for are
+ * not mirrored.
+ */
+static GHashTable *param_mirror = NULL;
+static GHashTable *param_watched = NULL;   /* Names with a callback */
+static guint64 param_mirror_hits = 0;
+static guint64 param_mirror_misses = 0;
+
+/*
+ * Parameter writes are done by a writer thread, the main loop only queues
+ * them. A write of a parameter that is still queued replaces its value,
+ * the callbacks of both are called once the latest value is written.
+ * Finished writes are handed back to the main loop in param_done.
+ */
+struct param_write_callback {
+  param_set_callback callback;
+  gpointer user_data;
+};
+
+struct param_write {
+  gchar *name;
+  gchar *value;
+  GSList *callbacks;
+  gboolean ok;
+  gchar *current;       /* Read back after a failed write, may be NULL */
+};
+
+static GThread *param_writer = NULL;
+static GMutex param_writer_lock;
+static GCond param_writer_cond;
+static GQueue param_writes = G_QUEUE_INIT;
+static GHashTable *param_queued = NULL;     /* Name to queued write */
+static gboolean param_writer_running = FALSE;
+static GQueue param_done = G_QUEUE_INIT;
+static guint param_done_source = 0;
+
+/* Only touched from the main loop */
+static struct param_writer_stats writer_stats;
+
+static void main_parameter_callback(const gchar *param_name,
+                                    const gchar *value, gpointer data);
+static gpointer param_writer_thread(gpointer data);
+static gboolean param_writes_done(gpointer data);
+
 void
 param_init(const char* app_name_ID)
 {
@@ -18,20 +68,50 @@ param_init(const char* app_name_ID)
   
   if( !handler_application_param )
   {
-    handler_application_param = ax_parameter_new( string_application_id, NULL);
+    handler_application_param = hal_param_init( string_application_id );
   }
 
   if( !table_application_param ) {
     table_application_param = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
   }
 
+  if (!param_mirror) {
+    param_mirror = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    param_watched = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  }
+
+  if (!param_writer) {
+    param_queued = g_hash_table_new(g_str_hash, g_str_equal);
+    param_writer_running = TRUE;
+    param_writer = g_thread_new("param-writer", param_writer_thread, NULL);
+  }
 }
 
 void
 param_cleanup()
 {
+    /* Queued writes are written before the thread exits */
+    if (param_writer) {
+        g_mutex_lock(&param_writer_lock);
+        param_writer_running = FALSE;
+        g_cond_signal(&param_writer_cond);
+        g_mutex_unlock(&param_writer_lock);
+
+        g_thread_join(param_writer);
+        param_writer = NULL;
+
+        /* Report what was written since the main loop last ran */
+        if (param_done_source) {
+            g_source_remove(param_done_source);
+        }
+        param_writes_done(NULL);
+
+        g_hash_table_destroy(param_queued);
+        param_queued = NULL;
+    }
+
     if( handler_application_param ) {
-        ax_parameter_free( handler_application_param);
+        hal_param_cleanup();
     }
 
     if( table_application_param ) {
@@ -39,19 +119,84 @@ param_cleanup()
         table_application_param = NULL;
     } 
 
-    handler_application_param = NULL;
+    if (param_mirror) {
+        g_hash_table_destroy(param_mirror);
+        g_hash_table_destroy(param_watched);
+        param_mirror = NULL;
+        param_watched = NULL;
+    }
+
+    handler_application_param = FALSE;
 }
 
 
+/*
+ * Register the change callback of a parameter once, for dispatching to the
+ * application and for keeping the mirror up to date
+ */
+static gboolean
+param_watch(const char *name)
+{
+  if (g_hash_table_contains(param_watched, name)) {
+    return TRUE;
+  }
+
+  if (!hal_param_register_callback(name, main_parameter_callback, NULL)) {
+    return FALSE;
+  }
+
+  g_hash_table_add(param_watched, g_strdup(name));
+
+  return TRUE;
+}
+
+/*
+ * Callbacks get the full name, e.g. root.PTZ.Various.V1.AutoFocus or
+ * root.Axvisca.StatusCacheMs, while the application uses the name as it
+ * was read or registered, e.g. PTZ.Various.V1.AutoFocus or StatusCacheMs
+ */
+static gboolean
+param_name_matches(const gchar *full_name, const gchar *name)
+{
+  gsize full_len = strlen(full_name);
+  gsize len = strlen(name);
+
+  return len <= full_len &&
+    strcmp(full_name + full_len - len, name) == 0 &&
+    (len == full_len || full_name[full_len - len - 1] == '.');
+}
+
+static gboolean
+param_mirror_update(const gchar *param_name, const gchar *value)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gboolean updated = FALSE;
+
+  g_hash_table_iter_init(&iter, param_mirror);
+
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    if (param_name_matches(param_name, key)) {
+      g_hash_table_iter_replace(&iter, g_strdup(value));
+      updated = TRUE;
+    }
+  }
+
+  return updated;
+}
+
 static void
 main_parameter_callback(const gchar *param_name, const gchar *value, gpointer data)
 {
   gchar *key;
   gchar *search_key;
   param_callback    user_callback = 0;
+  gboolean mirrored;
 
   g_printf("Main parameter callback! %s %s\n", param_name, value);
 
+  mirrored = param_mirror_update(param_name, value);
+
   search_key = g_strrstr_len(param_name,100,".");
   
   if( search_key ) {
@@ -60,15 +205,32 @@ main_parameter_callback(const gchar *param_name, const gchar *value, gpointer da
     LOG_ERROR("Camera: Cannot dispatch parameter update %s=%s (internal error)\n", param_name, value);
   }
   
-  g_hash_table_lookup_extended(table_application_param,
-                               search_key,
-                               (gpointer*)&key,
-                               (gpointer*)&user_callback);
+  if( search_key ) {
+    g_hash_table_lookup_extended(table_application_param,
+                                 search_key,
+                                 (gpointer*)&key,
+                                 (gpointer*)&user_callback);
+  }
+
+  /* Registered with more than the last component of the name */
+  if( !user_callback ) {
+    GHashTableIter iter;
+    gpointer name;
+    gpointer callback;
+
+    g_hash_table_iter_init(&iter, table_application_param);
+
+    while (!user_callback && g_hash_table_iter_next(&iter, &name, &callback)) {
+      if (param_name_matches(param_name, name)) {
+        user_callback = (param_callback) callback;
+      }
+    }
+  }
  
   if( user_callback ) {
      user_callback(value);
   }
-  else {
+  else if (!mirrored) {
     LOG_ERROR("Camera: Cannot dispatch parameter update %s=%s (internal error)\n", param_name, value);
   }
 }
@@ -84,7 +246,7 @@ param_register_callback(const char* name, param_callback theCallback)
         return 0;
     }
 
-    if( !ax_parameter_register_callback( handler_application_param, name, main_parameter_callback, NULL, NULL) ) {
+    if( !param_watch(name) ) {
         LOG_ERROR("Camera: Cannot register callback for %s (internal error)\n", name);
     }
 
@@ -97,24 +259,219 @@ const char*
 param_get(const char* param_name, char* value, int max_count)
 {
   gchar  *param_value = NULL;
+  const gchar *mirrored;
 
   if( !handler_application_param ) {
 	  LOG_ERROR("Camera: Cannot get parameter %s (handler not initialized)\n", param_name);
 	  return 0;
   }
 
-  if (!ax_parameter_get(handler_application_param, param_name, &param_value, NULL)) {
+  if ((mirrored = g_hash_table_lookup(param_mirror, param_name))) {
+    param_mirror_hits++;
+    g_strlcpy(value, mirrored, max_count);
+    return value;
+  }
+
+  param_mirror_misses++;
+
+  if (!hal_param_get(param_name, &param_value)) {
 	  LOG_ERROR("Camera: Cannot get parameter %s (internal errro)\n", param_name);
 	  value[0]=0;
 	  return 0;
   }
   g_strlcpy(value, param_value, max_count);
-  g_free( param_value);
+
+  /* Only mirrored if changes will be seen */
+  if (param_watch(param_name)) {
+    g_hash_table_replace(param_mirror, g_strdup(param_name), param_value);
+  } else {
+    g_free( param_value);
+  }
   return value;
 }
 
+static void
+param_write_free(struct param_write *write)
+{
+  g_slist_free_full(write->callbacks, g_free);
+  g_free(write->name);
+  g_free(write->value);
+  g_free(write->current);
+  g_free(write);
+}
+
+/*
+ * The mirror and the application got the value of a write that failed.
+ * Unless a newer value was set since, go back to what the camera has, or
+ * read it over IPC next time if that is not known.
+ */
+static void
+param_write_revert(struct param_write *write)
+{
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GSList *reverted = NULL;
+  GSList *it;
+
+  /* Mirrored as read, e.g. without the root. of a system parameter */
+  g_hash_table_iter_init(&iter, param_mirror);
+
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    if (!param_name_matches(write->name, key) ||
+        strcmp(value, write->value) != 0) {
+      continue;
+    }
+
+    if (!write->current) {
+      g_hash_table_iter_remove(&iter);
+    } else {
+      g_hash_table_iter_replace(&iter, g_strdup(write->current));
+      reverted = g_slist_prepend(reverted, key);
+    }
+  }
+
+  for (it = reverted; it; it = it->next) {
+    param_callback user_callback = NULL;
+
+    if (table_application_param) {
+      user_callback = g_hash_table_lookup(table_application_param, it->data);
+    }
+
+    if (user_callback && strcmp(write->current, write->value) != 0) {
+      user_callback(write->current);
+    }
+  }
+
+  g_slist_free(reverted);
+}
+
+/*
+ * Report a finished write on the main loop
+ */
+static void
+param_write_done(struct param_write *write)
+{
+  GSList *it;
+
+  if (write->ok) {
+    writer_stats.written++;
+  } else {
+    LOG_ERROR("Camera: Cannot set parameter %s=%s (internal error)\n", write->name, write->value);
+    writer_stats.failed++;
+    param_write_revert(write);
+  }
+
+  for (it = write->callbacks; it; it = it->next) {
+    struct param_write_callback *cb = it->data;
+
+    cb->callback(write->name, write->ok, cb->user_data);
+  }
+
+  param_write_free(write);
+}
+
+/*
+ * Idle callback reporting all writes finished by the writer thread, also
+ * called from param_cleanup for the ones the main loop did not get to
+ */
+static gboolean
+param_writes_done(gpointer data)
+{
+  struct param_write *write;
+  GQueue done;
+
+  g_mutex_lock(&param_writer_lock);
+  done = param_done;
+  g_queue_init(&param_done);
+  param_done_source = 0;
+  g_mutex_unlock(&param_writer_lock);
+
+  while ((write = g_queue_pop_head(&done))) {
+    param_write_done(write);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer
+param_writer_thread(gpointer data)
+{
+  struct param_write *write;
+
+  g_mutex_lock(&param_writer_lock);
+
+  for (;;) {
+    while (param_writer_running && g_queue_is_empty(&param_writes)) {
+      g_cond_wait(&param_writer_cond, &param_writer_lock);
+    }
+
+    if (!(write = g_queue_pop_head(&param_writes))) {
+      break;
+    }
+
+    /* Writes of the same name queued from now on are new writes */
+    g_hash_table_remove(param_queued, write->name);
+    g_mutex_unlock(&param_writer_lock);
+
+    write->ok = hal_param_set(write->name, write->value);
+    if (!write->ok && !hal_param_get(write->name, &write->current)) {
+      write->current = NULL;
+    }
+
+    g_mutex_lock(&param_writer_lock);
+
+    g_queue_push_tail(&param_done, write);
+    if (!param_done_source) {
+      param_done_source = g_idle_add(param_writes_done, NULL);
+    }
+  }
+
+  g_mutex_unlock(&param_writer_lock);
+
+  return NULL;
+}
+
+/*
+ * Queue a write, or replace the value of a queued write of the same name
+ */
+static void
+param_queue_write(const char *name, const char *value,
+                  param_set_callback callback, gpointer user_data)
+{
+  struct param_write *write;
+
+  g_mutex_lock(&param_writer_lock);
+
+  if ((write = g_hash_table_lookup(param_queued, name))) {
+    g_free(write->value);
+    write->value = g_strdup(value);
+    writer_stats.coalesced++;
+  } else {
+    write = g_new0(struct param_write, 1);
+    write->name = g_strdup(name);
+    write->value = g_strdup(value);
+    g_queue_push_tail(&param_writes, write);
+    g_hash_table_insert(param_queued, write->name, write);
+    g_cond_signal(&param_writer_cond);
+  }
+
+  if (callback) {
+    struct param_write_callback *cb = g_new0(struct param_write_callback, 1);
+
+    cb->callback = callback;
+    cb->user_data = user_data;
+    write->callbacks = g_slist_append(write->callbacks, cb);
+  }
+
+  writer_stats.queued++;
+
+  g_mutex_unlock(&param_writer_lock);
+}
+
 int
-param_set(const char* param_name,const char* value)
+param_set_async(const char* param_name, const char* value,
+                param_set_callback callback, gpointer user_data)
 {
   gchar *key;
   param_callback    user_callback = 0;
@@ -123,9 +480,11 @@ param_set(const char* param_name,const char* value)
     return 0;
   }
   
-  if (!ax_parameter_set(handler_application_param, param_name , value, TRUE, NULL)) {
-    LOG_ERROR("Camera: Cannot set parameter %s=%s (internal error)\n", param_name, value);
-    return 0;
+  param_queue_write(param_name, value, callback, user_data);
+
+  /* Read back from the mirror before the write is done */
+  if (g_hash_table_contains(param_mirror, param_name)) {
+    g_hash_table_replace(param_mirror, g_strdup(param_name), g_strdup(value));
   }
 
   if( !table_application_param ) {
@@ -145,16 +504,47 @@ param_set(const char* param_name,const char* value)
   return 1;
 }
 
+int
+param_set(const char* param_name,const char* value)
+{
+  return param_set_async(param_name, value, NULL, NULL);
+}
+
 int
 param_set_sys(const char* name, const char* value)
 {
   char fullPath[128];
-  sprintf(fullPath,"root.%s",name);
+  g_snprintf(fullPath, sizeof(fullPath), "root.%s", name);
   
-  if (!ax_parameter_set(handler_application_param, fullPath , value, TRUE, NULL)) {
-    LOG_ERROR("Camera: Cannot set parameter %s=%s (internal error)\n", fullPath, value);
+  if( !handler_application_param ) {
+    LOG_ERROR("Camera: Cannot set parameter %s=%s (handler not initialized)\n", fullPath, value);
     return 0;
   }
+
+  param_queue_write(fullPath, value, NULL, NULL);
+
+  /* Read back from the mirror before the write is done */
+  param_mirror_update(fullPath, value);
+
   LOG("Camera parameter %s = %s\n",fullPath, value);
   return 1;
-}
\ No newline at end of file
+}
+
+void
+param_get_writer_stats(struct param_writer_stats *stats)
+{
+  g_assert(stats);
+
+  *stats = writer_stats;
+}
+
+void
+param_get_mirror_stats(guint64 *hits, guint64 *misses)
+{
+  if (hits) {
+    *hits = param_mirror_hits;
+  }
+  if (misses) {
+    *misses = param_mirror_misses;
+  }
+}
@@ -1,16 +1,36 @@
 #ifndef INCLUSION_GUARD_PARAM_H
 #define INCLUSION_GUARD_PARAM_H
 
-#include <axsdk/axparameter.h>
+#include <glib.h>
 
 typedef void (*param_callback) (const gchar *value);
 
+/* Called on the main loop once a queued write is done */
+typedef void (*param_set_callback) (const gchar *name, gboolean ok,
+                                    gpointer user_data);
+
+struct param_writer_stats {
+  guint64 queued;
+  guint64 coalesced;    /* Replaced the value of a queued write */
+  guint64 written;
+  guint64 failed;
+};
+
 
 void param_init();
 int  param_register_callback(const char *param_name, param_callback callback);
 const char* param_get(const char* name, char *return_value, int max_size); //Returns the pointer to return_value or NULL if paramter does not exist
+/* Writes are queued and done off the main loop, param_get sees the value
+   right away. Returns 0 if the write could not be queued. */
 int  param_set(const char* name,const char* value);
+int  param_set_async(const char* name, const char* value,
+                     param_set_callback callback, gpointer user_data);
 int  param_set_sys(const char* name,const char* value);
 void param_cleanup();
 
+/* Reads served from the parameter mirror, and reads that needed IPC */
+void param_get_mirror_stats(guint64 *hits, guint64 *misses);
+
+void param_get_writer_stats(struct param_writer_stats *stats);
+
 #endif // INCLUSION_GUARD_PARAM_H
@@ -11,6 +11,13 @@
 
 #include "ptz.h"
 #include "param.h"
+#include "http.h"
+#include "hal.h"
+#include "metrics.h"
+#include "logring.h"
+#include "actuator.h"
+#include "conv.h"
+#include "calib.h"
 
 //#define LOG(fmt, args...)   { syslog(LOG_INFO, fmt, ## args); }
 #define LOG(fmt, args...)   { g_printf(fmt, ## args); }
@@ -18,25 +25,136 @@
 /* The number of fractional bits used in fix-point variables */
 #define FIXMATH_FRAC_BITS 16
 
-static AXPTZControlQueueGroup *ax_ptz_control_queue_group = NULL;
-static gint video_channel = 1;
-static AXPTZStatus *unitless_status = NULL;
-static AXPTZStatus *unit_status = NULL;
-static AXPTZLimits *unitless_limits = NULL;
-static AXPTZLimits *unit_limits = NULL;
+/* Movement completion tracking */
+#define PTZ_TRACK_INTERVAL_MS (33)
+#define PTZ_TRACK_TIMEOUT_US (10 * G_USEC_PER_SEC)
+#define PTZ_TRACK_TOLERANCE (0.05f)
 
-static gboolean image_rotated = FALSE;
+struct ptz_pending_move {
+  float target_pan;
+  float target_tilt;
+  float target_zoom;
+  gint64 deadline;
+  ptz_completion_callback callback;
+  gpointer user_data;
+};
+
+/* PTZ status snapshot cache, shared by all inquiries within max age */
+#define PTZ_STATUS_MAX_AGE_MS_DEFAULT (50)
+
+/*
+ * Motion model. Position inquiries within the extrapolation window of the
+ * last real sample are answered from that sample and the commanded or
+ * observed velocity, never past a commanded target or the limits.
+ */
+#define PTZ_EXTRAPOLATE_MS_DEFAULT (200)
+#define PTZ_MODEL_MIN_DT_US (10 * 1000)
+#define PTZ_MODEL_MAX_DT_US (G_USEC_PER_SEC)
+#define PTZ_MODEL_MIN_SPEED (0.05f)
+
+enum ptz_axis {
+  PTZ_AXIS_PAN = 0,
+  PTZ_AXIS_TILT,
+  PTZ_AXIS_ZOOM,
+  PTZ_NUM_AXES
+};
+
+struct ptz_axis_model {
+  gboolean continuous;
+  float speed;          /* Commanded unitless speed of a continuous move */
+  gboolean has_target;
+  float target;
+  float velocity;       /* Units per second */
+  float gain;           /* Learned units per second at unitless speed 1 */
+  float min;
+  float max;
+  gint64 command_time;
+};
+
+/* Continuous drive coalescing, latest drive within a window wins */
+#define PTZ_DRIVE_WINDOW_MS_DEFAULT (40)
+
+/*
+ * Everything known about one PTZ channel. Only the status cache and the
+ * motion model may be used off the main loop, under the status cache lock.
+ */
+struct ptz_channel {
+  gint number;          /* axptz video channel, from 1 */
+  guint index;
+  AXPTZLimits unitless_limits;
+  AXPTZLimits unit_limits;
+  gboolean image_rotated;
+  struct conv_tables conv;
+
+  GList *pending_moves;
+  guint pending_moves_source;
+
+  GMutex status_cache_lock;
+  GCond status_cache_cond;
+  struct ptz_status status_cache;
+  gboolean status_cache_valid;
+  gboolean status_cache_refreshing;
+  guint status_cache_generation;
+  gint64 status_cache_time;
+  gint64 status_cache_max_age;
+  guint64 status_cache_hits;
+  guint64 status_cache_misses;
+
+  /* Protected by the status cache lock */
+  struct ptz_axis_model axis_models[PTZ_NUM_AXES];
+  struct ptz_status model_anchor;    /* Rebased on every command */
+  gint64 model_anchor_time;
+  struct ptz_status model_sample;    /* Last real sample */
+  gint64 model_sample_time;
+  gboolean model_valid;
+  gint64 model_horizon;
+  guint64 model_estimates;
+
+  guint drive_window_source;
+  fixed_t drive_pan_speed;
+  fixed_t drive_tilt_speed;
+  fixed_t drive_zoom_speed;
+  gboolean drive_pt_dirty;
+  gboolean drive_zoom_dirty;
+  guint64 drive_received;
+  guint64 drive_actuated;
+};
+
+static struct ptz_channel channels[PTZ_MAX_CHANNELS];
+static guint num_channels = 0;
+
+static guint drive_window_ms = PTZ_DRIVE_WINDOW_MS_DEFAULT;
+
+/* Command class that queued movements are accounted to */
+static enum metrics_class axptz_class = METRICS_OTHER;
 
 /*********************** DECLARATION OF STATIC FUNCTIONS **********************/
 
-static void rotation_param_callback(const gchar *value);
+static void set_rotation(struct ptz_channel *ch, const gchar *value);
+static const param_callback rotation_param_callbacks[PTZ_MAX_CHANNELS];
+static void calibration_param_callback(const gchar *value);
+static void status_cache_param_callback(const gchar *value);
+static void drive_window_param_callback(const gchar *value);
+static void extrapolate_param_callback(const gchar *value);
+
+static void model_anchor_update(struct ptz_channel *ch,
+                                const struct ptz_status *fresh, gint64 now);
+static void model_command(struct ptz_channel *ch,
+                          const struct actuator_op *op);
 
-static gboolean start_continous_movement(fixed_t pan_speed,
+static void submit_drive(struct ptz_channel *ch,
+                         fixed_t pan_speed,
+                         fixed_t tilt_speed,
+                         fixed_t zoom_speed);
+
+static gboolean start_continous_movement(struct ptz_channel *ch,
+                                  fixed_t pan_speed,
                                   fixed_t tilt_speed,
                                   AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
                                   fixed_t zoom_speed, gfloat timeout);
 
-static gboolean move_to_relative_position(fixed_t pan_value,
+static gboolean move_to_relative_position(struct ptz_channel *ch,
+                                   fixed_t pan_value,
                                    fixed_t tilt_value,
                                    AXPTZMovementPanTiltSpace pan_tilt_space,
                                    gfloat speed,
@@ -44,162 +162,248 @@ static gboolean move_to_relative_position(fixed_t pan_value,
                                    fixed_t zoom_value, AXPTZMovementZoomSpace zoom_space);
 
 static gboolean
-move_to_absolute_position(fixed_t pan_value,
+move_to_absolute_position(struct ptz_channel *ch,
+                          fixed_t pan_value,
                           fixed_t tilt_value,
                           AXPTZMovementPanTiltSpace pan_tilt_space,
                           gfloat speed,
                           AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
                           fixed_t zoom_value, AXPTZMovementZoomSpace zoom_space);
 
-static int move_to_home_position();
+static int move_to_home_position(struct ptz_channel *ch);
+
+/* VISCA command dispatch */
+#define PTZ_MAX_NIBBLE_FIELDS (2)
+
+struct ptz_nibble_field {
+  guint8 offset;
+  guint8 count;
+};
 
-static int handle_ptdrive(unsigned char *command,
-                          gboolean is_absolute,
-                          size_t len);
+struct ptz_command_args {
+  struct ptz_channel *ch;
+  unsigned char *data;
+  int len;
+  unsigned int field[PTZ_MAX_NIBBLE_FIELDS];
+  ptz_completion_callback callback;
+  gpointer user_data;
+};
+
+typedef int (*ptz_command_handler) (struct ptz_command_args *args);
+
+struct ptz_command_entry {
+  ptz_command_handler handler;
+  enum metrics_class cls;
+  guint8 min_len;
+  struct ptz_nibble_field field[PTZ_MAX_NIBBLE_FIELDS];
+};
+
+static int handle_ptdrive(struct ptz_command_args *args,
+                          gboolean is_absolute);
 
 /****************************** /DECLARATION OF STATIC FUNCTIONS **************/
 
 /*
- * Wait for the camera to reach it's position
+ * Queue a movement for the actuation thread, accounted to the command
+ * class being processed
  */
-static gboolean wait_for_camera_movement_to_finish(float target_pan,
-                                                   float target_tilt,
-                                                   float target_zoom)
+static gboolean submit_movement(struct ptz_channel *ch, struct actuator_op *op)
 {
-  //gboolean is_moving = TRUE;
-  guint timer = 0;
-  guint timeout = 10e6;
-  guint usleep_time = 33333;
+  op->cls = axptz_class;
+  op->channel = ch->number;
+
+  if (!actuator_submit(op)) {
+    metrics_count_error(op->cls);
+    LOGR_WARN("PTZ actuation queue full, dropping movement %d", op->type);
+    return FALSE;
+  }
 
-  float tol = 0.05;
+  model_command(ch, op);
 
-  //GError *local_error = NULL;
+  return TRUE;
+}
 
-  g_printf("Waiting for camera movement to finish, pan=%f, tilt=%f, zoom=%f ....\n",
-    target_pan, target_tilt, target_zoom);
+/*
+ * Result of a movement, back on the main loop
+ */
+static void movement_done(const struct actuator_result *result)
+{
+  metrics_record(result->op.cls, METRICS_EVENT_QUEUE,
+                 result->start_time - result->op.submit_time);
+  metrics_record(result->op.cls, METRICS_EVENT_AXPTZ,
+                 result->end_time - result->start_time);
+
+  if (!result->ok) {
+    metrics_count_error(result->op.cls);
+    LOGR_WARN("PTZ movement %d failed", result->op.type);
+  }
+}
 
-  /* Initial sleep to avoid RC */
-  //usleep(250000);
+/*
+ * Check if a pending movement has reached it's target
+ */
+static gboolean is_target_reached(struct ptz_pending_move *move,
+                                  struct ptz_status *pt)
+{
+  /* If there is a pan movement, check if it has reached it's goal */
+  if (move->target_pan != AX_PTZ_MOVEMENT_NO_VALUE &&
+      fabs(move->target_pan - pt->pan) > PTZ_TRACK_TOLERANCE) {
+    return FALSE;
+  }
 
-  /* Check if target has been reached */
-  do {
-    struct ptz_status pt;
-    gboolean target_reached = TRUE;
+  /* If there is a tilt movement, check if it has reached it's goal */
+  if (move->target_tilt != AX_PTZ_MOVEMENT_NO_VALUE &&
+      fabs(move->target_tilt - pt->tilt) > PTZ_TRACK_TOLERANCE) {
+    return FALSE;
+  }
 
-    get_ptz_status(&pt);
+  /* If there is a zoom movement, check if it has reached it's goal */
+  if (move->target_zoom != AX_PTZ_MOVEMENT_NO_VALUE &&
+      fabs(move->target_zoom - pt->zoom) > PTZ_TRACK_TOLERANCE) {
+    return FALSE;
+  }
 
-    g_printf("---- PTZ position pan=%f, tilt=%f, zoom=%f\n", pt.pan, 
-        pt.tilt, 
-        pt.zoom);
+  return TRUE;
+}
 
-    /* If there is a pan movement, check if it has reached it's goal */
-    if (target_pan != AX_PTZ_MOVEMENT_NO_VALUE) {
-        if (fabs(target_pan - pt.pan) <= tol) {
-           g_printf("Pan position reached\n"); 
-        } else {
-            target_reached = FALSE;
-        }
-    } 
-
-    /* If there is a tilt movement, check if it has reached it's goal */
-    if (target_tilt != AX_PTZ_MOVEMENT_NO_VALUE) {
-        if (fabs(target_tilt - pt.tilt) <= tol) {
-           g_printf("Tilt position reached\n"); 
-        } else {
-            target_reached = FALSE;
-        }
-    }
+/*
+ * Timer callback polling the camera position for all pending movements.
+ * One status request is shared between all pending movements.
+ */
+static gboolean track_pending_moves(gpointer data)
+{
+  struct ptz_channel *ch = data;
+  struct ptz_status pt;
+  gboolean have_status = (ptz_get_status_snapshot(ch, &pt) == 0);
+  gint64 now = g_get_monotonic_time();
+
+  if (have_status) {
+    LOGR_TRACE("PTZ position pan=%f, tilt=%f, zoom=%f", pt.pan, pt.tilt,
+      pt.zoom);
+  }
 
-    /* If there is a zoom movement, check if it has reached it's goal */
-    if (target_zoom != AX_PTZ_MOVEMENT_NO_VALUE) {
-        if (fabs(target_zoom - pt.zoom) <= tol) {
-           g_printf("Zoom position reached\n"); 
-        } else {
-            target_reached = FALSE;
-        }
-    }
+  GList *it = ch->pending_moves;
+
+  while (it) {
+    GList *next = it->next;
+    struct ptz_pending_move *move = it->data;
+    gboolean target_reached = have_status && is_target_reached(move, &pt);
 
-    /* If the goal is reached, break out of the loop */
-    if (target_reached) {
-        break;
+    if (target_reached || now >= move->deadline) {
+      /* Unlink before invoking callback, it may add new movements */
+      ch->pending_moves = g_list_delete_link(ch->pending_moves, it);
+
+      LOGR_DEBUG("Camera movement finished, target %s",
+        target_reached ? "reached" : "not reached (timeout)");
+
+      move->callback(target_reached, move->user_data);
+      g_free(move);
     }
 
-    /* Wait a bit for the PTZ to finish moving */
-    usleep(usleep_time);
-    timer += usleep_time;
+    it = next;
+  }
+
+  if (!ch->pending_moves) {
+    ch->pending_moves_source = 0;
+    return G_SOURCE_REMOVE;
+  }
 
-  } while (timer < timeout);
+  return G_SOURCE_CONTINUE;
+}
 
-#if 0
-  if (!(ax_ptz_movement_handler_is_ptz_moving
-       (video_channel, &is_moving, &local_error))) {
-    g_error_free(local_error);
-    return FALSE;
+/*
+ * Track a movement until the camera has reached it's position. The callback
+ * is invoked from the main loop once the target is reached or on timeout.
+ */
+static int track_movement(struct ptz_channel *ch,
+                          float target_pan,
+                          float target_tilt,
+                          float target_zoom,
+                          ptz_completion_callback callback,
+                          gpointer user_data)
+{
+  if (!callback) {
+    return PTZ_CMD_COMPLETE;
   }
 
-  /* Wait until camera is in position or until we get a timeout */
-  while (is_moving && (timer < timeout)) {
-    if (!(ax_ptz_movement_handler_is_ptz_moving
-         (video_channel, &is_moving, &local_error))) {
-      g_error_free(local_error);
-      return FALSE;
-    }
+  LOGR_DEBUG("Tracking camera movement, pan=%f, tilt=%f, zoom=%f",
+    target_pan, target_tilt, target_zoom);
 
-    struct ptz_status pt;
-    get_ptz_status(&pt);
+  struct ptz_pending_move *move = g_new0(struct ptz_pending_move, 1);
 
-    g_printf("---- PTZ position pan=%f, tilt=%f, zoom=%f\n", pt.pan, pt.tilt, pt.zoom);
+  move->target_pan = target_pan;
+  move->target_tilt = target_tilt;
+  move->target_zoom = target_zoom;
+  move->deadline = g_get_monotonic_time() + PTZ_TRACK_TIMEOUT_US;
+  move->callback = callback;
+  move->user_data = user_data;
 
-    usleep(usleep_time);
-    timer += usleep_time;
+  ch->pending_moves = g_list_append(ch->pending_moves, move);
+
+  if (!ch->pending_moves_source) {
+    ch->pending_moves_source = g_timeout_add(PTZ_TRACK_INTERVAL_MS,
+                                             track_pending_moves,
+                                             ch);
   }
-#endif
 
-  g_printf("Camera movement finished....\n");
+  return PTZ_CMD_PENDING;
+}
 
-  if (timer >= timeout) {
-    /* Camera is still moving */
-    return FALSE;
-  } else {
-    /* Camera is in position */
-    return TRUE;
+/*
+ * Complete all pending movements immediately, e.g. on Clear_IF
+ */
+void ptz_flush_pending_moves(struct ptz_channel *ch)
+{
+  if (ch->pending_moves_source) {
+    g_source_remove(ch->pending_moves_source);
+    ch->pending_moves_source = 0;
+  }
+
+  while (ch->pending_moves) {
+    struct ptz_pending_move *move = ch->pending_moves->data;
+
+    ch->pending_moves = g_list_delete_link(ch->pending_moves,
+                                           ch->pending_moves);
+    move->callback(FALSE, move->user_data);
+    g_free(move);
   }
 }
 
-gboolean get_rotation()
+gboolean get_rotation(struct ptz_channel *ch)
 {
-  return image_rotated;
+  return ch->image_rotated;
 }
 
-int get_ptz_status(struct ptz_status *pt)
+int get_ptz_status(struct ptz_channel *ch, struct ptz_status *pt)
 {
   g_assert(pt);
 
-  AXPTZStatus *l_unit_status = NULL;
+  AXPTZStatus l_unit_status;
+  gint64 start = g_get_monotonic_time();
+  gboolean ok;
 
-#ifdef VERBOSE
-  g_printf("Getting PTZ status\n");
-#endif
+  LOGR_TRACE("Getting PTZ status of channel %d", ch->number);
 
   /* Get the current status (e.g. the current pan/tilt/zoom value/position) */
-  if (!(ax_ptz_movement_handler_get_ptz_status(video_channel,
-                                               AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
-                                               AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
-                                               &l_unit_status,
-                                               NULL))) {
-    g_printf("Failed to get PTZ status\n");                                                
+  ok = hal_ptz_get_status(ch->number,
+                          AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
+                          AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
+                          &l_unit_status,
+                          NULL);
+
+  metrics_record_since(METRICS_STATUS, METRICS_EVENT_AXPTZ, start);
+
+  if (!ok) {
+    metrics_count_error(METRICS_STATUS);
+    LOGR_WARN("Failed to get PTZ status");
     return -1;
   }
 
-#ifdef VERBOSE
-  g_printf("Got PTZ status\n");
-#endif
-
-  pt->pan  = fx_xtof(l_unit_status->pan_value, FIXMATH_FRAC_BITS);
-  pt->tilt = fx_xtof(l_unit_status->tilt_value, FIXMATH_FRAC_BITS);
-  pt->zoom = fx_xtof(l_unit_status->zoom_value, FIXMATH_FRAC_BITS);
-  pt->min_zoom = fx_xtof(unitless_limits->min_zoom_value, FIXMATH_FRAC_BITS);
-  pt->max_zoom = fx_xtof(unitless_limits->max_zoom_value, FIXMATH_FRAC_BITS);
+  pt->pan  = fx_xtof(l_unit_status.pan_value, FIXMATH_FRAC_BITS);
+  pt->tilt = fx_xtof(l_unit_status.tilt_value, FIXMATH_FRAC_BITS);
+  pt->zoom = fx_xtof(l_unit_status.zoom_value, FIXMATH_FRAC_BITS);
+  pt->min_zoom = fx_xtof(ch->unitless_limits.min_zoom_value, FIXMATH_FRAC_BITS);
+  pt->max_zoom = fx_xtof(ch->unitless_limits.max_zoom_value, FIXMATH_FRAC_BITS);
 
 #ifdef VERBOSE
   LOG("Status (Unit)\nP %.2f\n", pt->pan);
@@ -209,818 +413,1537 @@ int get_ptz_status(struct ptz_status *pt)
   LOG("Z max %f\n", pt->max_zoom);
 #endif
 
-  // TODO: Is this handled correctly?
-  g_free(l_unit_status);
-
   return 0;
 }
 
-gboolean ptz_init()
+/*
+ * Get PTZ status from the snapshot cache. The snapshot is refreshed when it
+ * is older than the max age, and concurrent callers during a refresh share
+ * the result of that single request.
+ */
+int ptz_get_status_snapshot(struct ptz_channel *ch, struct ptz_status *pt)
 {
-  GError *local_error = NULL;
-  
-  /* Create the axptz library */
-  if (!(ax_ptz_create(&local_error))) {
-    return FALSE;
-  }
-  
-  /* Get the application group from the PTZ control queue */
-  if (!(ax_ptz_control_queue_group =
-       ax_ptz_control_queue_get_app_group_instance(&local_error))) {
-    return FALSE;
-  }
-  
-  /* Get the current status (e.g. the current pan/tilt/zoom value/position) */
-  if (!(ax_ptz_movement_handler_get_ptz_status(video_channel,
-                                               AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS,
-                                               AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
-                                               &unitless_status,
-                                               &local_error))) {
-                                               
-    return FALSE;
-  }
-  LOG("Status (Unitless)\nP %.2f\n", fx_xtof(unitless_status->pan_value, FIXMATH_FRAC_BITS));
-  LOG("T %.2f\n", fx_xtof(unitless_status->tilt_value, FIXMATH_FRAC_BITS));
-  LOG("Z %f\n", fx_xtof(unitless_status->zoom_value, FIXMATH_FRAC_BITS));
-  
-  /* Get the current status (e.g. the current pan/tilt/zoom value/position) */
-  if (!(ax_ptz_movement_handler_get_ptz_status(video_channel,
-                                               AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
-                                               AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
-                                               &unit_status,
-                                               &local_error))) {
-                                               
-    return FALSE;
+  g_assert(pt);
+
+  struct ptz_status fresh;
+  int ret;
+
+  g_mutex_lock(&ch->status_cache_lock);
+
+  if (ch->status_cache_valid &&
+      g_get_monotonic_time() - ch->status_cache_time <=
+      ch->status_cache_max_age) {
+    ch->status_cache_hits++;
+    *pt = ch->status_cache;
+    g_mutex_unlock(&ch->status_cache_lock);
+    return 0;
   }
-  LOG("Status (Unit)\nP %.2f\n", fx_xtof(unit_status->pan_value, FIXMATH_FRAC_BITS));
-  LOG("T %.2f\n", fx_xtof(unit_status->tilt_value, FIXMATH_FRAC_BITS));
-  LOG("Z %f\n", fx_xtof(unit_status->zoom_value, FIXMATH_FRAC_BITS));
 
-  /* Get the pan, tilt and zoom limits for the unitless space */
-  if ((ax_ptz_movement_handler_get_ptz_limits(video_channel,
-                                              AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS,
-                                              AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
-                                              &unitless_limits,
-                                              &local_error))) {
-    LOG("Limits (Unitless)\nP %.2f, %.2f\n", fx_xtof(unitless_limits->min_pan_value, FIXMATH_FRAC_BITS), fx_xtof(unitless_limits->max_pan_value, FIXMATH_FRAC_BITS));
-    LOG("T %.2f, %.2f\n", fx_xtof(unitless_limits->min_tilt_value, FIXMATH_FRAC_BITS), fx_xtof(unitless_limits->max_tilt_value, FIXMATH_FRAC_BITS));
-    LOG("Z %f, %f\n", fx_xtof(unitless_limits->min_zoom_value, FIXMATH_FRAC_BITS), fx_xtof(unitless_limits->max_zoom_value, FIXMATH_FRAC_BITS));
-  } else {
-    return FALSE;
+  if (ch->status_cache_refreshing) {
+    guint generation = ch->status_cache_generation;
+
+    /* Someone else is already asking the camera, wait for the answer */
+    while (generation == ch->status_cache_generation) {
+      g_cond_wait(&ch->status_cache_cond, &ch->status_cache_lock);
+    }
+
+    ch->status_cache_hits++;
+    ret = ch->status_cache_valid ? 0 : -1;
+    if (ret == 0) {
+      *pt = ch->status_cache;
+    }
+    g_mutex_unlock(&ch->status_cache_lock);
+    return ret;
   }
 
-  /* Get the pan, tilt and zoom limits for the unit (degrees) space */
-  if ((ax_ptz_movement_handler_get_ptz_limits(video_channel,
-                                              AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
-                                              AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
-                                              &unit_limits, &local_error))) {
-    LOG("Limits (Unit)\nP %.2f, %.2f\n", fx_xtof(unit_limits->min_pan_value, FIXMATH_FRAC_BITS), fx_xtof(unit_limits->max_pan_value, FIXMATH_FRAC_BITS));
-    LOG("T %.2f, %.2f\n", fx_xtof(unit_limits->min_tilt_value, FIXMATH_FRAC_BITS), fx_xtof(unit_limits->max_tilt_value, FIXMATH_FRAC_BITS));
-    LOG("Z %f %f\n", fx_xtof(unit_limits->min_zoom_value, FIXMATH_FRAC_BITS), fx_xtof(unit_limits->max_zoom_value, FIXMATH_FRAC_BITS));
-  } else {
-    return FALSE;
+  ch->status_cache_misses++;
+  ch->status_cache_refreshing = TRUE;
+  g_mutex_unlock(&ch->status_cache_lock);
+
+  ret = get_ptz_status(ch, &fresh);
+
+  g_mutex_lock(&ch->status_cache_lock);
+  ch->status_cache_valid = (ret == 0);
+  if (ch->status_cache_valid) {
+    ch->status_cache = fresh;
+    ch->status_cache_time = g_get_monotonic_time();
+    *pt = fresh;
+    model_anchor_update(ch, &fresh, ch->status_cache_time);
   }
+  ch->status_cache_generation++;
+  ch->status_cache_refreshing = FALSE;
+  g_cond_broadcast(&ch->status_cache_cond);
+  g_mutex_unlock(&ch->status_cache_lock);
 
-  /* Get video rotation */
-  char rotation[100];
-  param_get("ImageSource.I0.Sensor.VideoRotation", rotation, 100);
+  return ret;
+}
 
-  /* Perform callback once to initiate rotation value */
-  rotation_param_callback(rotation);
+void ptz_set_status_max_age(guint max_age_ms)
+{
+  guint i;
 
-  /* Listen to parameter changes for rotation.
-     TODO: Doesn't seem like I am getting this callback, only for custom defined
-     params?
-   */
-  param_register_callback("ImageSource.I0.Sensor.VideoRotation",
-    rotation_param_callback);
+  for (i = 0; i < num_channels; i++) {
+    struct ptz_channel *ch = &channels[i];
 
-  /* Setup anonymous PTZ for focus and iris VAPIX callbacks to work. */
-  param_set("root.PTZ.BoaProtPTZOperator", "anonymous");
-  
-  return TRUE;
+    g_mutex_lock(&ch->status_cache_lock);
+    ch->status_cache_max_age = ((gint64) max_age_ms) * 1000;
+    g_mutex_unlock(&ch->status_cache_lock);
+  }
+}
+
+/*
+ * Totals of all channels
+ */
+void ptz_get_status_cache_stats(guint64 *hits, guint64 *misses,
+                                guint64 *estimates)
+{
+  guint64 total_hits = 0;
+  guint64 total_misses = 0;
+  guint64 total_estimates = 0;
+  guint i;
+
+  for (i = 0; i < num_channels; i++) {
+    struct ptz_channel *ch = &channels[i];
+
+    g_mutex_lock(&ch->status_cache_lock);
+    total_hits += ch->status_cache_hits;
+    total_misses += ch->status_cache_misses;
+    total_estimates += ch->model_estimates;
+    g_mutex_unlock(&ch->status_cache_lock);
+  }
+
+  if (hits) {
+    *hits = total_hits;
+  }
+  if (misses) {
+    *misses = total_misses;
+  }
+  if (estimates) {
+    *estimates = total_estimates;
+  }
 }
 
-int move_to_home_position()
+static float *status_axis(struct ptz_status *pt, enum ptz_axis axis)
 {
-  return ax_ptz_preset_handler_goto_home(ax_ptz_control_queue_group,
-                                         video_channel,
-                                         fx_ftox(1.0f, FIXMATH_FRAC_BITS),
-                                         AX_PTZ_PRESET_MOVEMENT_UNITLESS,
-                                         AX_PTZ_INVOKE_ASYNC, 
-                                         NULL,
-                                         NULL, 
-                                         NULL);
+  switch (axis) {
+  case PTZ_AXIS_PAN:
+    return &pt->pan;
+  case PTZ_AXIS_TILT:
+    return &pt->tilt;
+  default:
+    return &pt->zoom;
+  }
 }
 
-static void rotation_param_callback(const gchar *value)
+/*
+ * Position of an axis extrapolated from the anchor, caller holds the lock
+ */
+static float model_extrapolate(struct ptz_channel *ch, enum ptz_axis axis,
+                               gint64 now)
 {
-    g_printf("Got image rotation value %s\n", value);
+  struct ptz_axis_model *m = &ch->axis_models[axis];
+  float anchor = *status_axis(&ch->model_anchor, axis);
+  float pos = anchor +
+    m->velocity * (now - ch->model_anchor_time) / G_USEC_PER_SEC;
 
-    if (strncmp(value, "180", 3) == 0) {
-        g_printf("Image is rotated, flip mode in use\n");
-        image_rotated = TRUE;
-    } else if (strncmp(value, "0", 1) == 0) {
-        g_printf("Image is not rotated, flip not mode in use\n");
-        image_rotated = FALSE;
-    } else {
-        g_printf("Unknown value for video rotation, assume not rotated\n");
-    }
+  if (m->has_target) {
+    pos = anchor <= m->target ? MIN(pos, m->target) : MAX(pos, m->target);
+  }
+
+  return CLAMP(pos, m->min, m->max);
 }
 
 /*
- * Perform camera movement to absolute position
+ * New real sample. The velocity observed since the previous sample is used
+ * as is when no command was given in between, and continuous movements
+ * learn how fast the axis moves per unit of commanded speed.
  */
-static gboolean
-move_to_absolute_position(fixed_t pan_value,
-                          fixed_t tilt_value,
-                          AXPTZMovementPanTiltSpace pan_tilt_space,
-                          gfloat speed,
-                          AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
-                          fixed_t zoom_value, AXPTZMovementZoomSpace zoom_space)
+static void model_anchor_update(struct ptz_channel *ch,
+                                const struct ptz_status *fresh, gint64 now)
 {
-  AXPTZAbsoluteMovement *abs_movement = NULL;
-  GError *local_error = NULL;
+  gint64 dt = now - ch->model_sample_time;
+  gboolean have_dt = ch->model_valid &&
+    dt >= PTZ_MODEL_MIN_DT_US && dt <= PTZ_MODEL_MAX_DT_US;
+  int i;
 
-  /* Set the unit spaces for an absolute movement */
-  if ((ax_ptz_movement_handler_set_absolute_spaces
-       (pan_tilt_space, pan_tilt_speed_space, zoom_space, &local_error))) {
-    /* Create an absolute movement structure */
-    if ((abs_movement = ax_ptz_absolute_movement_create(&local_error))) {
-
-      /* Set the pan, tilt and zoom values for the absolute movement */
-      if (!(ax_ptz_absolute_movement_set_pan_tilt_zoom(abs_movement,
-                                                       pan_value,
-                                                       tilt_value,
-                                                       fx_ftox(speed,
-                                                               FIXMATH_FRAC_BITS),
-                                                       zoom_value,
-                                                       AX_PTZ_MOVEMENT_NO_VALUE,
-                                                       &local_error))) {
-        ax_ptz_absolute_movement_destroy(abs_movement, NULL);
-        g_error_free(local_error);
-        return FALSE;
-      }
+  for (i = 0; i < PTZ_NUM_AXES; i++) {
+    struct ptz_axis_model *m = &ch->axis_models[i];
+    float pos = *status_axis((struct ptz_status *) fresh, i);
 
-      /* Perform the absolute movement */
-      if (!(ax_ptz_movement_handler_absolute_move(ax_ptz_control_queue_group,
-                                                  video_channel,
-                                                  abs_movement,
-                                                  AX_PTZ_INVOKE_ASYNC, NULL,
-                                                  NULL, &local_error))) {
-        ax_ptz_absolute_movement_destroy(abs_movement, NULL);
-        g_error_free(local_error);
-        return FALSE;
-      }
+    if (have_dt) {
+      float observed = (pos - *status_axis(&ch->model_sample, i)) *
+        G_USEC_PER_SEC / dt;
+
+      if (m->command_time <= ch->model_sample_time) {
+        m->velocity = observed;
 
-      /* Now we don't need the absolute movement structure anymore, destroy it */
-      if (!(ax_ptz_absolute_movement_destroy(abs_movement, &local_error))) {
-        g_error_free(local_error);
-        return FALSE;
+        if (m->continuous && fabsf(m->speed) >= PTZ_MODEL_MIN_SPEED) {
+          float gain = observed / m->speed;
+          m->gain = m->gain != 0.0f ? (m->gain + gain) / 2 : gain;
+        }
+      } else if (m->has_target) {
+        m->velocity = observed;
       }
-    } else {
-      g_error_free(local_error);
-      return FALSE;
+    } else if (!m->continuous) {
+      m->velocity = 0.0f;
+    }
+
+    if (m->has_target && fabsf(pos - m->target) <= PTZ_TRACK_TOLERANCE) {
+      m->has_target = FALSE;
+      m->velocity = 0.0f;
     }
-  } else {
-    g_error_free(local_error);
-    return FALSE;
   }
 
-  return TRUE;
+  ch->model_sample = *fresh;
+  ch->model_sample_time = now;
+  ch->model_anchor = *fresh;
+  ch->model_anchor_time = now;
+  ch->model_valid = TRUE;
+}
+
+static void model_continuous(struct ptz_channel *ch, enum ptz_axis axis,
+                             fixed_t speed, gint64 now)
+{
+  struct ptz_axis_model *m = &ch->axis_models[axis];
+
+  if (speed == AX_PTZ_MOVEMENT_NO_VALUE) {
+    return;
+  }
+
+  m->speed = fx_xtof(speed, FIXMATH_FRAC_BITS);
+  m->continuous = (m->speed != 0.0f);
+  m->has_target = FALSE;
+  m->command_time = now;
+
+  /* Until the gain is learned the observed velocity is kept */
+  if (!m->continuous) {
+    m->velocity = 0.0f;
+  } else if (m->gain != 0.0f) {
+    m->velocity = m->gain * m->speed;
+  }
+}
+
+static void model_stop(struct ptz_channel *ch, enum ptz_axis axis,
+                       gint64 now)
+{
+  struct ptz_axis_model *m = &ch->axis_models[axis];
+
+  m->continuous = FALSE;
+  m->speed = 0.0f;
+  m->has_target = FALSE;
+  m->velocity = 0.0f;
+  m->command_time = now;
 }
 
+static void model_target(struct ptz_channel *ch, enum ptz_axis axis,
+                         float target, gint64 now)
+{
+  struct ptz_axis_model *m = &ch->axis_models[axis];
+
+  m->continuous = FALSE;
+  m->has_target = TRUE;
+  m->target = CLAMP(target, m->min, m->max);
+  m->command_time = now;
+}
 
 /*
- * Perform camera movement to relative position
+ * Update the model with a movement that was just queued
  */
-static gboolean move_to_relative_position(fixed_t pan_value,
-                                          fixed_t tilt_value,
-                                          AXPTZMovementPanTiltSpace pan_tilt_space,
-                                          gfloat speed,
-                                          AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
-                                          fixed_t zoom_value, AXPTZMovementZoomSpace zoom_space)
+static void model_command(struct ptz_channel *ch,
+                          const struct actuator_op *op)
 {
-  AXPTZRelativeMovement *rel_movement = NULL;
-  GError *local_error = NULL;
+  gint64 now = g_get_monotonic_time();
+  gboolean degrees = (op->pan_tilt_space == AX_PTZ_MOVEMENT_PAN_TILT_DEGREE);
+  int i;
 
-  /* Set the unit spaces for a relative movement */
-  if ((ax_ptz_movement_handler_set_relative_spaces
-       (pan_tilt_space, pan_tilt_speed_space, zoom_space, &local_error))) {
-
-    /* Create a relative movement structure */
-    if ((rel_movement = ax_ptz_relative_movement_create(&local_error))) {
-
-      /* Set the pan, tilt and zoom values for the relative movement */
-      if (!(ax_ptz_relative_movement_set_pan_tilt_zoom(rel_movement,
-                                                       pan_value,
-                                                       tilt_value,
-                                                       fx_ftox(speed, FIXMATH_FRAC_BITS),
-                                                       zoom_value,
-                                                       AX_PTZ_MOVEMENT_NO_VALUE,
-                                                       &local_error))) {
-        ax_ptz_relative_movement_destroy(rel_movement, NULL);
-        g_error_free(local_error);
-        return FALSE;
+  g_mutex_lock(&ch->status_cache_lock);
+
+  /* Rebase on the current estimate, the new velocity or target only
+     applies from now on. Observed velocities stay based on real samples. */
+  if (ch->model_valid) {
+    for (i = 0; i < PTZ_NUM_AXES; i++) {
+      *status_axis(&ch->model_anchor, i) = model_extrapolate(ch, i, now);
+    }
+    ch->model_anchor_time = now;
+  }
+
+  switch (op->type) {
+  case ACTUATOR_ABSOLUTE:
+  case ACTUATOR_RELATIVE:
+    for (i = 0; i < PTZ_NUM_AXES; i++) {
+      fixed_t value = i == PTZ_AXIS_PAN ? op->pan :
+        i == PTZ_AXIS_TILT ? op->tilt : op->zoom;
+      float target;
+
+      if (value == AX_PTZ_MOVEMENT_NO_VALUE) {
+        continue;
       }
 
-      /* Perform the relative movement */
-      if (!(ax_ptz_movement_handler_relative_move(ax_ptz_control_queue_group,
-                                                  video_channel,
-                                                  rel_movement,
-                                                  AX_PTZ_INVOKE_ASYNC, NULL,
-                                                  NULL, &local_error))) {
-        ax_ptz_relative_movement_destroy(rel_movement, NULL);
-        g_error_free(local_error);
-        return FALSE;
+      /* Only pan/tilt degrees and unitless zoom are modelled */
+      if ((i != PTZ_AXIS_ZOOM && !degrees) ||
+          (i == PTZ_AXIS_ZOOM && op->zoom_space != AX_PTZ_MOVEMENT_ZOOM_UNITLESS)) {
+        ch->model_valid = FALSE;
+        continue;
       }
 
-      /* Now we don't need the relative movement structure anymore, destroy it */
-      if (!(ax_ptz_relative_movement_destroy(rel_movement, &local_error))) {
-        g_error_free(local_error);
-        return FALSE;
+      target = fx_xtof(value, FIXMATH_FRAC_BITS);
+      if (op->type == ACTUATOR_RELATIVE) {
+        if (!ch->model_valid) {
+          continue;
+        }
+        target += model_extrapolate(ch, i, now);
       }
-    } else {
-      g_error_free(local_error);
-      return FALSE;
+
+      model_target(ch, i, target, now);
     }
-  } else {
-    g_error_free(local_error);
-    return FALSE;
+    break;
+  case ACTUATOR_CONTINUOUS_START:
+    model_continuous(ch, PTZ_AXIS_PAN, op->pan, now);
+    model_continuous(ch, PTZ_AXIS_TILT, op->tilt, now);
+    model_continuous(ch, PTZ_AXIS_ZOOM, op->zoom, now);
+    break;
+  case ACTUATOR_CONTINUOUS_STOP:
+    if (op->stop_pan_tilt) {
+      model_stop(ch, PTZ_AXIS_PAN, now);
+      model_stop(ch, PTZ_AXIS_TILT, now);
+    }
+    if (op->stop_zoom) {
+      model_stop(ch, PTZ_AXIS_ZOOM, now);
+    }
+    break;
+  case ACTUATOR_HOME:
+  case ACTUATOR_GOTO_PRESET:
+    /* Target is not known here, the next inquiry takes a real sample */
+    for (i = 0; i < PTZ_NUM_AXES; i++) {
+      model_stop(ch, i, now);
+    }
+    ch->model_valid = FALSE;
+    break;
+  default:
+    break;
   }
 
-  return TRUE;
+  g_mutex_unlock(&ch->status_cache_lock);
 }
 
 /*
- * Perform continous camera movement
+ * PTZ status for position inquiries, extrapolated by the motion model
+ * within the window after a real sample, otherwise from the snapshot cache.
  */
-static gboolean
-start_continous_movement(fixed_t pan_speed,
-                         fixed_t tilt_speed,
-                         AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
-                         fixed_t zoom_speed, gfloat timeout)
+int ptz_get_status_estimate(struct ptz_channel *ch, struct ptz_status *pt)
 {
-  AXPTZContinuousMovement *cont_movement = NULL;
-  GError *local_error = NULL;
+  g_assert(pt);
 
-  /* Set the unit spaces for a continous movement */
-  if ((ax_ptz_movement_handler_set_continuous_spaces
-       (pan_tilt_speed_space, &local_error))) {
-
-    /* Create a continous movement structure */
-    if ((cont_movement = ax_ptz_continuous_movement_create(&local_error))) {
-
-      /* Set the pan, tilt and zoom speeds for the continous movement */
-      if (!(ax_ptz_continuous_movement_set_pan_tilt_zoom(cont_movement,
-                                                         pan_speed,
-                                                         tilt_speed,
-                                                         zoom_speed,
-                                                         fx_ftox(timeout, FIXMATH_FRAC_BITS),
-                                                         &local_error))) {
-        ax_ptz_continuous_movement_destroy(cont_movement, NULL);
-        g_error_free(local_error);
-        return FALSE;
-      }
+  gint64 now = g_get_monotonic_time();
+  int i;
 
-      /* Perform the continous movement */
-      if (!(ax_ptz_movement_handler_continuous_start(ax_ptz_control_queue_group,
-                                                     video_channel,
-                                                     cont_movement,
-                                                     AX_PTZ_INVOKE_ASYNC, NULL,
-                                                     NULL, &local_error))) {
-        ax_ptz_continuous_movement_destroy(cont_movement, NULL);
-        g_error_free(local_error);
-        return FALSE;
-      }
+  g_mutex_lock(&ch->status_cache_lock);
 
-      /* Now we don't need the continous movement structure anymore, destroy it */
-      if (!(ax_ptz_continuous_movement_destroy(cont_movement, &local_error))) {
-        g_error_free(local_error);
-        return FALSE;
-      }
-    } else {
-      g_error_free(local_error);
-      return FALSE;
-    }
-  } else {
-    g_error_free(local_error);
-    return FALSE;
+  if (!ch->model_valid || ch->model_horizon == 0 ||
+      now - ch->model_sample_time > ch->model_horizon) {
+    g_mutex_unlock(&ch->status_cache_lock);
+    return ptz_get_status_snapshot(ch, pt);
   }
 
-  return TRUE;
+  *pt = ch->model_anchor;
+  for (i = 0; i < PTZ_NUM_AXES; i++) {
+    *status_axis(pt, i) = model_extrapolate(ch, i, now);
+  }
+  ch->model_estimates++;
+
+  g_mutex_unlock(&ch->status_cache_lock);
+
+  return 0;
 }
 
-/*
- * Stop continous camera movement
- */
-gboolean stop_continous_movement(gboolean stop_pan_tilt,
-                                        gboolean stop_zoom)
+void ptz_set_extrapolation_window(guint window_ms)
 {
-  GError *local_error = NULL;
+  guint i;
 
-  /* Stop the continous movement */
-  if (!(ax_ptz_movement_handler_continuous_stop(ax_ptz_control_queue_group,
-                                                video_channel,
-                                                stop_pan_tilt,
-                                                stop_zoom, AX_PTZ_INVOKE_ASYNC,
-                                                NULL, NULL, &local_error))) {
-    g_error_free(local_error);
-    return FALSE;
+  for (i = 0; i < num_channels; i++) {
+    struct ptz_channel *ch = &channels[i];
+
+    g_mutex_lock(&ch->status_cache_lock);
+    ch->model_horizon = ((gint64) window_ms) * 1000;
+    g_mutex_unlock(&ch->status_cache_lock);
   }
+}
 
-  return TRUE;
+static void extrapolate_param_callback(const gchar *value)
+{
+  gint64 window_ms = g_ascii_strtoll(value, NULL, 10);
+
+  g_printf("Got position extrapolation window %s ms\n", value);
+
+  ptz_set_extrapolation_window(CLAMP(window_ms, 0, 1000));
 }
 
-static fixed_t translate_speed_zoom(int speed)
+/*
+ * Axis limits of the model, pan/tilt in degrees and zoom unitless as in
+ * the status
+ */
+static void model_init(struct ptz_channel *ch)
 {
-  return fx_ftox( ((float) CLAMP(speed, 0, 7)) / 7, FIXMATH_FRAC_BITS);
+  ch->axis_models[PTZ_AXIS_PAN].min =
+    fx_xtof(ch->unit_limits.min_pan_value, FIXMATH_FRAC_BITS);
+  ch->axis_models[PTZ_AXIS_PAN].max =
+    fx_xtof(ch->unit_limits.max_pan_value, FIXMATH_FRAC_BITS);
+  ch->axis_models[PTZ_AXIS_TILT].min =
+    fx_xtof(ch->unit_limits.min_tilt_value, FIXMATH_FRAC_BITS);
+  ch->axis_models[PTZ_AXIS_TILT].max =
+    fx_xtof(ch->unit_limits.max_tilt_value, FIXMATH_FRAC_BITS);
+  ch->axis_models[PTZ_AXIS_ZOOM].min =
+    fx_xtof(ch->unitless_limits.min_zoom_value, FIXMATH_FRAC_BITS);
+  ch->axis_models[PTZ_AXIS_ZOOM].max =
+    fx_xtof(ch->unitless_limits.max_zoom_value, FIXMATH_FRAC_BITS);
 }
+
 /*
- * Translate joystick speed to Axis PTZ speed
+ * Compile the calibration profile named by value, or the one of the camera
+ * model when it is empty, into the conversion tables of every channel
  */
-fixed_t translate_speed_pt(int speed)
+static void calibration_param_callback(const gchar *value)
 {
-  fixed_t abs_speed = fx_ftox( ((float) CLAMP(speed, 0, 17)) / 17, FIXMATH_FRAC_BITS);
+  struct calib_profile profile;
+  char model[64] = "";
+  guint i;
 
-  if (image_rotated) {
-    return -abs_speed;
+  if (value && *value) {
+    g_strlcpy(model, value, sizeof(model));
   } else {
-    return abs_speed;
+    param_get("Brand.ProdNbr", model, sizeof(model));
   }
-} 
 
-/*
- * Process received command and move camera accordingly
- */
-int process_command(unsigned char* data, int length_data)
-{
-  //LOGINFO("Received data: %x\n", data);
-  //syslog(LOG_INFO, "%s", data);
-  unsigned char *command = data;
-  int speed_pan;
-  int speed_tilt;
-  int speed_zoom;
-
-  /* IMG FLIP COMMAND */
-  if (command[2] == 0x04 && command[3] == 0x66) {
-    unsigned char p = command[4] & 0x0F;
-
-    if (p == 2) {
-        param_set("ImageSource.I0.Sensor.VideoRotation", "180");
-        rotation_param_callback("180");
-    } else if (p == 3) {
-        param_set("ImageSource.I0.Sensor.VideoRotation", "0");
-        rotation_param_callback("0");
-    } else {
-        g_printf("Got unknown IMG FLIP command\n");
-    }
-    
-  }
-      
-  //if autofocus on/off
-  if(command[2] == 0x04 && command[3] == 0x38 && command[4] == 0x02) {
-    //autofocus ON
-    g_printf("Got Focus AUTO Command\n");
-    system("curl http://127.0.0.1/axis-cgi/com/ptz.cgi?autofocus=on &");
-  } else if (command[2] == 0x04 && command[3] == 0x38 && command[4] == 0x03) {
-    //autofocus OFF
-    g_printf("Got Focus MANUAL Command\n");
-    system("curl http://127.0.0.1/axis-cgi/com/ptz.cgi?autofocus=off &");
-  } else if (command[2] == 0x04 && command[3] == 0x48) {
-    unsigned int p = command[4] & 0x0F;
-    unsigned int q = command[5] & 0x0F;
-    unsigned int r = command[6] & 0x0F;
-    unsigned int s = command[7] & 0x0F;
+  calib_load(CALIB_FILE, model, &profile);
 
-    unsigned int Focus = (p << 12) | (q << 8) | (r << 4) | s;
+  g_printf("Using calibration profile %s for %s, pan %.2f, tilt %.2f, "
+           "%.1fx zoom\n", profile.name, model, profile.pan_degrees,
+           profile.tilt_degrees, profile.optical_zoom);
 
-    Focus = CLAMP(Focus, 0x1000, 0xC000);
+  for (i = 0; i < num_channels; i++) {
+    struct ptz_channel *ch = &channels[i];
 
-    long double focus_remapped = 10000 - (10000 *
-      (((float) (Focus - 0x1000)) / (0xC000 - 0x1000)));
-    focus_remapped = CLAMP(focus_remapped, 1, 9999);
+    conv_init(&ch->conv, &ch->unit_limits, &ch->unitless_limits, &profile);
+  }
+}
 
-    //ptz_preset_struct.focus = focus_remapped;
+static void status_cache_param_callback(const gchar *value)
+{
+  gint64 max_age_ms = g_ascii_strtoll(value, NULL, 10);
 
-    g_printf("Translated focus value %Lf\n", focus_remapped);
+  g_printf("Got status cache max age %s ms\n", value);
 
-    char cmd[100];
-    sprintf(cmd, "curl http://127.0.0.1/axis-cgi/com/ptz.cgi?focus=%d &", (int) focus_remapped);
+  ptz_set_status_max_age(CLAMP(max_age_ms, 0, 1000));
+}
 
-    g_printf("Executing command %s\n", cmd);                  
-    system(cmd);
-  }
+/*
+ * Parse the channel list, e.g. "1,2". Unknown or repeated channels are
+ * skipped, channel 1 is served if nothing is left.
+ */
+static void channels_init(const gchar *value)
+{
+  gchar **numbers = g_strsplit(value ? value : "", ",", -1);
+  guint i, k;
 
-  //if open/close iris (from Cam_Iris or Cam_AE)
-  if(command[2] == 0x04 && (command[3] == 0x0B || command[3] == 0x39) && command[4] == 0x00) {
-    g_printf("Got iris AUTO  command\n");
-    system("curl http://127.0.0.1/axis-cgi/com/ptz.cgi?autoiris=on &");
-  } else if (command[2] == 0x04 && command[3] == 0x39 && command[4] == 0x03) {
-    system("curl http://127.0.0.1/axis-cgi/com/ptz.cgi?autoiris=off &");
-    g_printf("Got iris MANUAL command\n");
-  } else if (command[2] == 0x04 && command[3] == 0x4B && command[4] == 0x00 && command[5] == 0x00) {
-    unsigned int p = command[6] & 0x0F;
-    unsigned int q = command[7] & 0x0F;
+  num_channels = 0;
 
-    unsigned int F = (p << 4) | q;
+  for (i = 0; numbers[i] && num_channels < PTZ_MAX_CHANNELS; i++) {
+    gint64 number = g_ascii_strtoll(g_strstrip(numbers[i]), NULL, 10);
+    gboolean duplicate = FALSE;
 
-    if (F >= 0x11) {
-      F = 0x11;
+    for (k = 0; k < num_channels; k++) {
+      duplicate |= (channels[k].number == number);
     }
-    
-    int iris_value = (int) (((float) 10000) / 0x11 ) * F;
-    iris_value = CLAMP(iris_value, 1, 9999);
 
-    char cmd[100];
-    sprintf(cmd, "curl http://127.0.0.1/axis-cgi/com/ptz.cgi?iris=%d &", iris_value);
+    if (number < 1 || number > G_MAXINT || duplicate) {
+      continue;
+    }
 
-    g_printf("Executing command %s\n", cmd);                  
-    system(cmd);
+    channels[num_channels].number = number;
+    num_channels++;
   }
+
+  g_strfreev(numbers);
+
+  if (num_channels == 0) {
+    channels[0].number = 1;
+    num_channels = 1;
+  }
+
+  for (i = 0; i < num_channels; i++) {
+    struct ptz_channel *ch = &channels[i];
+
+    ch->index = i;
+    g_mutex_init(&ch->status_cache_lock);
+    g_cond_init(&ch->status_cache_cond);
+    ch->status_cache_max_age = PTZ_STATUS_MAX_AGE_MS_DEFAULT * 1000;
+    ch->model_horizon = PTZ_EXTRAPOLATE_MS_DEFAULT * 1000;
+  }
+}
+
+/*
+ * Read the status and limits of a channel
+ */
+static gboolean channel_init(struct ptz_channel *ch)
+{
+  GError *local_error = NULL;
+  AXPTZStatus unitless_status;
+  AXPTZStatus unit_status;
+
+  LOG("Channel %d\n", ch->number);
+
+  /* Get the current status (e.g. the current pan/tilt/zoom value/position) */
+  if (!(hal_ptz_get_status(ch->number,
+                           AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS,
+                           AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
+                           &unitless_status,
+                           &local_error))) {
+                                               
+    return FALSE;
+  }
+  LOG("Status (Unitless)\nP %.2f\n", fx_xtof(unitless_status.pan_value, FIXMATH_FRAC_BITS));
+  LOG("T %.2f\n", fx_xtof(unitless_status.tilt_value, FIXMATH_FRAC_BITS));
+  LOG("Z %f\n", fx_xtof(unitless_status.zoom_value, FIXMATH_FRAC_BITS));
   
+  /* Get the current status (e.g. the current pan/tilt/zoom value/position) */
+  if (!(hal_ptz_get_status(ch->number,
+                           AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
+                           AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
+                           &unit_status,
+                           &local_error))) {
+                                               
+    return FALSE;
+  }
+  LOG("Status (Unit)\nP %.2f\n", fx_xtof(unit_status.pan_value, FIXMATH_FRAC_BITS));
+  LOG("T %.2f\n", fx_xtof(unit_status.tilt_value, FIXMATH_FRAC_BITS));
+  LOG("Z %f\n", fx_xtof(unit_status.zoom_value, FIXMATH_FRAC_BITS));
 
-  //if zoom
-  if(command[2] == 0x04 && command[3] == 0x07)
-  {
+  /* Get the pan, tilt and zoom limits for the unitless space */
+  if ((hal_ptz_get_limits(ch->number,
+                          AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS,
+                          AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
+                          &ch->unitless_limits,
+                          &local_error))) {
+    LOG("Limits (Unitless)\nP %.2f, %.2f\n", fx_xtof(ch->unitless_limits.min_pan_value, FIXMATH_FRAC_BITS), fx_xtof(ch->unitless_limits.max_pan_value, FIXMATH_FRAC_BITS));
+    LOG("T %.2f, %.2f\n", fx_xtof(ch->unitless_limits.min_tilt_value, FIXMATH_FRAC_BITS), fx_xtof(ch->unitless_limits.max_tilt_value, FIXMATH_FRAC_BITS));
+    LOG("Z %f, %f\n", fx_xtof(ch->unitless_limits.min_zoom_value, FIXMATH_FRAC_BITS), fx_xtof(ch->unitless_limits.max_zoom_value, FIXMATH_FRAC_BITS));
+  } else {
+    return FALSE;
+  }
 
-    speed_zoom = (int) command[4] & 0x0f;
-    if((command[4] & 0xf0) == 0x20)
-    {
-      //syslog(LOG_INFO, "Zoom out var");
-      if (!(start_continous_movement(AX_PTZ_MOVEMENT_NO_VALUE, //unitless_pos_speed
-                               AX_PTZ_MOVEMENT_NO_VALUE, //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               translate_speed_zoom(speed_zoom), 1000.0f))) //zoom
-      {
-          syslog(LOG_INFO, "Failure, Zoom");
-      }
-    }
-    if((command[4] & 0xf0) == 0x30)
-    {
-      //syslog(LOG_INFO, "Zoom in var");
-      if (!(start_continous_movement(AX_PTZ_MOVEMENT_NO_VALUE, //unitless_pos_speed
-                               AX_PTZ_MOVEMENT_NO_VALUE, //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               -translate_speed_zoom(speed_zoom), 1000.0f))) //zoom
-      {
-          syslog(LOG_INFO, "Failure, Zoom");
-      }
-      
-    }
-    if((command[4]) == 0x02)
-    {
-      //check current zoom setting, adjust if not max, set to max if current + step > max
-      //syslog(LOG_INFO, "Zoom in fix");
-      if (!(start_continous_movement(AX_PTZ_MOVEMENT_NO_VALUE, //unitless_pos_speed
-                               AX_PTZ_MOVEMENT_NO_VALUE, //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               fx_ftox(1.0f, FIXMATH_FRAC_BITS), 1000.0f))) //zoom
-      {
-          syslog(LOG_INFO, "Failure, Zoom");
-      }
-    }
-    if((command[4]) == 0x03)
-    {
-      //syslog(LOG_INFO, "Zoom out fix");
-      if (!(start_continous_movement(AX_PTZ_MOVEMENT_NO_VALUE, //unitless_pos_speed
-                               AX_PTZ_MOVEMENT_NO_VALUE, //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               -fx_ftox(1.0f, FIXMATH_FRAC_BITS), 1000.0f))) //zoom
-      {
-          syslog(LOG_INFO, "Failure, Zoom");
-      }
-      
+  /* Get the pan, tilt and zoom limits for the unit (degrees) space */
+  if ((hal_ptz_get_limits(ch->number,
+                          AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
+                          AX_PTZ_MOVEMENT_ZOOM_UNITLESS,
+                          &ch->unit_limits, &local_error))) {
+    LOG("Limits (Unit)\nP %.2f, %.2f\n", fx_xtof(ch->unit_limits.min_pan_value, FIXMATH_FRAC_BITS), fx_xtof(ch->unit_limits.max_pan_value, FIXMATH_FRAC_BITS));
+    LOG("T %.2f, %.2f\n", fx_xtof(ch->unit_limits.min_tilt_value, FIXMATH_FRAC_BITS), fx_xtof(ch->unit_limits.max_tilt_value, FIXMATH_FRAC_BITS));
+    LOG("Z %f %f\n", fx_xtof(ch->unit_limits.min_zoom_value, FIXMATH_FRAC_BITS), fx_xtof(ch->unit_limits.max_zoom_value, FIXMATH_FRAC_BITS));
+  } else {
+    return FALSE;
+  }
+
+  /* Get video rotation of the image source of the channel */
+  char rotation[100];
+  char rotation_param[64];
+
+  g_snprintf(rotation_param, sizeof(rotation_param),
+             "ImageSource.I%d.Sensor.VideoRotation", ch->number - 1);
+  param_get(rotation_param, rotation, 100);
+
+  set_rotation(ch, rotation);
+
+  model_init(ch);
+
+  return TRUE;
+}
+
+gboolean ptz_init()
+{
+  GError *local_error = NULL;
+  gint numbers[PTZ_MAX_CHANNELS];
+  guint i;
+  
+  /* Create the PTZ backend */
+  if (!(hal_ptz_init(&local_error))) {
+    return FALSE;
+  }
+
+  /* Get the PTZ channels to serve */
+  char channel_list[64];
+  if (!param_get("Channels", channel_list, sizeof(channel_list))) {
+    channel_list[0] = '\0';
+  }
+  channels_init(channel_list);
+
+  for (i = 0; i < num_channels; i++) {
+    char rotation_param[64];
+
+    if (!channel_init(&channels[i])) {
+      return FALSE;
     }
-    if((command[4]) == 0x00) //if((command[4] & 0xf0) == 0x00)
-    {
-      //syslog(LOG_INFO, "Zoom stop");
-      if (!(stop_continous_movement(FALSE, TRUE))) 
-      {
-        syslog(LOG_INFO, "Failure, Zoom");
-      }
+    numbers[i] = channels[i].number;
+
+    /* Listen to rotation changes of the image source of the channel */
+    g_snprintf(rotation_param, sizeof(rotation_param),
+               "ImageSource.I%d.Sensor.VideoRotation", channels[i].number - 1);
+    param_register_callback(rotation_param, rotation_param_callbacks[i]);
+  }
+
+  /* Get freshness window of the status snapshot cache */
+  char max_age[32];
+  if (param_get("StatusCacheMs", max_age, sizeof(max_age))) {
+    status_cache_param_callback(max_age);
+  }
+
+  param_register_callback("StatusCacheMs", status_cache_param_callback);
+
+  /* Get window for coalescing continuous drives */
+  char drive_window[32];
+  if (param_get("DriveWindowMs", drive_window, sizeof(drive_window))) {
+    drive_window_param_callback(drive_window);
+  }
+
+  param_register_callback("DriveWindowMs", drive_window_param_callback);
+
+  /* VISCA conversion tables depend on the limits and the camera model */
+  char calibration[64];
+  if (!param_get("CalibrationProfile", calibration, sizeof(calibration))) {
+    calibration[0] = '\0';
+  }
+  calibration_param_callback(calibration);
+
+  param_register_callback("CalibrationProfile", calibration_param_callback);
+
+  /* Get window for answering position inquiries from the motion model */
+  char extrapolate[32];
+  if (param_get("ExtrapolateMs", extrapolate, sizeof(extrapolate))) {
+    extrapolate_param_callback(extrapolate);
+  }
+
+  param_register_callback("ExtrapolateMs", extrapolate_param_callback);
+
+  /* Movements are executed on a thread per channel from here on */
+  if (!actuator_init(numbers, num_channels, movement_done)) {
+    return FALSE;
+  }
+
+  /* Setup anonymous PTZ for focus and iris VAPIX callbacks to work. */
+  param_set("root.PTZ.BoaProtPTZOperator", "anonymous");
+  
+  return TRUE;
+}
+
+void ptz_cleanup()
+{
+  guint i;
+
+  for (i = 0; i < num_channels; i++) {
+    struct ptz_channel *ch = &channels[i];
+
+    ptz_flush_pending_moves(ch);
+
+    if (ch->drive_window_source) {
+      g_source_remove(ch->drive_window_source);
+      ch->drive_window_source = 0;
     }
-  /* Direct Zoom */
-  } else if (command[2] == 0x04 && command[3] == 0x47) {
-    unsigned int p = command[4] & 0x0F;
-    unsigned int q = command[5] & 0x0F;
-    unsigned int r = command[6] & 0x0F;
-    unsigned int s = command[7] & 0x0F;
+  }
 
-    unsigned int Z = (p << 12) | (q << 8) | (r << 4) | s;
+  actuator_cleanup();
+  hal_ptz_cleanup();
+}
 
-    g_printf("Got Direct Zoom value %d\n", Z);
+guint ptz_num_channels()
+{
+  return num_channels;
+}
+
+struct ptz_channel *ptz_get_channel(guint index)
+{
+  g_assert(index < num_channels);
 
-    if (Z > 0x4000) {
-      Z = 0x4000;
+  return &channels[index];
+}
+
+gint ptz_channel_number(const struct ptz_channel *ch)
+{
+  return ch->number;
+}
+
+guint ptz_channel_index(const struct ptz_channel *ch)
+{
+  return ch->index;
+}
+
+const struct conv_tables *ptz_channel_conv(const struct ptz_channel *ch)
+{
+  return &ch->conv;
+}
+
+int move_to_home_position(struct ptz_channel *ch)
+{
+  struct actuator_op op = {
+    .type = ACTUATOR_HOME,
+    .speed = fx_ftox(1.0f, FIXMATH_FRAC_BITS),
+  };
+
+  return submit_movement(ch, &op);
+}
+
+static void set_rotation(struct ptz_channel *ch, const gchar *value)
+{
+    /* Value is not static, only the outcome goes to the log ring */
+    if (strncmp(value, "180", 3) == 0) {
+        LOGR_INFO("Image of channel %d is rotated, flip mode in use",
+          ch->number);
+        ch->image_rotated = TRUE;
+    } else if (strncmp(value, "0", 1) == 0) {
+        LOGR_INFO("Image of channel %d is not rotated, flip mode not in use",
+          ch->number);
+        ch->image_rotated = FALSE;
+    } else {
+        LOGR_WARN("Unknown video rotation of channel %d, assume not rotated",
+          ch->number);
     }
+}
 
-#ifdef VERBOSE
-    g_printf("Data Received: ");
-    size_t i = 0;
-    for (; i < length_data; i++) {
-      g_printf("%d=[0x%02x], ", i, command[i]);
-    } 
-    g_printf("\n");
-#endif
+/* Parameter callbacks carry no user data, one per channel index */
+static void rotation_param_callback_0(const gchar *value)
+{
+  set_rotation(&channels[0], value);
+}
 
-    float zoom_unitless_f = 
-      (fx_xtof(unitless_limits->max_zoom_value, FIXMATH_FRAC_BITS) / 0x4000)
-      * Z; 
+static void rotation_param_callback_1(const gchar *value)
+{
+  set_rotation(&channels[1], value);
+}
 
-    fixed_t api_zoom_val_unitless = fx_ftox(zoom_unitless_f, FIXMATH_FRAC_BITS);
+static void rotation_param_callback_2(const gchar *value)
+{
+  set_rotation(&channels[2], value);
+}
 
-    g_printf("Calculated zoom value %f\n", fx_xtof(api_zoom_val_unitless, FIXMATH_FRAC_BITS));
+static void rotation_param_callback_3(const gchar *value)
+{
+  set_rotation(&channels[3], value);
+}
 
-    move_to_absolute_position(AX_PTZ_MOVEMENT_NO_VALUE,
-                          AX_PTZ_MOVEMENT_NO_VALUE,
-                          AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS,
-                          1.0f,
-                          AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                          api_zoom_val_unitless, 
-                          AX_PTZ_MOVEMENT_ZOOM_UNITLESS);
-
-    wait_for_camera_movement_to_finish(AX_PTZ_MOVEMENT_NO_VALUE, 
-      AX_PTZ_MOVEMENT_NO_VALUE,
-      zoom_unitless_f);
-  } 
-  
-  //if pan/tilt
-  if(command[2] == 0x06 && command[3] == 0x01)
+static const param_callback rotation_param_callbacks[PTZ_MAX_CHANNELS] = {
+  rotation_param_callback_0,
+  rotation_param_callback_1,
+  rotation_param_callback_2,
+  rotation_param_callback_3,
+};
+
+/*
+ * Perform camera movement to absolute position
+ */
+static gboolean
+move_to_absolute_position(struct ptz_channel *ch,
+                          fixed_t pan_value,
+                          fixed_t tilt_value,
+                          AXPTZMovementPanTiltSpace pan_tilt_space,
+                          gfloat speed,
+                          AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                          fixed_t zoom_value, AXPTZMovementZoomSpace zoom_space)
+{
+  struct actuator_op op = {
+    .type = ACTUATOR_ABSOLUTE,
+    .pan = pan_value,
+    .tilt = tilt_value,
+    .pan_tilt_space = pan_tilt_space,
+    .speed = fx_ftox(speed, FIXMATH_FRAC_BITS),
+    .pan_tilt_speed_space = pan_tilt_speed_space,
+    .zoom = zoom_value,
+    .zoom_space = zoom_space,
+  };
+
+  return submit_movement(ch, &op);
+}
+
+
+/*
+ * Perform camera movement to relative position
+ */
+static gboolean move_to_relative_position(struct ptz_channel *ch,
+                                          fixed_t pan_value,
+                                          fixed_t tilt_value,
+                                          AXPTZMovementPanTiltSpace pan_tilt_space,
+                                          gfloat speed,
+                                          AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                                          fixed_t zoom_value, AXPTZMovementZoomSpace zoom_space)
+{
+  struct actuator_op op = {
+    .type = ACTUATOR_RELATIVE,
+    .pan = pan_value,
+    .tilt = tilt_value,
+    .pan_tilt_space = pan_tilt_space,
+    .speed = fx_ftox(speed, FIXMATH_FRAC_BITS),
+    .pan_tilt_speed_space = pan_tilt_speed_space,
+    .zoom = zoom_value,
+    .zoom_space = zoom_space,
+  };
+
+  return submit_movement(ch, &op);
+}
+
+/*
+ * Perform continous camera movement
+ */
+static gboolean
+start_continous_movement(struct ptz_channel *ch,
+                         fixed_t pan_speed,
+                         fixed_t tilt_speed,
+                         AXPTZMovementPanTiltSpeedSpace pan_tilt_speed_space,
+                         fixed_t zoom_speed, gfloat timeout)
+{
+  struct actuator_op op = {
+    .type = ACTUATOR_CONTINUOUS_START,
+    .pan = pan_speed,
+    .tilt = tilt_speed,
+    .pan_tilt_speed_space = pan_tilt_speed_space,
+    .zoom = zoom_speed,
+    .timeout = fx_ftox(timeout, FIXMATH_FRAC_BITS),
+  };
+
+  return submit_movement(ch, &op);
+}
+
+/*
+ * Send the latest coalesced drive, if any arrived since the last one
+ */
+static void actuate_drive(struct ptz_channel *ch)
+{
+  if (!ch->drive_pt_dirty && !ch->drive_zoom_dirty) {
+    return;
+  }
+
+  fixed_t pan_speed = ch->drive_pt_dirty ? ch->drive_pan_speed : AX_PTZ_MOVEMENT_NO_VALUE;
+  fixed_t tilt_speed = ch->drive_pt_dirty ? ch->drive_tilt_speed : AX_PTZ_MOVEMENT_NO_VALUE;
+  fixed_t zoom_speed = ch->drive_zoom_dirty ? ch->drive_zoom_speed : AX_PTZ_MOVEMENT_NO_VALUE;
+
+  ch->drive_pt_dirty = FALSE;
+  ch->drive_zoom_dirty = FALSE;
+  ch->drive_actuated++;
+
+  /* Also called when the coalescing window expires */
+  enum metrics_class prev_class = axptz_class;
+  axptz_class = METRICS_DRIVE;
+
+  if (!(start_continous_movement(ch, pan_speed,
+                                 tilt_speed,
+                                 AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
+                                 zoom_speed, 1000.0f)))
   {
+    syslog(LOG_INFO, "Failure, Pan/Tilt/Zoom drive");
+  }
+
+  axptz_class = prev_class;
+}
+
+static gboolean drive_window_expired(gpointer data)
+{
+  struct ptz_channel *ch = data;
+
+  /* Nothing new during the window, next drive is sent right away */
+  if (!ch->drive_pt_dirty && !ch->drive_zoom_dirty) {
+    ch->drive_window_source = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  actuate_drive(ch);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Queue a continuous drive. The first drive is sent immediately and opens
+ * a window, drives arriving within the window only update the speeds and
+ * the latest ones are sent when the window expires.
+ */
+static void submit_drive(struct ptz_channel *ch,
+                         fixed_t pan_speed,
+                         fixed_t tilt_speed,
+                         fixed_t zoom_speed)
+{
+  ch->drive_received++;
+
+  if (pan_speed != AX_PTZ_MOVEMENT_NO_VALUE ||
+      tilt_speed != AX_PTZ_MOVEMENT_NO_VALUE) {
+    ch->drive_pan_speed = pan_speed;
+    ch->drive_tilt_speed = tilt_speed;
+    ch->drive_pt_dirty = TRUE;
+  }
+
+  if (zoom_speed != AX_PTZ_MOVEMENT_NO_VALUE) {
+    ch->drive_zoom_speed = zoom_speed;
+    ch->drive_zoom_dirty = TRUE;
+  }
+
+  if (ch->drive_window_source) {
+    return;
+  }
+
+  actuate_drive(ch);
+
+  if (drive_window_ms > 0) {
+    ch->drive_window_source = g_timeout_add(drive_window_ms,
+                                        drive_window_expired,
+                                        ch);
+  }
+}
+
+void ptz_get_drive_stats(guint64 *received, guint64 *actuated)
+{
+  guint64 total_received = 0;
+  guint64 total_actuated = 0;
+  guint i;
+
+  for (i = 0; i < num_channels; i++) {
+    total_received += channels[i].drive_received;
+    total_actuated += channels[i].drive_actuated;
+  }
+
+  if (received) {
+    *received = total_received;
+  }
+  if (actuated) {
+    *actuated = total_actuated;
+  }
+}
+
+static void drive_window_param_callback(const gchar *value)
+{
+  gint64 window_ms = g_ascii_strtoll(value, NULL, 10);
+
+  g_printf("Got drive coalescing window %s ms\n", value);
+
+  drive_window_ms = CLAMP(window_ms, 0, 500);
+}
+
+/*
+ * Stop continous camera movement
+ */
+gboolean stop_continous_movement(struct ptz_channel *ch,
+                                 gboolean stop_pan_tilt,
+                                 gboolean stop_zoom)
+{
+  struct actuator_op op = {
+    .type = ACTUATOR_CONTINUOUS_STOP,
+    .stop_pan_tilt = stop_pan_tilt,
+    .stop_zoom = stop_zoom,
+  };
+
+  /* Stops are never delayed, and drop any drive not yet sent */
+  if (stop_pan_tilt) {
+    ch->drive_pt_dirty = FALSE;
+  }
+
+  if (stop_zoom) {
+    ch->drive_zoom_dirty = FALSE;
+  }
+
+  /* Stop the continous movement, queued movements are executed in order */
+  return submit_movement(ch, &op);
+}
+
+static fixed_t translate_speed_zoom(int speed)
+{
+  return fx_ftox( ((float) CLAMP(speed, 0, 7)) / 7, FIXMATH_FRAC_BITS);
+}
+/*
+ * Translate joystick speed to Axis PTZ speed
+ */
+fixed_t translate_speed_pt(struct ptz_channel *ch, int speed)
+{
+  fixed_t abs_speed = fx_ftox( ((float) CLAMP(speed, 0, 17)) / 17, FIXMATH_FRAC_BITS);
+
+  if (ch->image_rotated) {
+    return -abs_speed;
+  } else {
+    return abs_speed;
+  }
+} 
+
+/*
+ * IMG FLIP command
+ */
+static int cmd_img_flip(struct ptz_command_args *args)
+{
+  unsigned char p = args->data[4] & 0x0F;
+  char rotation_param[64];
+
+  g_snprintf(rotation_param, sizeof(rotation_param),
+             "ImageSource.I%d.Sensor.VideoRotation", args->ch->number - 1);
+
+  if (p == 2) {
+      param_set(rotation_param, "180");
+      set_rotation(args->ch, "180");
+  } else if (p == 3) {
+      param_set(rotation_param, "0");
+      set_rotation(args->ch, "0");
+  } else {
+      LOGR_WARN("Got unknown IMG FLIP value %d", p);
+  }
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Send a VAPIX PTZ request for the camera of the channel, query is
+ * "name=value"
+ */
+static void vapix_ptz(struct ptz_channel *ch, const char *query)
+{
+  char path[100];
+
+  g_snprintf(path, sizeof(path), "/axis-cgi/com/ptz.cgi?camera=%d&%s",
+             ch->number, query);
+
+  http_get(path);
+}
+
+/*
+ * Autofocus on/off
+ */
+static int cmd_focus_mode(struct ptz_command_args *args)
+{
+  if (args->data[4] == 0x02) {
+    LOGR_DEBUG("Got Focus AUTO Command");
+    vapix_ptz(args->ch, "autofocus=on");
+  } else if (args->data[4] == 0x03) {
+    LOGR_DEBUG("Got Focus MANUAL Command");
+    vapix_ptz(args->ch, "autofocus=off");
+  }
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Direct focus, 0pqrs
+ */
+static int cmd_focus_direct(struct ptz_command_args *args)
+{
+  unsigned int Focus = CLAMP(args->field[0], 0x1000, 0xC000);
+
+  long double focus_remapped = 10000 - (10000 *
+    (((float) (Focus - 0x1000)) / (0xC000 - 0x1000)));
+  focus_remapped = CLAMP(focus_remapped, 1, 9999);
+
+  LOGR_DEBUG("Translated focus value %Lf", focus_remapped);
+
+  char query[32];
+  g_snprintf(query, sizeof(query), "focus=%d", (int) focus_remapped);
+
+  vapix_ptz(args->ch, query);
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Iris auto (from Cam_Iris)
+ */
+static int cmd_iris_mode(struct ptz_command_args *args)
+{
+  if (args->data[4] == 0x00) {
+    LOGR_DEBUG("Got iris AUTO command");
+    vapix_ptz(args->ch, "autoiris=on");
+  }
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Iris auto/manual (from Cam_AE)
+ */
+static int cmd_ae_mode(struct ptz_command_args *args)
+{
+  if (args->data[4] == 0x00) {
+    LOGR_DEBUG("Got iris AUTO command");
+    vapix_ptz(args->ch, "autoiris=on");
+  } else if (args->data[4] == 0x03) {
+    vapix_ptz(args->ch, "autoiris=off");
+    LOGR_DEBUG("Got iris MANUAL command");
+  }
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Direct iris, 00 00 0p 0q
+ */
+static int cmd_iris_direct(struct ptz_command_args *args)
+{
+  if (args->data[4] != 0x00 || args->data[5] != 0x00) {
+    return PTZ_CMD_COMPLETE;
+  }
+
+  unsigned int F = args->field[0];
+
+  if (F >= 0x11) {
+    F = 0x11;
+  }
+
+  int iris_value = (int) (((float) 10000) / 0x11 ) * F;
+  iris_value = CLAMP(iris_value, 1, 9999);
+
+  char query[32];
+  g_snprintf(query, sizeof(query), "iris=%d", iris_value);
+
+  LOGR_DEBUG("Translated iris value %d", iris_value);
+  vapix_ptz(args->ch, query);
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Zoom stop, tele/wide standard and variable
+ */
+static int cmd_zoom(struct ptz_command_args *args)
+{
+  unsigned char *command = args->data;
+  int speed_zoom = (int) command[4] & 0x0f;
+
+  if((command[4] & 0xf0) == 0x20)
+  {
+    //syslog(LOG_INFO, "Zoom out var");
+    submit_drive(args->ch, AX_PTZ_MOVEMENT_NO_VALUE,
+                 AX_PTZ_MOVEMENT_NO_VALUE,
+                 translate_speed_zoom(speed_zoom));
+  }
+  if((command[4] & 0xf0) == 0x30)
+  {
+    //syslog(LOG_INFO, "Zoom in var");
+    submit_drive(args->ch, AX_PTZ_MOVEMENT_NO_VALUE,
+                 AX_PTZ_MOVEMENT_NO_VALUE,
+                 -translate_speed_zoom(speed_zoom));
     
-   
-    speed_pan = (int) command[4]; 
-    speed_tilt = (int) command[5];
-    if(command[6] == 0x03 && command[7] == 0x01)
-    {
-      //syslog(LOG_INFO, "UP");
-      if (!(start_continous_movement(AX_PTZ_MOVEMENT_NO_VALUE, //pan unitless_pos_speed
-                               translate_speed_pt(speed_tilt), //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-          syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x03 && command[7] == 0x02)
-    {
-      //syslog(LOG_INFO, "DOWN");
-      if (!(start_continous_movement(AX_PTZ_MOVEMENT_NO_VALUE, //pan unitless_pos_speed
-                               -translate_speed_pt(speed_tilt), //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-          syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x01 && command[7] == 0x03)
-    {
-      //syslog(LOG_INFO, "LEFT");
-      if (!(start_continous_movement(-translate_speed_pt(speed_pan), //pan unitless_pos_speed
-                               AX_PTZ_MOVEMENT_NO_VALUE, //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x02 && command[7] == 0x03)
-    {
-      //syslog(LOG_INFO, "RIGHT");
-      if (!(start_continous_movement(translate_speed_pt(speed_pan), //pan unitless_pos_speed translate_speed_pt(speed_pan)
-                               AX_PTZ_MOVEMENT_NO_VALUE, //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x01 && command[7] == 0x01)
-    {
-      //syslog(LOG_INFO, "UPLEFT");
-      if (!(start_continous_movement(-translate_speed_pt(speed_pan), //pan unitless_pos_speed
-                               translate_speed_pt(speed_tilt), //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x02 && command[7] == 0x01)
-    {
-      //syslog(LOG_INFO, "UPRIGHT");
-      if (!(start_continous_movement(translate_speed_pt(speed_pan), //pan unitless_pos_speed
-                               translate_speed_pt(speed_tilt), //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x01 && command[7] == 0x02)
-    {
-      //syslog(LOG_INFO, "DOWNLEFT");
-      if (!(start_continous_movement(-translate_speed_pt(speed_pan), //pan unitless_pos_speed
-                               -translate_speed_pt(speed_tilt), //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x02 && command[7] == 0x02)
-    {
-      //syslog(LOG_INFO, "DOWNRIGHT");
-      if (!(start_continous_movement(translate_speed_pt(speed_pan), //pan unitless_pos_speed
-                               -translate_speed_pt(speed_tilt), //tilt
-                               AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                               AX_PTZ_MOVEMENT_NO_VALUE, 1000.0f))) //zoom
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
-    }
-    if(command[6] == 0x03 && command[7] == 0x03)
+  }
+  if((command[4]) == 0x02)
+  {
+    //check current zoom setting, adjust if not max, set to max if current + step > max
+    //syslog(LOG_INFO, "Zoom in fix");
+    submit_drive(args->ch, AX_PTZ_MOVEMENT_NO_VALUE,
+                 AX_PTZ_MOVEMENT_NO_VALUE,
+                 fx_ftox(1.0f, FIXMATH_FRAC_BITS));
+  }
+  if((command[4]) == 0x03)
+  {
+    //syslog(LOG_INFO, "Zoom out fix");
+    submit_drive(args->ch, AX_PTZ_MOVEMENT_NO_VALUE,
+                 AX_PTZ_MOVEMENT_NO_VALUE,
+                 -fx_ftox(1.0f, FIXMATH_FRAC_BITS));
+    
+  }
+  if((command[4]) == 0x00) //if((command[4] & 0xf0) == 0x00)
+  {
+    //syslog(LOG_INFO, "Zoom stop");
+    if (!(stop_continous_movement(args->ch, FALSE, TRUE))) 
     {
-      //syslog(LOG_INFO, "STOP");
-      /* Stop the continous pan movement */
-      if (!(stop_continous_movement(TRUE, FALSE))) 
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
+      syslog(LOG_INFO, "Failure, Zoom");
     }
-  /* Absolute Pan / Tilt movement */
-  } else if (command[2] == 0x06 && command[3] == 0x02) {
-    
+  }
 
-    handle_ptdrive(command, TRUE, length_data);
+  return PTZ_CMD_COMPLETE;
+}
 
-  } else if (command[2] == 0x06 && command[3] == 0x03) {
-    
+/*
+ * Direct Zoom, 0pqrs
+ */
+static int cmd_zoom_direct(struct ptz_command_args *args)
+{
+  unsigned int Z = args->field[0];
 
-    handle_ptdrive(command, FALSE, length_data);
-  } else if (command[2] == 0x06 && command[3] == 0x04) {
-    move_to_home_position();
-  } else if (command[2] == 0x06 && command[3]== 0x05) {
+  LOGR_DEBUG("Got Direct Zoom value %d", Z);
 
-    /* TODO: How to handle Reset? */
-    if (!(stop_continous_movement(TRUE, FALSE))) 
-      {
-        syslog(LOG_INFO, "Failure, Pan/Tilt");
-      }
+  fixed_t api_zoom_val_unitless = conv_visca_to_zoom(&args->ch->conv, Z);
+  float zoom_unitless_f = fx_xtof(api_zoom_val_unitless, FIXMATH_FRAC_BITS);
+
+  LOGR_DEBUG("Calculated zoom value %f", zoom_unitless_f);
+
+  if (!move_to_absolute_position(args->ch,
+                                 AX_PTZ_MOVEMENT_NO_VALUE,
+                                 AX_PTZ_MOVEMENT_NO_VALUE,
+                                 AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS,
+                                 1.0f,
+                                 AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
+                                 api_zoom_val_unitless,
+                                 AX_PTZ_MOVEMENT_ZOOM_UNITLESS)) {
+    return PTZ_CMD_COMPLETE;
   }
 
-  //Set, Recall and delete presets
-  if(command[2] == 0x04 && command[3] == 0x3f)
+  return track_movement(args->ch,
+                        AX_PTZ_MOVEMENT_NO_VALUE,
+                        AX_PTZ_MOVEMENT_NO_VALUE,
+                        zoom_unitless_f,
+                        args->callback,
+                        args->user_data);
+}
+
+/*
+ * Set, Recall and delete presets
+ */
+static int cmd_preset(struct ptz_command_args *args)
+{
+  unsigned char *command = args->data;
+
+  //delete preset
+  if(command[4] == 0x00)
   {
-    //delete preset
-    if(command[4] == 0x00)
-    {
-      if (!(ax_ptz_preset_handler_remove_preset_number(ax_ptz_control_queue_group,
-                                               video_channel,
-                                               command[5] + 1,
-                                               NULL))) {
-      }
+    struct actuator_op op = {
+      .type = ACTUATOR_REMOVE_PRESET,
+      .preset = command[5] + 1,
+    };
 
-      syslog(LOG_INFO,"Remove preset %d\n", command[5] + 1);
-    }
-    //set preset
-    if(command[4] == 0x01)
-    {
-      /* Set PTZ preset X to the current camera position */
-      if (!(ax_ptz_preset_handler_set_preset_number(ax_ptz_control_queue_group,
-                                            video_channel, command[5] + 1,
-                                            FALSE, NULL))) {
-      
-      }
+    submit_movement(args->ch, &op);
+
+    syslog(LOG_INFO,"Remove preset %d\n", command[5] + 1);
+  }
+  //set preset
+  if(command[4] == 0x01)
+  {
+    /* Set PTZ preset X to the current camera position */
+    struct actuator_op op = {
+      .type = ACTUATOR_SET_PRESET,
+      .preset = command[5] + 1,
+    };
 
-      syslog(LOG_INFO,"Set preset %d\n", command[5] + 1);
+    submit_movement(args->ch, &op);
+
+    syslog(LOG_INFO,"Set preset %d\n", command[5] + 1);
+  }
+  //recall preset
+  if(command[4] == 0x02)
+  {
+    struct actuator_op op = {
+      .type = ACTUATOR_GOTO_PRESET,
+      .preset = command[5] + 1,
+      .speed = fx_ftox(1.0f, FIXMATH_FRAC_BITS),
+    };
+
+    submit_movement(args->ch, &op);
+    syslog(LOG_INFO,"Goto preset %d\n", command[5] + 1);
+  }
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Pan/Tilt drive, VV WW 0p 0q
+ */
+static int cmd_pt_drive(struct ptz_command_args *args)
+{
+  unsigned char *command = args->data;
+  int speed_pan = (int) command[4]; 
+  int speed_tilt = (int) command[5];
+
+  if(command[6] == 0x03 && command[7] == 0x01)
+  {
+    //syslog(LOG_INFO, "UP");
+    submit_drive(args->ch, AX_PTZ_MOVEMENT_NO_VALUE,
+                 translate_speed_pt(args->ch, speed_tilt),
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x03 && command[7] == 0x02)
+  {
+    //syslog(LOG_INFO, "DOWN");
+    submit_drive(args->ch, AX_PTZ_MOVEMENT_NO_VALUE,
+                 -translate_speed_pt(args->ch, speed_tilt),
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x01 && command[7] == 0x03)
+  {
+    //syslog(LOG_INFO, "LEFT");
+    submit_drive(args->ch, -translate_speed_pt(args->ch, speed_pan),
+                 AX_PTZ_MOVEMENT_NO_VALUE,
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x02 && command[7] == 0x03)
+  {
+    //syslog(LOG_INFO, "RIGHT");
+    submit_drive(args->ch, translate_speed_pt(args->ch, speed_pan),
+                 AX_PTZ_MOVEMENT_NO_VALUE,
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x01 && command[7] == 0x01)
+  {
+    //syslog(LOG_INFO, "UPLEFT");
+    submit_drive(args->ch, -translate_speed_pt(args->ch, speed_pan),
+                 translate_speed_pt(args->ch, speed_tilt),
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x02 && command[7] == 0x01)
+  {
+    //syslog(LOG_INFO, "UPRIGHT");
+    submit_drive(args->ch, translate_speed_pt(args->ch, speed_pan),
+                 translate_speed_pt(args->ch, speed_tilt),
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x01 && command[7] == 0x02)
+  {
+    //syslog(LOG_INFO, "DOWNLEFT");
+    submit_drive(args->ch, -translate_speed_pt(args->ch, speed_pan),
+                 -translate_speed_pt(args->ch, speed_tilt),
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x02 && command[7] == 0x02)
+  {
+    //syslog(LOG_INFO, "DOWNRIGHT");
+    submit_drive(args->ch, translate_speed_pt(args->ch, speed_pan),
+                 -translate_speed_pt(args->ch, speed_tilt),
+                 AX_PTZ_MOVEMENT_NO_VALUE);
+  }
+  if(command[6] == 0x03 && command[7] == 0x03)
+  {
+    //syslog(LOG_INFO, "STOP");
+    /* Stop the continous pan movement */
+    if (!(stop_continous_movement(args->ch, TRUE, FALSE))) 
+    {
+      syslog(LOG_INFO, "Failure, Pan/Tilt");
     }
-    //recall preset
-    if(command[4] == 0x02)
+  }
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Absolute Pan / Tilt movement
+ */
+static int cmd_pt_absolute(struct ptz_command_args *args)
+{
+  return handle_ptdrive(args, TRUE);
+}
+
+/*
+ * Relative Pan / Tilt movement
+ */
+static int cmd_pt_relative(struct ptz_command_args *args)
+{
+  return handle_ptdrive(args, FALSE);
+}
+
+static int cmd_pt_home(struct ptz_command_args *args)
+{
+  move_to_home_position(args->ch);
+
+  return PTZ_CMD_COMPLETE;
+}
+
+static int cmd_pt_reset(struct ptz_command_args *args)
+{
+  /* TODO: How to handle Reset? */
+  if (!(stop_continous_movement(args->ch, TRUE, FALSE))) 
     {
-      if (!(ax_ptz_preset_handler_goto_preset_number(ax_ptz_control_queue_group,
-                                             video_channel,
-                                             command[5] + 1,
-                                             fx_ftox(1.0f,
-                                                     FIXMATH_FRAC_BITS),
-                                             AX_PTZ_PRESET_MOVEMENT_UNITLESS,
-                                             AX_PTZ_INVOKE_ASYNC, NULL,
-                                             NULL, NULL))) {
-      }
-      syslog(LOG_INFO,"Goto preset %d\n", command[5] + 1);
+      syslog(LOG_INFO, "Failure, Pan/Tilt");
     }
+
+  return PTZ_CMD_COMPLETE;
+}
+
+/*
+ * Command tables indexed by command byte, one table per category byte.
+ * Lengths include the address byte and the terminator, e.g. Direct Zoom
+ * 81 01 04 47 0p 0q 0r 0s FF is 9 bytes with one 4 nibble field at 4.
+ */
+static const struct ptz_command_entry camera_commands[256] = {
+  [0x07] = { cmd_zoom,         METRICS_DRIVE,        6 },
+  [0x0B] = { cmd_iris_mode,    METRICS_FOCUS_IRIS,   6 },
+  [0x38] = { cmd_focus_mode,   METRICS_FOCUS_IRIS,   6 },
+  [0x39] = { cmd_ae_mode,      METRICS_FOCUS_IRIS,   6 },
+  [0x3F] = { cmd_preset,       METRICS_PRESET,       7 },
+  [0x47] = { cmd_zoom_direct,  METRICS_ZOOM_DIRECT,  9, { { 4, 4 } } },
+  [0x48] = { cmd_focus_direct, METRICS_FOCUS_IRIS,   9, { { 4, 4 } } },
+  [0x4B] = { cmd_iris_direct,  METRICS_FOCUS_IRIS,   9, { { 6, 2 } } },
+  [0x66] = { cmd_img_flip,     METRICS_OTHER,        6 },
+};
+
+static const struct ptz_command_entry pan_tilt_commands[256] = {
+  [0x01] = { cmd_pt_drive,     METRICS_DRIVE,        9 },
+  [0x02] = { cmd_pt_absolute,  METRICS_ABSOLUTE,    16, { { 6, 5 }, { 11, 4 } } },
+  [0x03] = { cmd_pt_relative,  METRICS_RELATIVE,    16, { { 6, 5 }, { 11, 4 } } },
+  [0x04] = { cmd_pt_home,      METRICS_PRESET,       5 },
+  [0x05] = { cmd_pt_reset,     METRICS_OTHER,        5 },
+};
+
+static const struct ptz_command_entry *command_categories[256] = {
+  [0x04] = camera_commands,
+  [0x06] = pan_tilt_commands,
+};
+
+/*
+ * Combine the low nibbles of count bytes, most significant first
+ */
+static unsigned int decode_nibbles(const unsigned char *data, unsigned int count)
+{
+  unsigned int value = 0;
+
+  while (count--) {
+    value = (value << 4) | (*data++ & 0x0F);
   }
 
-  return 1;
+  return value;
 }
 
-static int handle_ptdrive(unsigned char *command,
-                          gboolean is_absolute,
-                          size_t len) 
+/*
+ * Process received command and move camera accordingly. Returns
+ * PTZ_CMD_PENDING if the callback will be invoked once the movement is done,
+ * otherwise PTZ_CMD_COMPLETE.
+ */
+int process_command(struct ptz_channel *ch,
+                    unsigned char* data, int length_data,
+                    ptz_completion_callback callback,
+                    gpointer user_data)
 {
-  int speed_pan  = CLAMP(command[4], 0, 17);
-  int speed_tilt = CLAMP(command[5], 0, 17);
+  const struct ptz_command_entry *table;
+  const struct ptz_command_entry *entry;
+  struct ptz_command_args args;
+  int ret;
+  int i;
+
+  if (length_data < 4) {
+    return PTZ_CMD_COMPLETE;
+  }
 
-  /* Only one speed is supported so use the maximum specified */
-  float api_speed = ((float) MAX(speed_pan, speed_tilt)) / 17;
+  table = command_categories[data[2]];
+  entry = table ? &table[data[3]] : NULL;
+
+  if (!entry || !entry->handler) {
+    LOGR_WARN("Unhandled VISCA command %02X %02X", data[2], data[3]);
+    return PTZ_CMD_COMPLETE;
+  }
+
+  if (length_data < entry->min_len) {
+    LOGR_WARN("VISCA command %02X %02X too short, %d bytes", data[2], data[3],
+      length_data);
+    return PTZ_CMD_COMPLETE;
+  }
 
 #ifdef VERBOSE
   g_printf("Data Received: ");
-  size_t i = 0;
-  for (; i < len; i++) {
-    g_printf("%d=[0x%02x], ", i, command[i]);
+  for (i = 0; i < length_data; i++) {
+    g_printf("%d=[0x%02x], ", i, data[i]);
   }
   g_printf("\n");
 #endif
 
-  unsigned int y1 = command[6] & 0x0F;
-  unsigned int y2 = command[7] & 0x0F;
-  unsigned int y3 = command[8] & 0x0F;
-  unsigned int y4 = command[9] & 0x0F;
-  unsigned int y5 = command[10] & 0x0F;
-
-  unsigned int z1 = command[11] & 0x0F;
-  unsigned int z2 = command[12] & 0x0F;
-  unsigned int z3 = command[13] & 0x0F;
-  unsigned int z4 = command[14] & 0x0F;
+  args.ch = ch;
+  args.data = data;
+  args.len = length_data;
+  args.callback = callback;
+  args.user_data = user_data;
 
-  unsigned int Pan  = (y1 << 16) | (y2 << 12) | (y3 << 8) | (y4 << 4) | y5;
-  unsigned int Tilt = (z1 << 12) | (z2 << 8) | (z3 << 4) | z4;
+  for (i = 0; i < PTZ_MAX_NIBBLE_FIELDS; i++) {
+    args.field[i] = decode_nibbles(&data[entry->field[i].offset],
+                                   entry->field[i].count);
+  }
 
+  axptz_class = entry->cls;
+  ret = entry->handler(&args);
+  axptz_class = METRICS_OTHER;
 
-  g_printf("ABS PAN COMMAND ------\n");
-  g_printf("Got Pan value 0x%05X=%d\n", Pan, Pan);
-  g_printf("Got Tilt value 0x%04X=%d\n", Tilt, Tilt);
+  return ret;
+}
 
-  float Pan_deg_f;
-  float Tilt_deg_f;
+/*
+ * Class of a command for metrics, without processing it
+ */
+enum metrics_class ptz_command_class(const unsigned char *data, int length_data)
+{
+  const struct ptz_command_entry *table;
 
-  if (Pan & 0xF0000) {
-    Pan_deg_f = -(170.0f - (170.0f / 0x09BDE ) * (Pan - 0xF6422));
-  } else {
-    Pan_deg_f = (170.0f / 0x09BDE) * Pan; 
+  if (length_data < 4) {
+    return METRICS_OTHER;
   }
 
-  if (Tilt & 0xA000) {
-    Tilt_deg_f = -(90.0f - (90.0f / 0x52F8 ) * (Tilt - 0xAD08));
-  } else {
-    Tilt_deg_f = (90.0f / 0x52F8) * Tilt; 
-  }
+  table = command_categories[data[2]];
+
+  return table && table[data[3]].handler ? table[data[3]].cls : METRICS_OTHER;
+}
+
+static int handle_ptdrive(struct ptz_command_args *args,
+                          gboolean is_absolute)
+{
+  int speed_pan  = CLAMP(args->data[4], 0, 17);
+  int speed_tilt = CLAMP(args->data[5], 0, 17);
+
+  /* Only one speed is supported so use the maximum specified */
+  float api_speed = ((float) MAX(speed_pan, speed_tilt)) / 17;
+
+  unsigned int Pan  = args->field[0];
+  unsigned int Tilt = args->field[1];
+
+  LOGR_DEBUG("PT %s move, pan 0x%05X, tilt 0x%04X",
+    is_absolute ? "absolute" : "relative", Pan, Tilt);
 
+  fixed_t api_pan_val_degrees = conv_visca_to_pan(&args->ch->conv, Pan);
+  fixed_t api_tilt_val_degrees = conv_visca_to_tilt(&args->ch->conv, Tilt);
 
-  if (image_rotated) {
-    Tilt_deg_f = -Tilt_deg_f;
+  if (args->ch->image_rotated) {
+    api_tilt_val_degrees = -api_tilt_val_degrees;
   }
 
   /* Clamp within limits if absolute movement */
   if (is_absolute) {
-    float min_pan_value_f = fx_xtof(unit_limits->min_pan_value,
-      FIXMATH_FRAC_BITS);
-    float max_pan_value_f = fx_xtof(unit_limits->max_pan_value,
-      FIXMATH_FRAC_BITS);
+    LOGR_TRACE("Coordinates before clamp pan=%f, tilt=%f",
+      fx_xtof(api_pan_val_degrees, FIXMATH_FRAC_BITS),
+      fx_xtof(api_tilt_val_degrees, FIXMATH_FRAC_BITS));
 
-    float min_tilt_value_f = fx_xtof(unit_limits->min_tilt_value,
-      FIXMATH_FRAC_BITS);
-    float max_tilt_value_f = fx_xtof(unit_limits->max_tilt_value,
-      FIXMATH_FRAC_BITS);
-
-    g_printf("Coordinates before clamp pan=%f, tilt=%f\n", Pan_deg_f, Tilt_deg_f);
-
-    Pan_deg_f = CLAMP(Pan_deg_f, min_pan_value_f, max_pan_value_f);
-    Tilt_deg_f = CLAMP(Tilt_deg_f, min_tilt_value_f, max_tilt_value_f);
+    api_pan_val_degrees = conv_clamp_pan(&args->ch->conv, api_pan_val_degrees);
+    api_tilt_val_degrees = conv_clamp_tilt(&args->ch->conv, api_tilt_val_degrees);
   }
-  
 
-  g_printf("Translated pan degree value %f\n", Pan_deg_f);
-  g_printf("Translated tilt degree value %f\n", Tilt_deg_f);
-  g_printf("/ABS PAN COMMAND ------\n");
+  LOGR_DEBUG("Translated pan %f, tilt %f degrees",
+    fx_xtof(api_pan_val_degrees, FIXMATH_FRAC_BITS),
+    fx_xtof(api_tilt_val_degrees, FIXMATH_FRAC_BITS));
 
-  fixed_t api_pan_val_degrees = fx_ftox(Pan_deg_f, FIXMATH_FRAC_BITS);
-  fixed_t api_tilt_val_degrees = fx_ftox(Tilt_deg_f, FIXMATH_FRAC_BITS);
+  fixed_t target_pan = api_pan_val_degrees;
+  fixed_t target_tilt = api_tilt_val_degrees;
+  gboolean submitted;
 
   if (is_absolute) {
-    move_to_absolute_position(api_pan_val_degrees,
-                              api_tilt_val_degrees,
-                              AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
-                              api_speed,
-                              AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                              AX_PTZ_MOVEMENT_NO_VALUE, 
-                              AX_PTZ_MOVEMENT_ZOOM_UNITLESS);
-
+    submitted = move_to_absolute_position(args->ch,
+                                          api_pan_val_degrees,
+                                          api_tilt_val_degrees,
+                                          AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
+                                          api_speed,
+                                          AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
+                                          AX_PTZ_MOVEMENT_NO_VALUE,
+                                          AX_PTZ_MOVEMENT_ZOOM_UNITLESS);
   } else {
-    move_to_relative_position(api_pan_val_degrees,
-                              api_tilt_val_degrees,
-                              AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
-                              api_speed,
-                              AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
-                              AX_PTZ_MOVEMENT_NO_VALUE, 
-                              AX_PTZ_MOVEMENT_ZOOM_UNITLESS);
-  }
-
-  wait_for_camera_movement_to_finish(Pan_deg_f, 
-                                     Tilt_deg_f, 
-                                     AX_PTZ_MOVEMENT_NO_VALUE);
-  
-  return 0;
+    /* The target of a relative move is where the camera is now plus the
+       delta, within limits. Taken before submitting, which moves the
+       motion model on. Not needed if the move is not tracked. */
+    struct ptz_status pt;
+
+    if (args->callback && ptz_get_status_estimate(args->ch, &pt) == 0) {
+      target_pan = conv_clamp_pan(&args->ch->conv,
+        fx_ftox(pt.pan, FIXMATH_FRAC_BITS) + api_pan_val_degrees);
+      target_tilt = conv_clamp_tilt(&args->ch->conv,
+        fx_ftox(pt.tilt, FIXMATH_FRAC_BITS) + api_tilt_val_degrees);
+    } else if (args->callback) {
+      LOGR_WARN("No PTZ position, relative move is not tracked");
+      args->callback = NULL;
+    }
+
+    submitted = move_to_relative_position(args->ch,
+                                          api_pan_val_degrees,
+                                          api_tilt_val_degrees,
+                                          AX_PTZ_MOVEMENT_PAN_TILT_DEGREE,
+                                          api_speed,
+                                          AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
+                                          AX_PTZ_MOVEMENT_NO_VALUE,
+                                          AX_PTZ_MOVEMENT_ZOOM_UNITLESS);
+  }
+
+  /* Nothing will move, complete right away */
+  if (!submitted) {
+    return PTZ_CMD_COMPLETE;
+  }
+
+  return track_movement(args->ch,
+                        fx_xtof(target_pan, FIXMATH_FRAC_BITS),
+                        fx_xtof(target_tilt, FIXMATH_FRAC_BITS),
+                        AX_PTZ_MOVEMENT_NO_VALUE,
+                        args->callback,
+                        args->user_data);
 }
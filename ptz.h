@@ -4,6 +4,14 @@
 #include <fixmath.h>
 #include <axsdk/axptz.h>
 
+#include "metrics.h"
+#include "conv.h"
+
+/* PTZ channels served, each with its own VISCA ports */
+#define PTZ_MAX_CHANNELS (4)
+
+struct ptz_channel;
+
 struct ptz_status {
 	float pan;
 	float tilt;
@@ -12,15 +20,57 @@ struct ptz_status {
 	float max_zoom;
 };
 
-gboolean stop_continous_movement(gboolean stop_pan_tilt,
+/* Called once a tracked movement has reached its target or timed out */
+typedef void (*ptz_completion_callback) (gboolean target_reached,
+                                         gpointer user_data);
+
+/* Return values of process_command */
+#define PTZ_CMD_PENDING  (0)
+#define PTZ_CMD_COMPLETE (1)
+
+gboolean stop_continous_movement(struct ptz_channel *ch,
+                                 gboolean stop_pan_tilt,
                                  gboolean stop_zoom);
 
-gboolean get_rotation();
+gboolean get_rotation(struct ptz_channel *ch);
+
+int get_ptz_status(struct ptz_channel *ch, struct ptz_status *pt);
+
+int ptz_get_status_snapshot(struct ptz_channel *ch, struct ptz_status *pt);
+
+void ptz_set_status_max_age(guint max_age_ms);
+
+int ptz_get_status_estimate(struct ptz_channel *ch, struct ptz_status *pt);
+
+void ptz_set_extrapolation_window(guint window_ms);
 
-int get_ptz_status(struct ptz_status *pt);
+void ptz_get_status_cache_stats(guint64 *hits, guint64 *misses,
+                                guint64 *estimates);
+
+void ptz_get_drive_stats(guint64 *received, guint64 *actuated);
 
 gboolean ptz_init();
 
-int process_command(unsigned char* data, int length_data);
+void ptz_cleanup();
+
+guint ptz_num_channels();
+
+struct ptz_channel *ptz_get_channel(guint index);
+
+gint ptz_channel_number(const struct ptz_channel *ch);
+
+guint ptz_channel_index(const struct ptz_channel *ch);
+
+const struct conv_tables *ptz_channel_conv(const struct ptz_channel *ch);
+
+int process_command(struct ptz_channel *ch,
+                    unsigned char* data, int length_data,
+                    ptz_completion_callback callback,
+                    gpointer user_data);
+
+enum metrics_class ptz_command_class(const unsigned char *data,
+                                     int length_data);
+
+void ptz_flush_pending_moves(struct ptz_channel *ch);
 
 #endif // INCLUSION_GUARD_PTZ_H
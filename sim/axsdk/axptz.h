@@ -0,0 +1,44 @@
+#ifndef INCLUSION_GUARD_SIM_AXPTZ_H
+#define INCLUSION_GUARD_SIM_AXPTZ_H
+
+#include <glib.h>
+#include <fixmath.h>
+
+/*
+ * Host replacement of the axptz data types. The axptz functions are not
+ * declared, the application reaches the PTZ through hal.h only.
+ */
+
+/* Value of an axis that is not part of a movement */
+#define AX_PTZ_MOVEMENT_NO_VALUE (G_MAXINT32)
+
+typedef enum {
+  AX_PTZ_MOVEMENT_PAN_TILT_UNITLESS,
+  AX_PTZ_MOVEMENT_PAN_TILT_DEGREE
+} AXPTZMovementPanTiltSpace;
+
+typedef enum {
+  AX_PTZ_MOVEMENT_PAN_TILT_SPEED_UNITLESS,
+  AX_PTZ_MOVEMENT_PAN_TILT_SPEED_DEGREE
+} AXPTZMovementPanTiltSpeedSpace;
+
+typedef enum {
+  AX_PTZ_MOVEMENT_ZOOM_UNITLESS
+} AXPTZMovementZoomSpace;
+
+typedef struct {
+  fixed_t pan_value;
+  fixed_t tilt_value;
+  fixed_t zoom_value;
+} AXPTZStatus;
+
+typedef struct {
+  fixed_t min_pan_value;
+  fixed_t max_pan_value;
+  fixed_t min_tilt_value;
+  fixed_t max_tilt_value;
+  fixed_t min_zoom_value;
+  fixed_t max_zoom_value;
+} AXPTZLimits;
+
+#endif // INCLUSION_GUARD_SIM_AXPTZ_H
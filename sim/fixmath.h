@@ -0,0 +1,23 @@
+#ifndef INCLUSION_GUARD_SIM_FIXMATH_H
+#define INCLUSION_GUARD_SIM_FIXMATH_H
+
+#include <stdint.h>
+
+/*
+ * Host replacement of the fixmath library in the Axis SDK, only the parts
+ * used by the application.
+ */
+
+typedef int32_t fixed_t;
+
+static inline fixed_t fx_ftox(float f, int frac_bits)
+{
+  return (fixed_t) (f * (float) (1 << frac_bits));
+}
+
+static inline float fx_xtof(fixed_t x, int frac_bits)
+{
+  return (float) x / (float) (1 << frac_bits);
+}
+
+#endif // INCLUSION_GUARD_SIM_FIXMATH_H
@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include <glib.h>
+
+#include "spsc.h"
+
+/*
+ * Positions run freely and wrap at 2^32, which is a multiple of the size.
+ * The atomic accesses are full barriers, so an element is written before
+ * the tail moves past it and read before the head does.
+ */
+
+void spsc_init(struct spsc_queue *queue, guint size, gsize elem_size)
+{
+  g_assert(size > 0 && (size & (size - 1)) == 0);
+
+  queue->head = 0;
+  queue->tail = 0;
+  queue->size = size;
+  queue->elem_size = elem_size;
+  queue->elems = g_malloc0(size * elem_size);
+}
+
+void spsc_free(struct spsc_queue *queue)
+{
+  g_free(queue->elems);
+  queue->elems = NULL;
+}
+
+gboolean spsc_push(struct spsc_queue *queue, gconstpointer elem)
+{
+  guint tail = queue->tail;
+  guint head = (guint) g_atomic_int_get((gint *) &queue->head);
+
+  if (tail - head == queue->size) {
+    return FALSE;
+  }
+
+  memcpy(&queue->elems[(tail & (queue->size - 1)) * queue->elem_size], elem,
+         queue->elem_size);
+
+  g_atomic_int_set((gint *) &queue->tail, tail + 1);
+
+  return TRUE;
+}
+
+gboolean spsc_pop(struct spsc_queue *queue, gpointer elem)
+{
+  guint head = queue->head;
+  guint tail = (guint) g_atomic_int_get((gint *) &queue->tail);
+
+  if (head == tail) {
+    return FALSE;
+  }
+
+  memcpy(elem, &queue->elems[(head & (queue->size - 1)) * queue->elem_size],
+         queue->elem_size);
+
+  g_atomic_int_set((gint *) &queue->head, head + 1);
+
+  return TRUE;
+}
+
+guint spsc_depth(struct spsc_queue *queue)
+{
+  guint head = (guint) g_atomic_int_get((gint *) &queue->head);
+  guint tail = (guint) g_atomic_int_get((gint *) &queue->tail);
+
+  return tail - head;
+}
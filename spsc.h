@@ -0,0 +1,27 @@
+#ifndef INCLUSION_GUARD_SPSC_H
+#define INCLUSION_GUARD_SPSC_H
+
+#include <glib.h>
+
+/*
+ * Bounded single-producer/single-consumer queue of fixed size elements.
+ * The head is only written by the consumer and the tail only by the
+ * producer, so the two sides need no lock between them.
+ */
+struct spsc_queue {
+  guint head;
+  guint tail;
+  guint size;       /* Power of two */
+  gsize elem_size;
+  guchar *elems;
+};
+
+void spsc_init(struct spsc_queue *queue, guint size, gsize elem_size);
+void spsc_free(struct spsc_queue *queue);
+
+gboolean spsc_push(struct spsc_queue *queue, gconstpointer elem); //FALSE if full
+gboolean spsc_pop(struct spsc_queue *queue, gpointer elem);       //FALSE if empty
+
+guint spsc_depth(struct spsc_queue *queue);
+
+#endif // INCLUSION_GUARD_SPSC_H
@@ -0,0 +1,115 @@
+/*
+ * Exhaustive round trips of every VISCA pan, tilt and zoom word through
+ * the fixed point conversions, for the built in profile and a profile of
+ * calibration.conf. Run from the top directory.
+ */
+
+#include <glib.h>
+
+#include "conv.h"
+#include "calib.h"
+
+/* The number of fractional bits used in fix-point variables */
+#define FIXMATH_FRAC_BITS 16
+
+/* Limits as reported by the camera, pan/tilt degrees and unitless zoom */
+static const AXPTZLimits unit_limits = {
+  .min_pan_value = -(170 << FIXMATH_FRAC_BITS),
+  .max_pan_value = 170 << FIXMATH_FRAC_BITS,
+  .min_tilt_value = -(90 << FIXMATH_FRAC_BITS),
+  .max_tilt_value = 90 << FIXMATH_FRAC_BITS,
+};
+
+static const AXPTZLimits unitless_limits = {
+  .min_zoom_value = 1 << FIXMATH_FRAC_BITS,
+  .max_zoom_value = 9999 << FIXMATH_FRAC_BITS,
+};
+
+/********************************************/
+
+static void check_round_trips(const struct calib_profile *profile)
+{
+  struct conv_tables *t = g_new0(struct conv_tables, 1);
+  gint v;
+
+  conv_init(t, &unit_limits, &unitless_limits, profile);
+
+  for (v = -CONV_PAN_MAX; v <= CONV_PAN_MAX; v++) {
+    unsigned int word = v & 0xFFFFF;
+
+    g_assert_cmphex(conv_pan_to_visca(t, conv_visca_to_pan(t, word)), ==,
+                    word);
+  }
+
+  for (v = -CONV_TILT_MAX; v <= CONV_TILT_MAX; v++) {
+    unsigned int word = v & 0xFFFF;
+
+    g_assert_cmphex(conv_tilt_to_visca(t, conv_visca_to_tilt(t, word)), ==,
+                    word);
+  }
+
+  for (v = 0; v <= CONV_ZOOM_MAX; v++) {
+    g_assert_cmphex(conv_zoom_to_visca(t, conv_visca_to_zoom(t, v)), ==, v);
+  }
+
+  g_free(t);
+}
+
+static void test_builtin()
+{
+  struct calib_profile profile;
+
+  calib_builtin(&profile);
+  check_round_trips(&profile);
+}
+
+static void test_v5925()
+{
+  struct calib_profile profile;
+
+  g_assert_true(calib_load(CALIB_FILE, "V5925", &profile));
+  g_assert_cmpstr(profile.name, ==, "V5925");
+  g_assert_cmpuint(profile.num_zoom_points, >, 2);
+
+  check_round_trips(&profile);
+}
+
+/*
+ * Tilt is 16 bit two's complement, 0x2000-0x3FFF are positive. Only the
+ * sign bit makes a word negative.
+ */
+static void test_tilt_sign()
+{
+  struct conv_tables *t = g_new0(struct conv_tables, 1);
+  struct calib_profile profile;
+  unsigned int word;
+
+  calib_builtin(&profile);
+  conv_init(t, &unit_limits, &unitless_limits, &profile);
+
+  for (word = 0x0001; word <= 0x7FFF; word++) {
+    g_assert_cmpint(conv_visca_to_tilt(t, word), >, 0);
+  }
+
+  for (word = 0x8000; word <= 0xFFFF; word++) {
+    g_assert_cmpint(conv_visca_to_tilt(t, word), <, 0);
+  }
+
+  g_assert_cmpint(conv_visca_to_tilt(t, 0x2000), ==,
+                  -conv_visca_to_tilt(t, 0xE000));
+  g_assert_cmpint(conv_visca_to_tilt(t, 0x3FFF), ==,
+                  -conv_visca_to_tilt(t, 0xC001));
+
+  g_free(t);
+}
+
+int main(int argc, char *argv[])
+{
+  g_test_init(&argc, &argv, NULL);
+
+  g_test_add_func("/conv/round-trip/builtin", test_builtin);
+  g_test_add_func("/conv/round-trip/V5925", test_v5925);
+  g_test_add_func("/conv/tilt-sign", test_tilt_sign);
+
+  return g_test_run();
+}
@@ -0,0 +1,466 @@
+/*
+ * HTTP client against a small server in the test itself. http.c is built
+ * in to see its connection state. The server side uses plain sockets on
+ * 127.0.0.1 from the same thread, the main loop is run while waiting so
+ * the client makes progress.
+ */
+
+#include <poll.h>
+
+#include "http.c"
+
+#define TEST_TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+#define RESPONSE_OK "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nOK"
+
+static int listener = -1;
+
+/********************************************/
+
+static void run_for(gint64 us)
+{
+  gint64 end = g_get_monotonic_time() + us;
+
+  while (g_get_monotonic_time() < end) {
+    while (g_main_context_iteration(NULL, FALSE));
+    g_usleep(1000);
+  }
+}
+
+/*
+ * Wait for the client to connect, FALSE if it did not within timeout
+ */
+static gboolean server_try_accept(gint64 timeout, int *conn)
+{
+  gint64 end = g_get_monotonic_time() + timeout;
+  struct pollfd pfd = { .fd = listener, .events = POLLIN };
+
+  while (g_get_monotonic_time() < end) {
+    while (g_main_context_iteration(NULL, FALSE));
+
+    if (poll(&pfd, 1, 1) == 1) {
+      *conn = accept(listener, NULL, NULL);
+      g_assert_cmpint(*conn, >=, 0);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static int server_accept()
+{
+  int conn = -1;
+
+  g_assert_true(server_try_accept(TEST_TIMEOUT_US, &conn));
+
+  return conn;
+}
+
+/*
+ * Read one request head, returns it without the trailing blank line or
+ * NULL if the client closed the connection
+ */
+static gchar *server_read(int conn)
+{
+  gint64 end = g_get_monotonic_time() + TEST_TIMEOUT_US;
+  GString *request = g_string_new(NULL);
+
+  while (g_get_monotonic_time() < end) {
+    gchar buf[256];
+    gchar *head_end;
+    ssize_t len;
+
+    while (g_main_context_iteration(NULL, FALSE));
+
+    head_end = strstr(request->str, "\r\n\r\n");
+    if (head_end) {
+      g_string_truncate(request, head_end - request->str);
+      return g_string_free(request, FALSE);
+    }
+
+    len = recv(conn, buf, sizeof(buf), MSG_DONTWAIT);
+
+    if (len == 0) {
+      g_string_free(request, TRUE);
+      return NULL;
+    }
+
+    if (len < 0) {
+      g_assert_true(errno == EAGAIN || errno == EWOULDBLOCK);
+      g_usleep(1000);
+      continue;
+    }
+
+    g_string_append_len(request, buf, len);
+  }
+
+  g_assert_not_reached();
+  return NULL;
+}
+
+/*
+ * Read a request and check it is a keep-alive GET of path
+ */
+static void server_expect(int conn, const char *path)
+{
+  gchar *request = server_read(conn);
+  gchar *line = g_strdup_printf("GET %s HTTP/1.1\r\n", path);
+
+  g_assert_nonnull(request);
+  g_assert_true(g_str_has_prefix(request, line));
+  g_assert_nonnull(strstr(request, "\r\nConnection: keep-alive"));
+
+  g_free(line);
+  g_free(request);
+}
+
+static void server_send(int conn, const char *response)
+{
+  gsize len = strlen(response);
+
+  g_assert_cmpint(send(conn, response, len, MSG_NOSIGNAL), ==, len);
+}
+
+/* Requests done by the client, successful or not */
+static guint64 finished()
+{
+  return stats.requests + stats.failures;
+}
+
+static void wait_finished(guint64 count)
+{
+  gint64 end = g_get_monotonic_time() + TEST_TIMEOUT_US;
+
+  while (finished() < count) {
+    g_assert_cmpint(g_get_monotonic_time(), <, end);
+    run_for(1000);
+  }
+}
+
+/********************************************/
+
+static void test_keep_alive()
+{
+  struct http_stats before, after;
+  int conn;
+
+  http_get_stats(&before);
+
+  http_get("/axis-cgi/com/ptz.cgi?camera=1&autofocus=on");
+  conn = server_accept();
+  server_expect(conn, "/axis-cgi/com/ptz.cgi?camera=1&autofocus=on");
+
+  /* Latency covers the time until the response is there */
+  run_for(20 * 1000);
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 1);
+  g_assert_true(http_state == HTTP_CONNECTED);
+
+  /* Second request on the same connection */
+  http_get("/axis-cgi/com/ptz.cgi?camera=1&iris=100");
+  server_expect(conn, "/axis-cgi/com/ptz.cgi?camera=1&iris=100");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 2);
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests + 2);
+  g_assert_cmpuint(after.failures, ==, before.failures);
+  g_assert_cmpuint(after.connects, ==, before.connects + 1);
+  g_assert_cmpint(after.max_latency_us, >=, 20 * 1000);
+  g_assert_cmpint(after.max_latency_us, >=, after.last_latency_us);
+  g_assert_cmpint(after.last_latency_us, >, 0);
+  g_assert_cmpint(after.total_latency_us - before.total_latency_us, >=,
+                  20 * 1000 + after.last_latency_us);
+
+  close(conn);
+  run_for(10 * 1000);
+  g_assert_true(http_state == HTTP_DISCONNECTED);
+}
+
+static void test_connection_close()
+{
+  struct http_stats before, after;
+  gchar buf[16];
+  int conn;
+
+  http_get_stats(&before);
+
+  http_get("/close?a=1");
+  conn = server_accept();
+  server_expect(conn, "/close?a=1");
+  server_send(conn, "HTTP/1.1 200 OK\r\n"
+                    "Connection: close\r\n"
+                    "Content-Length: 2\r\n"
+                    "\r\n"
+                    "OK");
+  wait_finished(before.requests + before.failures + 1);
+
+  /* Client closes its end */
+  g_assert_true(http_state == HTTP_DISCONNECTED);
+  g_assert_cmpint(recv(conn, buf, sizeof(buf), 0), ==, 0);
+  close(conn);
+
+  /* Next request connects again */
+  http_get("/close?a=2");
+  conn = server_accept();
+  server_expect(conn, "/close?a=2");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 2);
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests + 2);
+  g_assert_cmpuint(after.failures, ==, before.failures);
+  g_assert_cmpuint(after.connects, ==, before.connects + 2);
+
+  close(conn);
+  run_for(10 * 1000);
+}
+
+static void test_chunked()
+{
+  struct http_stats before, after;
+  int conn;
+
+  http_get_stats(&before);
+
+  http_get("/chunked?a=1");
+  conn = server_accept();
+  server_expect(conn, "/chunked?a=1");
+
+  /* Split inside a chunk, the response is not complete yet */
+  server_send(conn, "HTTP/1.1 200 OK\r\n"
+                    "Transfer-Encoding: chunked\r\n"
+                    "\r\n"
+                    "4\r\nWi");
+  run_for(20 * 1000);
+  g_assert_cmpuint(finished(), ==, before.requests + before.failures);
+  g_assert_true(http_state == HTTP_RECEIVING);
+
+  server_send(conn, "ki\r\n5\r\npedia\r\n");
+  run_for(20 * 1000);
+  g_assert_cmpuint(finished(), ==, before.requests + before.failures);
+
+  server_send(conn, "0\r\n\r\n");
+  wait_finished(before.requests + before.failures + 1);
+  g_assert_true(http_state == HTTP_CONNECTED);
+
+  /* Connection is kept after the last chunk */
+  http_get("/chunked?a=2");
+  server_expect(conn, "/chunked?a=2");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 2);
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests + 2);
+  g_assert_cmpuint(after.failures, ==, before.failures);
+  g_assert_cmpuint(after.connects, ==, before.connects + 1);
+
+  close(conn);
+  run_for(10 * 1000);
+}
+
+static void test_idle_close()
+{
+  struct http_stats before, after;
+  int conn;
+
+  http_get_stats(&before);
+
+  http_get("/idle?a=1");
+  conn = server_accept();
+  server_expect(conn, "/idle?a=1");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 1);
+  g_assert_true(http_state == HTTP_CONNECTED);
+
+  /* Noticed while idle, the next request does not try the old connection */
+  close(conn);
+  run_for(10 * 1000);
+  g_assert_true(http_state == HTTP_DISCONNECTED);
+  g_assert_cmpint(http_fd, <, 0);
+
+  http_get("/idle?a=2");
+  conn = server_accept();
+  server_expect(conn, "/idle?a=2");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 2);
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests + 2);
+  g_assert_cmpuint(after.failures, ==, before.failures);
+  g_assert_cmpuint(after.connects, ==, before.connects + 2);
+
+  close(conn);
+  run_for(10 * 1000);
+}
+
+static void test_retry()
+{
+  struct http_stats before, after;
+  int conn;
+
+  http_get_stats(&before);
+
+  http_get("/retry?a=1");
+  conn = server_accept();
+  server_expect(conn, "/retry?a=1");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 1);
+
+  /* Closed by the server, but the next request is sent before the client
+     gets to notice. It is resent once on a new connection. */
+  close(conn);
+  http_get("/retry?a=2");
+
+  conn = server_accept();
+  server_expect(conn, "/retry?a=2");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 2);
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests + 2);
+  g_assert_cmpuint(after.failures, ==, before.failures);
+  g_assert_cmpuint(after.connects, ==, before.connects + 2);
+
+  close(conn);
+  run_for(10 * 1000);
+}
+
+static void test_retry_once()
+{
+  struct http_stats before, after;
+  int conn;
+
+  http_get_stats(&before);
+
+  /* Both attempts are closed without response */
+  http_get("/lost?a=1");
+  conn = server_accept();
+  server_expect(conn, "/lost?a=1");
+  close(conn);
+
+  conn = server_accept();
+  server_expect(conn, "/lost?a=1");
+  close(conn);
+
+  wait_finished(before.requests + before.failures + 1);
+  g_assert_false(server_try_accept(100 * 1000, &conn));
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests);
+  g_assert_cmpuint(after.failures, ==, before.failures + 1);
+  g_assert_cmpuint(after.connects, ==, before.connects + 2);
+  g_assert_cmpint(after.last_latency_us, ==, before.last_latency_us);
+  g_assert_cmpint(after.total_latency_us, ==, before.total_latency_us);
+}
+
+static void test_error_status()
+{
+  struct http_stats before, after;
+  int conn;
+
+  http_get_stats(&before);
+
+  /* Counted as failure, the connection is still good */
+  http_get("/error?a=1");
+  conn = server_accept();
+  server_expect(conn, "/error?a=1");
+  server_send(conn, "HTTP/1.1 500 Internal Server Error\r\n"
+                    "Content-Length: 0\r\n"
+                    "\r\n");
+  wait_finished(before.requests + before.failures + 1);
+  g_assert_true(http_state == HTTP_CONNECTED);
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests);
+  g_assert_cmpuint(after.failures, ==, before.failures + 1);
+  g_assert_cmpuint(after.connects, ==, before.connects + 1);
+
+  close(conn);
+  run_for(10 * 1000);
+}
+
+static void test_coalesce()
+{
+  struct http_stats before, after;
+  int conn;
+
+  http_get_stats(&before);
+
+  /* First request in flight, the rest are queued behind it */
+  http_get("/ptz?camera=1&focus=50");
+  conn = server_accept();
+  server_expect(conn, "/ptz?camera=1&focus=50");
+
+  http_get("/ptz?camera=1&focus=100");
+  http_get("/ptz?camera=1&autofocus=off");
+  http_get("/ptz?camera=2&focus=100");
+  run_for(20 * 1000);
+  http_get("/ptz?camera=1&focus=200");
+
+  /* Latest focus of camera 1 is sent last, waiting from when it was set */
+  server_send(conn, RESPONSE_OK);
+  server_expect(conn, "/ptz?camera=1&autofocus=off");
+  server_send(conn, RESPONSE_OK);
+  server_expect(conn, "/ptz?camera=2&focus=100");
+  server_send(conn, RESPONSE_OK);
+  server_expect(conn, "/ptz?camera=1&focus=200");
+  server_send(conn, RESPONSE_OK);
+  wait_finished(before.requests + before.failures + 4);
+
+  http_get_stats(&after);
+  g_assert_cmpuint(after.requests, ==, before.requests + 4);
+  g_assert_cmpuint(after.coalesced, ==, before.coalesced + 1);
+  g_assert_cmpint(after.last_latency_us, <, 20 * 1000);
+
+  close(conn);
+  run_for(10 * 1000);
+}
+
+/********************************************/
+
+static void setup()
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  g_assert_cmpint(listener, >=, 0);
+  g_assert_cmpint(bind(listener, (struct sockaddr *) &addr,
+                       sizeof(addr)), ==, 0);
+  g_assert_cmpint(listen(listener, 4), ==, 0);
+  g_assert_cmpint(getsockname(listener, (struct sockaddr *) &addr,
+                              &addr_len), ==, 0);
+
+  g_assert_cmpint(http_init("127.0.0.1", ntohs(addr.sin_port)), ==, 0);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret;
+
+  g_test_init(&argc, &argv, NULL);
+
+  setup();
+
+  g_test_add_func("/http/keep-alive", test_keep_alive);
+  g_test_add_func("/http/connection-close", test_connection_close);
+  g_test_add_func("/http/chunked", test_chunked);
+  g_test_add_func("/http/idle-close", test_idle_close);
+  g_test_add_func("/http/retry", test_retry);
+  g_test_add_func("/http/retry-once", test_retry_once);
+  g_test_add_func("/http/error-status", test_error_status);
+  g_test_add_func("/http/coalesce", test_coalesce);
+
+  ret = g_test_run();
+
+  http_cleanup();
+  close(listener);
+
+  return ret;
+}
@@ -0,0 +1,300 @@
+/*
+ * VISCA over IP against the simulated camera in hal_sim.c. vip.c is built
+ * in to listen on ports picked by the system, requests are sent from a
+ * UDP socket of the test and the main loop is run until the replies are
+ * there. Run from the top directory, parameters come from param.conf.
+ */
+
+#include "vip.c"
+
+#define TEST_TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+static int client = -1;
+static guint32 next_seq = 1;
+
+/********************************************/
+
+/*
+ * Run the main loop for a while, the camera moves in the meantime
+ */
+static void run_for(gint64 us)
+{
+  gint64 end = g_get_monotonic_time() + us;
+
+  while (g_get_monotonic_time() < end) {
+    while (g_main_context_iteration(NULL, FALSE));
+    g_usleep(1000);
+  }
+}
+
+/*
+ * Wait for the next datagram to the client, returns the raw VISCA length
+ */
+static int recv_reply(guint32 seq, unsigned char *raw)
+{
+  gint64 end = g_get_monotonic_time() + TEST_TIMEOUT_US;
+  unsigned char buf[64];
+
+  while (g_get_monotonic_time() < end) {
+    ssize_t len;
+
+    while (g_main_context_iteration(NULL, FALSE));
+
+    len = recv(client, buf, sizeof(buf), MSG_DONTWAIT);
+
+    if (len < 0) {
+      g_assert_true(errno == EAGAIN || errno == EWOULDBLOCK);
+      g_usleep(1000);
+      continue;
+    }
+
+    g_assert_cmpint(len, >, VIP_HEADER_SIZE);
+    g_assert_cmpint(buf[0], ==, 0x01);
+    g_assert_cmpint(buf[1], ==, 0x11);
+    g_assert_cmpint(buf[3], ==, len - VIP_HEADER_SIZE);
+    g_assert_cmpuint(vip_get_seq(buf), ==, seq);
+
+    memcpy(raw, &buf[VIP_HEADER_SIZE], len - VIP_HEADER_SIZE);
+
+    return len - VIP_HEADER_SIZE;
+  }
+
+  g_assert_not_reached();
+  return -1;
+}
+
+static guint32 send_request(const unsigned char *raw, size_t len)
+{
+  unsigned char buf[64];
+  guint32 seq = next_seq++;
+
+  buf[0] = 0x01;
+  buf[1] = 0x00;
+  buf[2] = 0x00;
+  buf[3] = len;
+  buf[4] = seq >> 24;
+  buf[5] = seq >> 16;
+  buf[6] = seq >> 8;
+  buf[7] = seq;
+  memcpy(&buf[VIP_HEADER_SIZE], raw, len);
+
+  g_assert_cmpint(send(client, buf, VIP_HEADER_SIZE + len, 0), ==,
+                  VIP_HEADER_SIZE + len);
+
+  return seq;
+}
+
+/*
+ * Send a command and wait for its ACK and completion
+ */
+static void command(const unsigned char *raw, size_t len)
+{
+  static const unsigned char ack[] = { 0x90, 0x40, 0xFF };
+  static const unsigned char completion[] = { 0x90, 0x50, 0xFF };
+  guint32 seq = send_request(raw, len);
+  unsigned char reply[32];
+
+  g_assert_cmpint(recv_reply(seq, reply), ==, sizeof(ack));
+  g_assert_cmpmem(reply, sizeof(ack), ack, sizeof(ack));
+
+  g_assert_cmpint(recv_reply(seq, reply), ==, sizeof(completion));
+  g_assert_cmpmem(reply, sizeof(completion), completion, sizeof(completion));
+}
+
+static int inquiry(const unsigned char *raw, size_t len, unsigned char *reply)
+{
+  return recv_reply(send_request(raw, len), reply);
+}
+
+static unsigned int get_nibbles(const unsigned char *data, int count)
+{
+  unsigned int value = 0;
+
+  while (count--) {
+    g_assert_cmpint(*data & 0xF0, ==, 0);
+    value = (value << 4) | *data++;
+  }
+
+  return value;
+}
+
+/* Sign extended pan and tilt words of a PT inquiry */
+static void inquire_pt(gint *pan, gint *tilt)
+{
+  static const unsigned char inq[] = { 0x81, 0x09, 0x06, 0x12, 0xFF };
+  unsigned char reply[32];
+
+  g_assert_cmpint(inquiry(inq, sizeof(inq), reply), ==, 12);
+  g_assert_cmpint(reply[0], ==, 0x90);
+  g_assert_cmpint(reply[1], ==, 0x50);
+  g_assert_cmpint(reply[11], ==, 0xFF);
+
+  *pan = get_nibbles(&reply[2], 5);
+  *tilt = get_nibbles(&reply[7], 4);
+
+  if (*pan & 0x80000) {
+    *pan -= 0x100000;
+  }
+  if (*tilt & 0x8000) {
+    *tilt -= 0x10000;
+  }
+}
+
+/********************************************/
+
+static void test_absolute_move()
+{
+  static const unsigned char move[] = {
+    0x81, 0x01, 0x06, 0x02, 0x18, 0x14,
+    0x00, 0x01, 0x00, 0x00, 0x00,       /* Pan 0x01000 */
+    0x0F, 0x08, 0x00, 0x00,             /* Tilt -0x0800 */
+    0xFF
+  };
+  gint pan, tilt;
+
+  /* Completion is only sent once the target is reached */
+  command(move, sizeof(move));
+
+  inquire_pt(&pan, &tilt);
+  g_assert_cmpint(ABS(pan - 0x1000), <=, 0x10);
+  g_assert_cmpint(ABS(tilt + 0x0800), <=, 0x10);
+}
+
+static void test_relative_move()
+{
+  static const unsigned char move[] = {
+    0x81, 0x01, 0x06, 0x03, 0x18, 0x14,
+    0x00, 0x00, 0x08, 0x00, 0x00,       /* Pan +0x00800 */
+    0x00, 0x04, 0x00, 0x00,             /* Tilt +0x0400 */
+    0xFF
+  };
+  gint start_pan, start_tilt, pan, tilt;
+
+  inquire_pt(&start_pan, &start_tilt);
+
+  /* Completion once the camera is at the delta from where it was, well
+     before the tracking timeout */
+  command(move, sizeof(move));
+
+  inquire_pt(&pan, &tilt);
+  g_assert_cmpint(ABS(pan - start_pan - 0x0800), <=, 0x10);
+  g_assert_cmpint(ABS(tilt - start_tilt - 0x0400), <=, 0x10);
+}
+
+static void test_drive_stop()
+{
+  static const unsigned char right[] = {
+    0x81, 0x01, 0x06, 0x01, 0x11, 0x11, 0x02, 0x03, 0xFF
+  };
+  static const unsigned char stop[] = {
+    0x81, 0x01, 0x06, 0x01, 0x11, 0x11, 0x03, 0x03, 0xFF
+  };
+  gint start, moving, stopped, later, tilt;
+
+  inquire_pt(&start, &tilt);
+
+  command(right, sizeof(right));
+  run_for(300 * 1000);
+  inquire_pt(&moving, &tilt);
+  g_assert_cmpint(moving - start, >, 0x100);
+
+  command(stop, sizeof(stop));
+  run_for(300 * 1000);
+  inquire_pt(&stopped, &tilt);
+  g_assert_cmpint(stopped, >=, moving);
+
+  /* Neither the camera nor the motion model keep moving */
+  run_for(300 * 1000);
+  inquire_pt(&later, &tilt);
+  g_assert_cmpint(ABS(later - stopped), <=, 0x10);
+}
+
+static void test_inquiries()
+{
+  static const unsigned char version_inq[] = { 0x81, 0x09, 0x00, 0x02, 0xFF };
+  static const unsigned char version[] = {
+    0x90, 0x50, 0x00, 0x01, 0x05, 0x01, 0x05, 0x00, 0x02, 0xFF
+  };
+  static const unsigned char af_inq[] = { 0x81, 0x09, 0x04, 0x38, 0xFF };
+  static const unsigned char flip_inq[] = { 0x81, 0x09, 0x04, 0x66, 0xFF };
+  static const unsigned char zoom_inq[] = { 0x81, 0x09, 0x04, 0x47, 0xFF };
+  static const unsigned char zoom[] = {
+    0x81, 0x01, 0x04, 0x47, 0x02, 0x00, 0x00, 0x00, 0xFF
+  };
+  unsigned char reply[32];
+
+  g_assert_cmpint(inquiry(version_inq, sizeof(version_inq), reply), ==,
+                  sizeof(version));
+  g_assert_cmpmem(reply, sizeof(version), version, sizeof(version));
+
+  g_assert_cmpint(inquiry(af_inq, sizeof(af_inq), reply), ==, 4);
+  g_assert_cmpint(reply[1], ==, 0x50);
+  g_assert_true(reply[2] == 0x02 || reply[2] == 0x03);
+
+  /* Image is not rotated in the simulator */
+  g_assert_cmpint(inquiry(flip_inq, sizeof(flip_inq), reply), ==, 4);
+  g_assert_cmpint(reply[1], ==, 0x50);
+  g_assert_cmpint(reply[2], ==, 0x03);
+
+  command(zoom, sizeof(zoom));
+
+  g_assert_cmpint(inquiry(zoom_inq, sizeof(zoom_inq), reply), ==, 7);
+  g_assert_cmpint(reply[1], ==, 0x50);
+  g_assert_cmpint(reply[6], ==, 0xFF);
+  g_assert_cmpint(ABS((gint) get_nibbles(&reply[2], 4) - 0x2000), <=, 0x10);
+}
+
+static void test_unknown_inquiry()
+{
+  static const unsigned char inq[] = { 0x81, 0x09, 0x7E, 0x7E, 0xFF };
+  static const unsigned char version_inq[] = { 0x81, 0x09, 0x00, 0x02, 0xFF };
+  unsigned char reply[32];
+
+  /* Not answered, the next request still is */
+  send_request(inq, sizeof(inq));
+  g_assert_cmpint(inquiry(version_inq, sizeof(version_inq), reply), ==, 10);
+}
+
+/********************************************/
+
+static void setup()
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+
+  param_init("Axvisca");
+  g_assert_true(ptz_init());
+  g_assert_cmpint(vip_init_ports(0, 0), ==, 0);
+
+  g_assert_cmpint(getsockname(udp_listeners[0].s,
+                              (struct sockaddr *) &addr, &addr_len), ==, 0);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  client = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  g_assert_cmpint(client, >=, 0);
+  g_assert_cmpint(connect(client, (struct sockaddr *) &addr,
+                          sizeof(addr)), ==, 0);
+}
+
+int main(int argc, char *argv[])
+{
+  int ret;
+
+  g_test_init(&argc, &argv, NULL);
+
+  setup();
+
+  g_test_add_func("/vip/absolute-move", test_absolute_move);
+  g_test_add_func("/vip/relative-move", test_relative_move);
+  g_test_add_func("/vip/drive-stop", test_drive_stop);
+  g_test_add_func("/vip/inquiries", test_inquiries);
+  g_test_add_func("/vip/unknown-inquiry", test_unknown_inquiry);
+
+  ret = g_test_run();
+
+  close(client);
+  ptz_cleanup();
+  param_cleanup();
+
+  return ret;
+}
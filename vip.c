@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <gio/gio.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
@@ -7,6 +8,8 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include <glib.h>
 #include <glib/gprintf.h>
@@ -15,6 +18,9 @@
 #include "vip.h"
 #include "ptz.h"
 #include "param.h"
+#include "metrics.h"
+#include "logring.h"
+#include "conv.h"
 
 #define VIP_RAW_CMD_START_IDX (8)
 #define VIP_RAW_END_MARKER (0xFF)
@@ -25,6 +31,12 @@
 #define VIP_MIN_INQ_PACKET_SIZE (13)
 #define VIP_RAW_CMD_SIZE_IDX (3)
 
+/* Control message byte of telemetry subscriptions */
+#define VIP_TELEMETRY_MSG (0x10)
+
+/* The number of fractional bits used in fix-point variables */
+#define FIXMATH_FRAC_BITS 16
+
 /* Payload type as determined from raw package */
 #define VIP_RAW_PT_IDX (VIP_RAW_CMD_START_IDX + 1)
 
@@ -33,19 +45,99 @@
 
 #define SBUF_SIZE (512)
 
-static unsigned char rcv[SBUF_SIZE] = {0,};
-static unsigned char raw_cmd[SBUF_SIZE] = {0,};
+/* Each received datagram yields at most an ACK and a reply */
+#define VIP_TX_BATCH_SIZE (VIP_BATCH_SIZE * 2)
+#define VIP_TX_BUF_SIZE (VIP_HEADER_SIZE + 16)
+
+/*
+ * Packets are preallocated descriptors, passed by pointer from receive
+ * through dispatch to the reply queue and returned to the pool once sent.
+ * A request is answered in place, in its own packet, only the ACK of a
+ * command takes a second packet. Packets never outlive a main loop
+ * wakeup, so the pool only runs out if batches grow beyond its size.
+ */
+#define VIP_POOL_SIZE (VIP_BATCH_SIZE + VIP_TX_BATCH_SIZE + 16)
+
+struct vip_packet {
+  struct vip_packet *next;      /* Free list */
+  size_t len;
+  struct sockaddr_in addr;      /* Source, or destination of a reply */
+  socklen_t addr_len;
+  gint64 rx_time;               /* Of the request, for latencies */
+  enum metrics_event event;     /* What a queued reply is measured as */
+  enum metrics_class cls;
+  unsigned char data[SBUF_SIZE];
+};
+
+static struct vip_packet pool[VIP_POOL_SIZE];
+static struct vip_packet *pool_free = NULL;
+static struct vip_pool_stats pool_stats;
+
+/* Datagrams received and replies sent per main loop wakeup */
+static struct vip_packet *rx_packets[VIP_BATCH_SIZE];
+static struct mmsghdr rx_msgs[VIP_BATCH_SIZE];
+static struct iovec rx_iovecs[VIP_BATCH_SIZE];
+
+static struct vip_packet *tx_packets[VIP_TX_BATCH_SIZE];
+static struct mmsghdr tx_msgs[VIP_TX_BATCH_SIZE];
+static struct iovec tx_iovecs[VIP_TX_BATCH_SIZE];
+static unsigned int tx_count = 0;
+
+/* Class of the current datagram */
+static enum metrics_class cur_class = METRICS_OTHER;
+
+static struct vip_batch_stats batch_stats;
 
-static int vip_digest_package(unsigned char *buf, size_t len);
+struct vip_session;
+struct vip_tcp_conn;
+
+struct vip_packet;
+
+static int vip_digest_package(struct vip_session *session,
+                              struct vip_packet *pkt);
 static int vip_is_clear_if(unsigned char *buf, size_t len);
+static void vip_send_completion(gboolean target_reached, gpointer user_data);
+static void vip_handle_datagram(struct vip_session *session,
+                                struct vip_packet *pkt);
+static void vip_queue_packet(struct vip_session *session,
+                             struct vip_packet *pkt,
+                             enum metrics_event event);
+static void vip_queue_reply(struct vip_session *session,
+                            const unsigned char *buf, size_t len,
+                            enum metrics_event event);
+static void vip_flush_replies(int s);
+static void vip_tcp_queue(struct vip_tcp_conn *conn,
+                          const unsigned char *buf, size_t len);
+static void vip_tcp_flush(struct vip_tcp_conn *conn);
+static gboolean vip_tcp_is_open(const struct vip_tcp_conn *conn);
+static void vip_tcp_free(struct vip_tcp_conn *conn);
+static size_t vip_handle_subscribe(struct vip_session *session,
+                                   unsigned char *buf, size_t len);
+static void vip_telemetry_unsubscribe(struct vip_session *session);
 
 /* Inquiry handling functions */
-static int vip_digest_inquiry(unsigned char *buf, size_t len);
-static int vip_inq_version(unsigned char *buf, size_t len);
-static int vip_inq_flip(unsigned char *buf, size_t len);
-static int vip_inq_AF(unsigned char *buf, size_t len);
-static int vip_inq_PT(unsigned char *buf, size_t len);
-static int vip_inq_Zoom(unsigned char *buf, size_t len);
+static int vip_digest_inquiry(struct ptz_channel *ch,
+                              unsigned char *buf, size_t len);
+static int vip_inq_version(struct ptz_channel *ch,
+                           unsigned char *buf, size_t len);
+static int vip_inq_flip(struct ptz_channel *ch,
+                        unsigned char *buf, size_t len);
+static int vip_inq_AF(struct ptz_channel *ch,
+                      unsigned char *buf, size_t len);
+static int vip_inq_PT(struct ptz_channel *ch,
+                      unsigned char *buf, size_t len);
+static int vip_inq_Zoom(struct ptz_channel *ch,
+                        unsigned char *buf, size_t len);
+
+typedef int (*vip_inquiry_handler) (struct ptz_channel *ch,
+                                    unsigned char *buf, size_t len);
+
+struct vip_inquiry_entry {
+  vip_inquiry_handler handler;
+  enum metrics_class cls;
+  size_t min_len;
+  const char *name;
+};
 
 struct vip_endpoint {
   struct sockaddr_in sock_addr;
@@ -53,232 +145,614 @@ struct vip_endpoint {
   int s;
 };
 
-struct vip_endpoint cur_endpoint;
+/* A UDP or TCP socket of one PTZ channel, ports are offset by its index */
+struct vip_listener {
+  int s;
+  struct ptz_channel *channel;
+};
+
+static struct vip_listener udp_listeners[PTZ_MAX_CHANNELS];
+static struct vip_listener tcp_listeners[PTZ_MAX_CHANNELS];
+
+/* Completion to be sent once a tracked movement has finished */
+struct vip_completion {
+  struct vip_session *session;
+  unsigned char header[VIP_HEADER_SIZE];
+  enum metrics_class cls;
+  gint64 rx_time;
+  gboolean in_use;
+};
+
+/* Number of commands a controller can have waiting for completion */
+#define VIP_SESSION_MAX_PENDING (4)
+
+/* Replies to recent commands, used to answer retransmissions */
+#define VIP_REPLY_CACHE_SIZE (4)
+#define VIP_REPLY_CACHE_REQ_SIZE (32)
+#define VIP_REPLY_CACHE_WINDOW_US (1 * G_USEC_PER_SEC)
+
+struct vip_cached_reply {
+  gboolean valid;
+  guint32 seq;
+  gint64 time;
+  size_t req_len;
+  unsigned char req[VIP_REPLY_CACHE_REQ_SIZE];
+  unsigned int num_replies;
+  size_t reply_len[2];
+  unsigned char reply[2][VIP_TX_BUF_SIZE];
+};
+
+/* Sessions without traffic or pending completions are evicted */
+#define VIP_SESSION_IDLE_TIMEOUT_US (60 * G_USEC_PER_SEC)
+#define VIP_SESSION_EVICT_INTERVAL_S (10)
+
+/* Controller address as four log ring arguments, it only keeps static
+   strings so inet_ntoa can not be used there */
+#define VIP_ADDR_OCTETS(sin)                          \
+  (ntohl((sin)->sin_addr.s_addr) >> 24),              \
+  ((ntohl((sin)->sin_addr.s_addr) >> 16) & 0xFF),     \
+  ((ntohl((sin)->sin_addr.s_addr) >> 8) & 0xFF),      \
+  (ntohl((sin)->sin_addr.s_addr) & 0xFF)
+
+/* One session per controller and channel, keyed by source address, port
+   and channel index */
+struct vip_session {
+  guint64 key;
+  struct vip_endpoint endpoint;
+  struct ptz_channel *channel;
+  struct vip_tcp_conn *conn;    /* Raw VISCA over TCP, NULL for UDP */
+  gboolean subscribed;          /* Gets position telemetry */
+  guint32 last_seq;
+  gboolean have_seq;
+  gint64 last_activity;
+  guint pending;
+  struct vip_completion completions[VIP_SESSION_MAX_PENDING];
+  struct vip_cached_reply replies[VIP_REPLY_CACHE_SIZE];
+  unsigned int next_reply;
+  struct vip_cached_reply *cur_reply;
+};
+
+static GHashTable *sessions = NULL;
+
+static guint64 num_duplicates = 0;
+static guint64 num_resets = 0;
 
 /********************************************/
 
-static int vip_inq_version(unsigned char *buf, size_t len)
+static struct vip_packet *vip_packet_get()
 {
-  g_assert(buf);
+  struct vip_packet *pkt = pool_free;
 
-  /* Fill out raw return buffer */
-  buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
-  buf[VIP_RAW_CMD_START_IDX + 1] = 0x50;
-  buf[VIP_RAW_CMD_START_IDX + 2] = 0x00;
+  if (!pkt) {
+    pool_stats.exhausted++;
+    return NULL;
+  }
+
+  pool_free = pkt->next;
+  pkt->next = NULL;
 
-  buf[VIP_RAW_CMD_START_IDX + 3] = 0x01;
-  buf[VIP_RAW_CMD_START_IDX + 4] = 0x05;
-  buf[VIP_RAW_CMD_START_IDX + 5] = 0x01;
+  pool_stats.in_use++;
+  pool_stats.max_in_use = MAX(pool_stats.max_in_use, pool_stats.in_use);
 
-  buf[VIP_RAW_CMD_START_IDX + 6] = 0x05;
-  buf[VIP_RAW_CMD_START_IDX + 7] = 0x00;
-  buf[VIP_RAW_CMD_START_IDX + 8] = 0x02;
+  return pkt;
+}
 
-  buf[VIP_RAW_CMD_START_IDX + 9] = 0xFF;
+static void vip_packet_put(struct vip_packet *pkt)
+{
+  pkt->next = pool_free;
+  pool_free = pkt;
 
-  return 10;
+  pool_stats.in_use--;
 }
 
-static int vip_inq_flip(unsigned char *buf, size_t len)
+static void vip_pool_init()
 {
-  g_assert(buf);
+  int i;
 
-  /* Fill out raw return buffer */
+  pool_free = NULL;
+
+  for (i = 0; i < VIP_POOL_SIZE; i++) {
+    vip_packet_put(&pool[i]);
+  }
+
+  memset(&pool_stats, 0, sizeof(pool_stats));
+  pool_stats.size = VIP_POOL_SIZE;
+}
+
+/********************************************/
+
+static struct vip_session *vip_session_lookup(struct vip_listener *listener,
+                                              const struct sockaddr_in *addr,
+                                              socklen_t addr_len)
+{
+  guint64 index = ptz_channel_index(listener->channel);
+  guint64 key = (index << 48) |
+    ((guint64) ntohl(addr->sin_addr.s_addr) << 16) | ntohs(addr->sin_port);
+  struct vip_session *session = g_hash_table_lookup(sessions, &key);
+
+  if (!session) {
+    session = g_new0(struct vip_session, 1);
+    session->key = key;
+    session->channel = listener->channel;
+    session->endpoint.s = listener->s;
+    session->endpoint.sock_addr = *addr;
+    session->endpoint.addr_slen = addr_len;
+
+    int i;
+    for (i = 0; i < VIP_SESSION_MAX_PENDING; i++) {
+      session->completions[i].session = session;
+    }
+
+    g_hash_table_insert(sessions, &session->key, session);
+
+    LOGR_INFO("New controller %u.%u.%u.%u:%d on channel %d",
+      VIP_ADDR_OCTETS(addr), ntohs(addr->sin_port),
+      ptz_channel_number(listener->channel));
+  }
+
+  session->last_activity = g_get_monotonic_time();
+
+  return session;
+}
+
+static struct vip_completion *vip_session_reserve_completion(
+  struct vip_session *session)
+{
+  int i;
+
+  for (i = 0; i < VIP_SESSION_MAX_PENDING; i++) {
+    if (!session->completions[i].in_use) {
+      session->completions[i].in_use = TRUE;
+      session->pending++;
+      return &session->completions[i];
+    }
+  }
+
+  return NULL;
+}
+
+static void vip_session_release_completion(struct vip_completion *completion)
+{
+  struct vip_session *session = completion->session;
+
+  completion->in_use = FALSE;
+  session->pending--;
+
+  /* Closed connections are kept until their last completion */
+  if (session->conn && session->pending == 0 &&
+      !vip_tcp_is_open(session->conn)) {
+    vip_tcp_free(session->conn);
+  }
+}
+
+static guint32 vip_get_seq(const unsigned char *buf)
+{
+  return ((guint32) buf[4] << 24) | ((guint32) buf[5] << 16) |
+    ((guint32) buf[6] << 8) | buf[7];
+}
+
+/*
+ * Find the cached replies of a retransmitted command, i.e. same sequence
+ * number and same content as a recently received command. Without buf
+ * only the sequence number is matched.
+ */
+static struct vip_cached_reply *vip_session_find_reply(
+  struct vip_session *session, guint32 seq,
+  const unsigned char *buf, size_t len)
+{
+  gint64 now = g_get_monotonic_time();
+  int i;
+
+  for (i = 0; i < VIP_REPLY_CACHE_SIZE; i++) {
+    struct vip_cached_reply *cached = &session->replies[i];
+
+    if (!cached->valid || cached->seq != seq ||
+        now - cached->time >= VIP_REPLY_CACHE_WINDOW_US) {
+      continue;
+    }
+
+    if (!buf ||
+        (cached->req_len == len && memcmp(cached->req, buf, len) == 0)) {
+      return cached;
+    }
+  }
+
+  return NULL;
+}
+
+static struct vip_cached_reply *vip_session_new_reply(
+  struct vip_session *session, guint32 seq,
+  const unsigned char *buf, size_t len)
+{
+  if (len > VIP_REPLY_CACHE_REQ_SIZE) {
+    return NULL;
+  }
+
+  struct vip_cached_reply *cached = &session->replies[session->next_reply];
+  session->next_reply = (session->next_reply + 1) % VIP_REPLY_CACHE_SIZE;
+
+  cached->valid = TRUE;
+  cached->seq = seq;
+  cached->time = g_get_monotonic_time();
+  cached->req_len = len;
+  memcpy(cached->req, buf, len);
+  cached->num_replies = 0;
+
+  return cached;
+}
+
+static void vip_cache_reply(struct vip_cached_reply *cached,
+                            const unsigned char *buf, size_t len)
+{
+  if (!cached || cached->num_replies >= 2 || len > VIP_TX_BUF_SIZE) {
+    return;
+  }
+
+  memcpy(cached->reply[cached->num_replies], buf, len);
+  cached->reply_len[cached->num_replies] = len;
+  cached->num_replies++;
+}
+
+/*
+ * Sequence number reset from the controller, old replies are invalid
+ */
+static void vip_session_reset(struct vip_session *session)
+{
+  int i;
+
+  for (i = 0; i < VIP_REPLY_CACHE_SIZE; i++) {
+    session->replies[i].valid = FALSE;
+  }
+
+  session->have_seq = FALSE;
+  session->last_seq = 0;
+  num_resets++;
+}
+
+static gboolean vip_session_is_idle(gpointer key,
+                                    gpointer value,
+                                    gpointer user_data)
+{
+  struct vip_session *session = value;
+  gint64 now = *((gint64 *) user_data);
+
+  if (session->pending > 0 ||
+      now - session->last_activity <= VIP_SESSION_IDLE_TIMEOUT_US) {
+    return FALSE;
+  }
+
+  /* Subscriptions not renewed expire with the session */
+  vip_telemetry_unsubscribe(session);
+
+  return TRUE;
+}
+
+static gboolean vip_evict_sessions(gpointer data)
+{
+  gint64 now = g_get_monotonic_time();
+  guint evicted = g_hash_table_foreach_remove(sessions,
+                                              vip_session_is_idle,
+                                              &now);
+
+  if (evicted > 0) {
+    LOGR_INFO("Evicted %u idle controllers, %u sessions", evicted,
+      g_hash_table_size(sessions));
+  }
+
+  return TRUE;
+}
+
+static void vip_send_completion(gboolean target_reached, gpointer user_data)
+{
+  struct vip_completion *completion = user_data;
+  struct vip_session *session;
+  unsigned char buf[VIP_HEADER_SIZE + 3];
+
+  g_assert(completion);
+
+  session = completion->session;
+
+  memcpy(buf, completion->header, VIP_HEADER_SIZE);
+
+  buf[0] = 0x01;
+  buf[1] = 0x11;
+  buf[2] = 0x00;
+  buf[3] = 3;
+
+  /* Fill out response buffer for command completion */
   buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
   buf[VIP_RAW_CMD_START_IDX + 1] = 0x50;
+  buf[VIP_RAW_CMD_START_IDX + 2] = 0xFF;
 
-  gboolean rotated = get_rotation();
+  if (!target_reached) {
+    LOGR_DEBUG("Movement did not reach target, sending completion anyway");
+  }
 
-  if (rotated) {
-    g_printf("Image is rotated, flip mode in use\n");
-    buf[VIP_RAW_CMD_START_IDX + 2] = 0x02;
+  if (session->conn) {
+    /* Raw VISCA has no header, nothing to resend to on a closed connection */
+    if (vip_tcp_is_open(session->conn)) {
+      vip_tcp_queue(session->conn, &buf[VIP_RAW_CMD_START_IDX],
+                    sizeof(buf) - VIP_HEADER_SIZE);
+      vip_tcp_flush(session->conn);
+      metrics_record_since(completion->cls, METRICS_EVENT_COMPLETION,
+                           completion->rx_time);
+    }
+  } else if (sendto(session->endpoint.s,
+                    buf,
+                    sizeof(buf),
+                    0,
+                    (const struct sockaddr *) &session->endpoint.sock_addr,
+                    session->endpoint.addr_slen) == -1) {
+    LOGR_WARN("Failed to send completion");
   } else {
-    g_printf("Image is not rotated, flip not mode in use\n");
-    buf[VIP_RAW_CMD_START_IDX + 2] = 0x03;
- }
+    metrics_record_since(completion->cls, METRICS_EVENT_COMPLETION,
+                         completion->rx_time);
+  }
+
+  /* Let a retransmission of the command get the completion too */
+  if (!session->conn) {
+    vip_cache_reply(vip_session_find_reply(session, vip_get_seq(buf),
+                                           NULL, 0), buf, sizeof(buf));
+  }
+
+  vip_session_release_completion(completion);
+}
+
+/********************************************/
+
+/*
+ * Replies of inquiries that only depend on rarely changing state are kept
+ * as ready frames, header included, and only rebuilt when the state
+ * changes. Answering copies the frame around the echoed sequence number.
+ */
+struct vip_reply_template {
+  gboolean valid;
+  int state;
+  size_t len;           /* Raw VISCA length */
+  unsigned char frame[VIP_TX_BUF_SIZE];
+};
 
-  buf[VIP_RAW_CMD_START_IDX + 3] = 0xFF;
+static struct vip_reply_template version_reply;
+static struct vip_reply_template af_replies[PTZ_MAX_CHANNELS];
+static struct vip_reply_template flip_replies[PTZ_MAX_CHANNELS];
 
-  return 4;
+static void vip_template_set(struct vip_reply_template *t, int state,
+                             const unsigned char *raw, size_t len)
+{
+  g_assert(len <= VIP_TX_BUF_SIZE - VIP_HEADER_SIZE);
+
+  t->frame[0] = 0x01;
+  t->frame[1] = 0x11;
+  t->frame[2] = 0x00;
+  t->frame[3] = len;
+  memset(&t->frame[4], 0, 4);
+  memcpy(&t->frame[VIP_HEADER_SIZE], raw, len);
+
+  t->len = len;
+  t->state = state;
+  t->valid = TRUE;
 }
 
-static int vip_inq_AF(unsigned char *buf, size_t len)
+static int vip_template_reply(const struct vip_reply_template *t,
+                              unsigned char *buf)
 {
-  g_assert(buf);
+  memcpy(buf, t->frame, 4);
+  memcpy(&buf[VIP_HEADER_SIZE], &t->frame[VIP_HEADER_SIZE], t->len);
+
+  return t->len;
+}
+
+static void vip_build_version_reply()
+{
+  static const unsigned char raw[] = {
+    VIP_RAW_TX_DEV_ADDR, 0x50, 0x00, 0x01, 0x05, 0x01, 0x05, 0x00, 0x02, 0xFF
+  };
+
+  vip_template_set(&version_reply, 0, raw, sizeof(raw));
+}
 
-  char param[100];
-  param_get("PTZ.Various.V1.AutoFocus", param, sizeof(param));
+static void vip_build_flip_reply(struct vip_reply_template *t,
+                                 gboolean rotated)
+{
+  unsigned char raw[] = { VIP_RAW_TX_DEV_ADDR, 0x50, 0x03, 0xFF };
 
-  unsigned int focus_mode = 0x02;
-  if (strncmp(param, "true", sizeof(param)) == 0) {
-    focus_mode = 0x02;
-  } else if (strncmp(param, "false", sizeof(param)) == 0) {
-    focus_mode = 0x03;
+  if (rotated) {
+    LOGR_DEBUG("Image is rotated, flip mode in use");
+    raw[2] = 0x02;
   } else {
-    g_printf("Unknown focus mode! %s\n", param);
+    LOGR_DEBUG("Image is not rotated, flip not mode in use");
   }
 
-  /* Fill out raw return buffer */
-  buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
-  buf[VIP_RAW_CMD_START_IDX + 1] = 0x50;
-  buf[VIP_RAW_CMD_START_IDX + 2] = focus_mode;
-  buf[VIP_RAW_CMD_START_IDX + 3] = 0xFF;
+  vip_template_set(t, rotated, raw, sizeof(raw));
+}
+
+static void vip_build_af_reply(struct vip_reply_template *t,
+                               const gchar *value)
+{
+  unsigned char raw[] = { VIP_RAW_TX_DEV_ADDR, 0x50, 0x02, 0xFF };
+
+  if (strcmp(value, "true") == 0) {
+    raw[2] = 0x02;
+  } else if (strcmp(value, "false") == 0) {
+    raw[2] = 0x03;
+  } else {
+    LOGR_WARN("Unknown focus mode, AF inquiries answered with auto");
+  }
+
+  vip_template_set(t, raw[2], raw, sizeof(raw));
+}
 
-  return 4;
+/* Parameter callbacks carry no user data, one per channel index */
+static void autofocus_param_callback_0(const gchar *value)
+{
+  vip_build_af_reply(&af_replies[0], value);
+}
+
+static void autofocus_param_callback_1(const gchar *value)
+{
+  vip_build_af_reply(&af_replies[1], value);
+}
+
+static void autofocus_param_callback_2(const gchar *value)
+{
+  vip_build_af_reply(&af_replies[2], value);
+}
+
+static void autofocus_param_callback_3(const gchar *value)
+{
+  vip_build_af_reply(&af_replies[3], value);
 }
 
-static int vip_inq_PT(unsigned char *buf, size_t len)
+static const param_callback autofocus_param_callbacks[PTZ_MAX_CHANNELS] = {
+  autofocus_param_callback_0,
+  autofocus_param_callback_1,
+  autofocus_param_callback_2,
+  autofocus_param_callback_3,
+};
+
+static int vip_inq_version(struct ptz_channel *ch,
+                           unsigned char *buf, size_t len)
 {
   g_assert(buf);
 
-  struct ptz_status pt;
+  return vip_template_reply(&version_reply, buf);
+}
 
-  get_ptz_status(&pt);
+static int vip_inq_flip(struct ptz_channel *ch,
+                        unsigned char *buf, size_t len)
+{
+  struct vip_reply_template *t = &flip_replies[ptz_channel_index(ch)];
+  gboolean rotated = get_rotation(ch);
 
-  gboolean rotated = get_rotation();
+  g_assert(buf);
 
-  unsigned int translated_pan_value;
-  if (pt.pan >= 0) {
-    translated_pan_value = 0x09BDE * (pt.pan / 170.0f);
-    translated_pan_value = CLAMP(translated_pan_value, 0x0000, 0x09BDE);
-  } else {
-    translated_pan_value = 0xF6422 + ((170.0f + pt.pan) / 170.0f) * 0x09BDE;
-    translated_pan_value = CLAMP(translated_pan_value, 0xF6422, 0xFFFFF);
+  /* Rotation is a flag of the channel, cheaper to compare than notify */
+  if (!t->valid || t->state != rotated) {
+    vip_build_flip_reply(t, rotated);
   }
 
-  unsigned int translated_tilt_value;
+  return vip_template_reply(t, buf);
+}
+
+static int vip_inq_AF(struct ptz_channel *ch,
+                      unsigned char *buf, size_t len)
+{
+  g_assert(buf);
+
+  return vip_template_reply(&af_replies[ptz_channel_index(ch)], buf);
+}
+
+static int vip_inq_PT(struct ptz_channel *ch,
+                      unsigned char *buf, size_t len)
+{
+  g_assert(buf);
+
+  struct ptz_status pt;
 
-  g_printf("PTZ STATUS ------ Tilt %f\n", pt.tilt);
+  if (ptz_get_status_estimate(ch, &pt) < 0) {
+    return -1;
+  }
+
+  gboolean rotated = get_rotation(ch);
 
   if (rotated) {
     pt.tilt = -pt.tilt;
   }
-  
-  if (pt.tilt >= 0) {
-    translated_tilt_value = 0x52F8 * (pt.tilt / 90.0f);
-    translated_tilt_value = CLAMP(translated_tilt_value, 0x0000, 0x52F8);
-  } else {
-    translated_tilt_value = 0xAD08 + ((90.0f + pt.tilt) / 90.0f) * 0x52F8;
-    translated_tilt_value = CLAMP(translated_tilt_value, 0xAD08, 0xFFFF);
-  }
-
-//#ifdef VERBOSE
-  g_printf("PT INQ!!!!!! --- Translated values: pan %f=0x%04X, tilt %f=0x%04x\n",
-    pt.pan, translated_pan_value, pt.tilt, translated_tilt_value);
-//#endif
 
-  unsigned int w1 = (translated_pan_value & 0xF0000) >> 16;
-  unsigned int w2 = (translated_pan_value & 0x0F000) >> 12;
-  unsigned int w3 = (translated_pan_value & 0x00F00) >> 8;
-  unsigned int w4 = (translated_pan_value & 0x000F0) >> 4;
-  unsigned int w5 = (translated_pan_value & 0x0000F);
+  unsigned int translated_pan_value =
+    conv_pan_to_visca(ptz_channel_conv(ch), fx_ftox(pt.pan, FIXMATH_FRAC_BITS));
+  unsigned int translated_tilt_value =
+    conv_tilt_to_visca(ptz_channel_conv(ch), fx_ftox(pt.tilt, FIXMATH_FRAC_BITS));
 
-  unsigned int z1 = (translated_tilt_value & 0xF000) >> 12;
-  unsigned int z2 = (translated_tilt_value & 0x0F00) >> 8;
-  unsigned int z3 = (translated_tilt_value & 0x00F0) >> 4;
-  unsigned int z4 = (translated_tilt_value & 0x000F);
+  LOGR_DEBUG("PT inquiry, pan %f=0x%05X, tilt %f=0x%04X",
+    pt.pan, translated_pan_value, pt.tilt, translated_tilt_value);
 
   /* Fill out raw return buffer */
   buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
   buf[VIP_RAW_CMD_START_IDX + 1] = 0x50;
 
-  buf[VIP_RAW_CMD_START_IDX + 2] = w1;
-  buf[VIP_RAW_CMD_START_IDX + 3] = w2;
-  buf[VIP_RAW_CMD_START_IDX + 4] = w3;
-  buf[VIP_RAW_CMD_START_IDX + 5] = w4;
-  buf[VIP_RAW_CMD_START_IDX + 6] = w5;
-
-  buf[VIP_RAW_CMD_START_IDX + 7] = z1;
-  buf[VIP_RAW_CMD_START_IDX + 8] = z2;
-  buf[VIP_RAW_CMD_START_IDX + 9] = z3;
-  buf[VIP_RAW_CMD_START_IDX + 10] = z4; 
+  conv_put_nibbles(&buf[VIP_RAW_CMD_START_IDX + 2], translated_pan_value, 5);
+  conv_put_nibbles(&buf[VIP_RAW_CMD_START_IDX + 7], translated_tilt_value, 4);
 
   buf[VIP_RAW_CMD_START_IDX + 11] = 0xFF;  
 
   return 12;
 }
 
-static int vip_inq_Zoom(unsigned char *buf, size_t len)
+static int vip_inq_Zoom(struct ptz_channel *ch,
+                        unsigned char *buf, size_t len)
 {
   g_assert(buf);
 
   struct ptz_status pt;
 
-  get_ptz_status(&pt);
-
-  /* TODO: Disregarding actual zoom factor (30x for V59) and just doing the
-   18x scale from Visca document. */
-  unsigned int translated_zoom_value = 0x4000 *
-    ((pt.zoom - pt.min_zoom) / (pt.max_zoom - pt.min_zoom));
-
-  translated_zoom_value = CLAMP(translated_zoom_value, 0, 0x4000);
+  if (ptz_get_status_estimate(ch, &pt) < 0) {
+    return -1;
+  }
 
-  unsigned int p = (translated_zoom_value & 0xF000) >> 12;
-  unsigned int q = (translated_zoom_value & 0x0F00) >> 8;
-  unsigned int r = (translated_zoom_value & 0x00F0) >> 4;
-  unsigned int s = (translated_zoom_value & 0x000F);
+  /* Mapped along the zoom curve of the calibration profile */
+  unsigned int translated_zoom_value =
+    conv_zoom_to_visca(ptz_channel_conv(ch), fx_ftox(pt.zoom, FIXMATH_FRAC_BITS));
 
-#ifdef VERBOSE
-  g_printf("Translated values: zoom %f=0x%04X\n",
-    pt.zoom, translated_zoom_value);
-#endif
+  LOGR_DEBUG("Zoom inquiry, zoom %f=0x%04X", pt.zoom, translated_zoom_value);
 
   /* Fill out raw return buffer */
   buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
   buf[VIP_RAW_CMD_START_IDX + 1] = 0x50;
 
-  buf[VIP_RAW_CMD_START_IDX + 2] = p;
-  buf[VIP_RAW_CMD_START_IDX + 3] = q;
-  buf[VIP_RAW_CMD_START_IDX + 4] = r;
-  buf[VIP_RAW_CMD_START_IDX + 5] = s;
+  conv_put_nibbles(&buf[VIP_RAW_CMD_START_IDX + 2], translated_zoom_value, 4);
 
   buf[VIP_RAW_CMD_START_IDX + 6] = 0xFF;  
 
   return 7;
 }
 
-static int vip_digest_inquiry(unsigned char *buf, size_t len)
-{
-  g_assert(len >= VIP_MIN_INQ_PACKET_SIZE);
-
-  if (buf[VIP_INC_CMD_START_IDX] == 0x00 && 
-      buf[VIP_INC_CMD_START_IDX + 1] == 0x02) {
+/*
+ * Inquiry tables indexed by command byte, one table per category byte
+ */
+static const struct vip_inquiry_entry interface_inquiries[256] = {
+  [0x02] = { vip_inq_version, METRICS_INQ_VERSION, VIP_MIN_INQ_PACKET_SIZE, "version" },
+};
 
-    g_printf("Got version inq request\n");
-    return vip_inq_version(buf, len);
+static const struct vip_inquiry_entry camera_inquiries[256] = {
+  [0x38] = { vip_inq_AF,      METRICS_INQ_AF,      VIP_MIN_INQ_PACKET_SIZE, "AF mode" },
+  [0x47] = { vip_inq_Zoom,    METRICS_INQ_ZOOM,    VIP_MIN_INQ_PACKET_SIZE, "zoom position" },
+  [0x66] = { vip_inq_flip,    METRICS_INQ_FLIP,    VIP_MIN_INQ_PACKET_SIZE, "flip mode" },
+};
 
-  } else if (buf[VIP_INC_CMD_START_IDX] == 0x04 && 
-             buf[VIP_INC_CMD_START_IDX + 1] == 0x66 ) {
+static const struct vip_inquiry_entry pan_tilt_inquiries[256] = {
+  [0x12] = { vip_inq_PT,      METRICS_INQ_PT,      VIP_MIN_INQ_PACKET_SIZE, "PT position" },
+};
 
-    g_printf("Got Flip mode inq request\n");
-    return vip_inq_flip(buf, len);
+static const struct vip_inquiry_entry *inquiry_categories[256] = {
+  [0x00] = interface_inquiries,
+  [0x04] = camera_inquiries,
+  [0x06] = pan_tilt_inquiries,
+};
 
-  } else if (buf[VIP_INC_CMD_START_IDX] == 0x04 && 
-             buf[VIP_INC_CMD_START_IDX + 1] == 0x38 ) {
+static int vip_digest_inquiry(struct ptz_channel *ch,
+                              unsigned char *buf, size_t len)
+{
+  const struct vip_inquiry_entry *table;
+  const struct vip_inquiry_entry *entry;
 
-    g_printf("Got AF Mode inq request\n");
-    return vip_inq_AF(buf, len);
+  if (len < VIP_INC_CMD_START_IDX + 2) {
+    return -1;
+  }
 
-  } else if (buf[VIP_INC_CMD_START_IDX] == 0x06 && 
-             buf[VIP_INC_CMD_START_IDX + 1] == 0x12 ) {
+  table = inquiry_categories[buf[VIP_INC_CMD_START_IDX]];
+  entry = table ? &table[buf[VIP_INC_CMD_START_IDX + 1]] : NULL;
 
-#ifdef VERBOSE
-    g_printf("Got PT Position inquiry\n");
-#endif
-    return vip_inq_PT(buf, len);
+  if (!entry || !entry->handler || len < entry->min_len) {
+    LOGR_WARN("Unhandled VISCA inquiry");
+    return -1;
+  }
 
-  } else if (buf[VIP_INC_CMD_START_IDX] == 0x04 && 
-             buf[VIP_INC_CMD_START_IDX + 1] == 0x47 ) {
+  cur_class = entry->cls;
 
-#ifdef VERBOSE
-    g_printf("Got Zoom Position inquiry\n");
-#endif
-    return vip_inq_Zoom(buf, len);
+  LOGR_TRACE("Got %s inquiry", entry->name);
 
-  } else {
-    g_printf("Unhandled VISCA inquiry");
-    return -1;
-  }
+  return entry->handler(ch, buf, len);
 }
 
 static int vip_is_clear_if(unsigned char *buf, size_t len)
@@ -299,11 +773,13 @@ static int vip_is_clear_if(unsigned char *buf, size_t len)
   return 3;
 }
 
-static int vip_digest_package(unsigned char *buf,
-                              size_t len)
+static int vip_digest_package(struct vip_session *session,
+                              struct vip_packet *pkt)
 {
-  g_assert(buf);
+  g_assert(pkt);
 
+  unsigned char *buf = pkt->data;
+  size_t len = pkt->len;
   int raw_resp_buf_size = -1;
 
   if (len < VIP_MIN_PACKET_SIZE) {
@@ -325,17 +801,24 @@ static int vip_digest_package(unsigned char *buf,
     raw_resp_buf_size = vip_is_clear_if(buf, len);
     
     if (raw_resp_buf_size > 0) {
-      g_printf("Got Clear_If, no ack sent\n");
+      LOGR_DEBUG("Got Clear_If, no ack sent");
 
       /* Stop any ongoing Zoom or Pan/Tilt movements */
-      stop_continous_movement(TRUE, TRUE);
+      stop_continous_movement(session->channel, TRUE, TRUE);
+
+      /* Do not keep controllers waiting for movements that were stopped */
+      ptz_flush_pending_moves(session->channel);
 
     } else {
       //g_printf("Got VISCA command, defer to PTZ functionality and first send ack\n");
-      size_t raw_cmd_len = buf[VIP_RAW_CMD_SIZE_IDX];
+      /* Never trust the header length beyond what was received. The
+         command is processed where it was received, the ACK goes in a
+         packet of its own. */
+      unsigned char *raw_cmd = &buf[VIP_RAW_CMD_START_IDX];
+      size_t raw_cmd_len = MIN(buf[VIP_RAW_CMD_SIZE_IDX],
+                               len - VIP_RAW_CMD_START_IDX);
 
-      /* Copy old raw command for procession function */
-      memcpy(raw_cmd, &buf[VIP_RAW_CMD_START_IDX], raw_cmd_len);
+      cur_class = ptz_command_class(raw_cmd, raw_cmd_len);
 
 #ifdef VERBOSE
       g_printf("Data Received: ");
@@ -346,41 +829,58 @@ static int vip_digest_package(unsigned char *buf,
       g_printf("\n");
 #endif
 
-      /* Send reply to remote end */
-      buf[0] = 0x01;
-      buf[1] = 0x11;
-      buf[2] = 0x00;
-      buf[3] = 3;
+      struct vip_packet *ack = vip_packet_get();
 
-      /* Fill out raw return buffer for command ACK */
-      buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
-      buf[VIP_RAW_CMD_START_IDX + 1] = 0x40;
-      buf[VIP_RAW_CMD_START_IDX + 2] = 0xFF;
+      if (ack) {
+        /* Sequence number in bytes 4-7 is echoed */
+        memcpy(ack->data, buf, VIP_HEADER_SIZE);
 
-      size_t resp_size = VIP_HEADER_SIZE + 3;
-      
-      if (sendto(cur_endpoint.s, 
-                 buf,
-                 resp_size, 
-                 0, 
-                 (const struct sockaddr *) &cur_endpoint.sock_addr, 
-                 cur_endpoint.addr_slen) == -1) {
-        g_printf("Failed to send acknowledgementa\n");
-      }
-    
+        /* Send reply to remote end */
+        ack->data[0] = 0x01;
+        ack->data[1] = 0x11;
+        ack->data[2] = 0x00;
+        ack->data[3] = 3;
 
-#ifdef VERBOSE
-      g_printf("Data Sent: ");
-      size_t i = 0;
-      for (; i < resp_size; i++) {
-        g_printf("%d=[0x%02x], ", i, rcv[i]);
+        /* Fill out raw return buffer for command ACK */
+        ack->data[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
+        ack->data[VIP_RAW_CMD_START_IDX + 1] = 0x40;
+        ack->data[VIP_RAW_CMD_START_IDX + 2] = 0xFF;
+
+        ack->len = VIP_HEADER_SIZE + 3;
+        ack->rx_time = pkt->rx_time;
+
+        /* ACK is sent together with all other replies of this wakeup */
+        vip_cache_reply(session->cur_reply, ack->data, ack->len);
+        vip_queue_packet(session, ack, METRICS_EVENT_ACK);
+      } else {
+        LOGR_WARN("Packet pool exhausted, ACK not sent");
       }
-      g_printf("\n");
 
+#ifdef VERBOSE
       /* TODO: Process Command */
       g_printf("Procssing cmd length %d\n", raw_cmd_len);
 #endif
-      process_command(raw_cmd, raw_cmd_len);
+      /* Movements that need to reach a target complete asynchronously,
+         keep what is needed to send the completion later on. If the
+         controller has no free completion slot, complete right away. */
+      struct vip_completion *completion =
+        vip_session_reserve_completion(session);
+
+      if (completion) {
+        memcpy(completion->header, buf, VIP_HEADER_SIZE);
+        completion->cls = cur_class;
+        completion->rx_time = pkt->rx_time;
+
+        if (process_command(session->channel, raw_cmd, raw_cmd_len,
+                            vip_send_completion,
+                            completion) == PTZ_CMD_PENDING) {
+          return 0;
+        }
+
+        vip_session_release_completion(completion);
+      } else {
+        process_command(session->channel, raw_cmd, raw_cmd_len, NULL, NULL);
+      }
 
       /* Fill out response buffer for command completion */
       buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_TX_DEV_ADDR;
@@ -396,122 +896,1207 @@ static int vip_digest_package(unsigned char *buf,
     #ifdef VERBOSE
     g_printf("Got VISCA Inquiry\n");
     #endif
-    return vip_digest_inquiry(buf, len);
+    return vip_digest_inquiry(session->channel, buf, len);
   } else {
-    g_printf("Got unhandled VISCA package type\n");
+    LOGR_WARN("Got unhandled VISCA package type");
   }
 
   return raw_resp_buf_size;
 }
 
-/********************************************/
-
-
-int vip_init()
+/*
+ * Queue a reply packet to the session's controller, sent on the next flush.
+ * The packet is owned by the queue from here on.
+ */
+static void vip_queue_packet(struct vip_session *session,
+                             struct vip_packet *pkt,
+                             enum metrics_event event)
 {
-  struct sockaddr_in si_me;
+  g_assert(pkt->len <= VIP_TX_BUF_SIZE);
 
-  int s;
+  pkt->event = event;
+  pkt->cls = cur_class;
 
-  if ((s=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))==-1) {
-    g_printf("Could not create socket!\n");
-    return -1;
+  /* Written to the connection after its read, without the header */
+  if (session->conn) {
+    vip_tcp_queue(session->conn, &pkt->data[VIP_HEADER_SIZE],
+                  pkt->len - VIP_HEADER_SIZE);
+    if (event != METRICS_EVENT_NONE) {
+      metrics_record_since(pkt->cls, event, pkt->rx_time);
+    }
+    vip_packet_put(pkt);
+    return;
   }
 
-  memset((char *) &si_me, 0, sizeof(si_me));
+  if (tx_count == VIP_TX_BATCH_SIZE) {
+    vip_flush_replies(session->endpoint.s);
+  }
 
-  si_me.sin_family = AF_INET;
-  si_me.sin_port = htons(52381);
-  si_me.sin_addr.s_addr = htonl(INADDR_ANY);
+  pkt->addr = session->endpoint.sock_addr;
+  pkt->addr_len = session->endpoint.addr_slen;
 
-  if (bind(s, (const struct sockaddr *) &si_me, sizeof(si_me))==-1) {
-    g_printf("Failed to bind socket!");
-    return -1;
-  }
+  tx_iovecs[tx_count].iov_base = pkt->data;
+  tx_iovecs[tx_count].iov_len = pkt->len;
 
-  GIOChannel *channel = g_io_channel_unix_new(s);
-  g_io_add_watch(channel, G_IO_IN, (GIOFunc) vip_cmd_callback, GINT_TO_POINTER(s));
+  memset(&tx_msgs[tx_count], 0, sizeof(tx_msgs[tx_count]));
+  tx_msgs[tx_count].msg_hdr.msg_name = &pkt->addr;
+  tx_msgs[tx_count].msg_hdr.msg_namelen = pkt->addr_len;
+  tx_msgs[tx_count].msg_hdr.msg_iov = &tx_iovecs[tx_count];
+  tx_msgs[tx_count].msg_hdr.msg_iovlen = 1;
 
-  return 0;
+  tx_packets[tx_count] = pkt;
+
+  tx_count++;
 }
 
-gboolean vip_cmd_callback(GIOChannel *source,
-                          GIOCondition cond,
-                          gpointer data)
+/*
+ * Queue a copy of a reply, for replies that are not built in a packet
+ */
+static void vip_queue_reply(struct vip_session *session,
+                            const unsigned char *buf, size_t len,
+                            enum metrics_event event)
 {
-  #ifdef VERBOSE
-  g_printf("Received connection from client.\n");
-  #endif
-  gsize bytes_read;
-  cur_endpoint.s = GPOINTER_TO_INT(data);
-  int raw_resp_buf_size;
-
-  cur_endpoint.addr_slen = sizeof(cur_endpoint.sock_addr);
+  struct vip_packet *pkt = vip_packet_get();
 
-  
-  bytes_read = recvfrom(cur_endpoint.s, 
-                        rcv, 
-                        512, 
-                        0, 
-                        (struct sockaddr *) &cur_endpoint.sock_addr, 
-                        (socklen_t *) &cur_endpoint.addr_slen);
-
-  if (bytes_read == -1) {
-    g_printf("Failed to receive data!\n");
-    goto out;
+  if (!pkt) {
+    LOGR_WARN("Packet pool exhausted, reply not sent");
+    return;
   }
 
-#ifdef VERBOSE
-  g_printf("Received %d bytes packet from %s:%d\n", bytes_read, 
-    inet_ntoa(cur_endpoint.sock_addr.sin_addr), 
-    ntohs(cur_endpoint.sock_addr.sin_port));
-
-  g_printf("Data Received: ");
-  size_t i = 0;
-  for (; i < bytes_read; i++) {
-    g_printf("%d=[0x%02x], ", i, rcv[i]);
-  }
-  g_printf("\n");
-#endif
+  memcpy(pkt->data, buf, len);
+  pkt->len = len;
+  pkt->rx_time = 0;
 
-  raw_resp_buf_size = vip_digest_package(rcv, bytes_read);
+  vip_queue_packet(session, pkt, event);
+}
+
+/*
+ * Errors of sendmmsg that concern the socket, not the destination of the
+ * failing message. Others, such as an unreachable controller, only fail
+ * that message.
+ */
+static gboolean vip_send_error_is_fatal(int err)
+{
+  return err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS ||
+    err == ENOMEM || err == EBADF || err == ENOTSOCK || err == EFAULT;
+}
+
+/*
+ * Send all queued replies with as few system calls as possible
+ */
+static void vip_flush_replies(int s)
+{
+  gboolean failed[VIP_TX_BATCH_SIZE] = { FALSE };
+  unsigned int sent = 0;
+  unsigned int errors = 0;
+  unsigned int i;
+
+  while (sent < tx_count) {
+    int ret = sendmmsg(s, &tx_msgs[sent], tx_count - sent, 0);
+
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      if (vip_send_error_is_fatal(errno)) {
+        LOGR_WARN("Failed to send %u replies", tx_count - sent);
+        break;
+      }
+
+      /* Skip the reply to this controller, send the rest */
+      failed[sent++] = TRUE;
+      errors++;
+      continue;
+    }
+
+    sent += ret;
+    batch_stats.tx_batches++;
+  }
+
+  for (i = sent; i < tx_count; i++) {
+    failed[i] = TRUE;
+    errors++;
+  }
+
+  if (errors > 0) {
+    LOGR_WARN("Failed to send %u of %u replies", errors, tx_count);
+  }
+
+  batch_stats.tx_datagrams += tx_count - errors;
+  batch_stats.tx_errors += errors;
+
+  for (i = 0; i < tx_count; i++) {
+    struct vip_packet *pkt = tx_packets[i];
+
+    if (!failed[i] && pkt->event != METRICS_EVENT_NONE) {
+      metrics_record_since(pkt->cls, pkt->event, pkt->rx_time);
+    }
+
+    vip_packet_put(pkt);
+    tx_packets[i] = NULL;
+  }
+
+  tx_count = 0;
+}
+
+/*
+ * Control messages (payload type 0x0200), RESET of the sequence number
+ * and telemetry subscriptions are supported. The reply is built in place,
+ * returns its length or 0 for no reply.
+ */
+static size_t vip_handle_control(struct vip_session *session,
+                                 unsigned char *buf, size_t len)
+{
+  if (len == VIP_HEADER_SIZE + 2 &&
+      buf[VIP_RAW_CMD_START_IDX] == VIP_TELEMETRY_MSG) {
+    return vip_handle_subscribe(session, buf, len);
+  }
+
+  if (len != VIP_HEADER_SIZE + 1 || buf[VIP_RAW_CMD_START_IDX] != 0x01) {
+    LOGR_WARN("Got unhandled control message");
+    return 0;
+  }
+
+  LOGR_INFO("Got sequence number RESET");
+
+  vip_session_reset(session);
+
+  /* Control reply, echoing the sequence number */
+  buf[0] = 0x02;
+  buf[1] = 0x01;
+  buf[2] = 0x00;
+  buf[3] = 0x01;
+  buf[VIP_RAW_CMD_START_IDX] = 0x01;
+
+  return VIP_HEADER_SIZE + 1;
+}
+
+/*
+ * Handle a received packet, which is either answered in place or returned
+ * to the pool
+ */
+static void vip_handle_datagram(struct vip_session *session,
+                                struct vip_packet *pkt)
+{
+  unsigned char *buf = pkt->data;
+  size_t len = pkt->len;
+  int raw_resp_buf_size;
+
+#ifdef VERBOSE
+  g_printf("Received %d bytes packet from %s:%d\n", len, 
+    inet_ntoa(session->endpoint.sock_addr.sin_addr), 
+    ntohs(session->endpoint.sock_addr.sin_port));
+
+  g_printf("Data Received: ");
+  size_t i = 0;
+  for (; i < len; i++) {
+    g_printf("%d=[0x%02x], ", i, buf[i]);
+  }
+  g_printf("\n");
+#endif
+
+  if (len < VIP_HEADER_SIZE) {
+    LOGR_WARN("Invalid Visca command");
+    vip_packet_put(pkt);
+    return;
+  }
+
+  guint32 seq = vip_get_seq(buf);
+
+  if (buf[0] == 0x02 && buf[1] == 0x00) {
+    cur_class = METRICS_OTHER;
+
+    if ((pkt->len = vip_handle_control(session, buf, len)) > 0) {
+      vip_queue_packet(session, pkt, METRICS_EVENT_NONE);
+    } else {
+      vip_packet_put(pkt);
+    }
+    return;
+  }
+
+  /* Retransmitted commands are answered from the cache, not executed
+     again. Inquiries are cheap and always answered with fresh data.
+     TCP does not retransmit. */
+  session->cur_reply = NULL;
+
+  if (!session->conn && len >= VIP_MIN_PACKET_SIZE &&
+      buf[0] == 0x01 && buf[1] == 0x00 && buf[VIP_RAW_PT_IDX] == 0x01) {
+    struct vip_cached_reply *cached =
+      vip_session_find_reply(session, seq, buf, len);
+
+    if (cached) {
+      unsigned int r;
+
+      num_duplicates++;
+      for (r = 0; r < cached->num_replies; r++) {
+        vip_queue_reply(session, cached->reply[r], cached->reply_len[r],
+                        METRICS_EVENT_NONE);
+      }
+      vip_packet_put(pkt);
+      return;
+    }
+
+    session->cur_reply = vip_session_new_reply(session, seq, buf, len);
+  }
+
+  /* Keep track of the controller's sequence number */
+  session->last_seq = seq;
+  session->have_seq = TRUE;
+
+  cur_class = METRICS_OTHER;
+
+  raw_resp_buf_size = vip_digest_package(session, pkt);
+
+  metrics_count(cur_class);
 
   /* Digest package */
   if (raw_resp_buf_size < 0) {
-    g_printf("Invalid Visca command\n");
-    goto out;
+    metrics_count_error(cur_class);
+    LOGR_WARN("Invalid Visca command");
+    session->cur_reply = NULL;
+    vip_packet_put(pkt);
+    return;
+  }
+
+  /* Completion is sent once the movement has finished */
+  if (raw_resp_buf_size == 0) {
+    session->cur_reply = NULL;
+    vip_packet_put(pkt);
+    return;
   }
 
   size_t resp_size = raw_resp_buf_size + VIP_HEADER_SIZE;
 
   g_assert(raw_resp_buf_size >= 1 && raw_resp_buf_size <= 16);
 
-  rcv[0] = 0x01;
-  rcv[1] = 0x11;
-  rcv[2] = 0x00;
-  rcv[3] = raw_resp_buf_size;
+  buf[0] = 0x01;
+  buf[1] = 0x11;
+  buf[2] = 0x00;
+  buf[3] = raw_resp_buf_size;
 
-  /* Send reply to remote end */
-  if (sendto(cur_endpoint.s, 
-               rcv, 
-               resp_size, 
-               0, 
-               (const struct sockaddr *) &cur_endpoint.sock_addr, 
-               cur_endpoint.addr_slen) == -1) {
-      g_printf("Failed to echo data\n");
-      goto out;
-  }
+  /* Send reply to remote end, sequence number in bytes 4-7 is echoed */
+  vip_cache_reply(session->cur_reply, buf, resp_size);
+  session->cur_reply = NULL;
 
 #ifdef VERBOSE
   g_printf("Data Sent: ");
   i = 0;
   for (; i < resp_size; i++) {
-    g_printf("%d=[0x%02x], ", i, rcv[i]);
+    g_printf("%d=[0x%02x], ", i, buf[i]);
   }
   g_printf("\n");
 #endif
-  
+
+  pkt->len = resp_size;
+  vip_queue_packet(session, pkt, METRICS_EVENT_COMPLETION);
+}
+
+/********************************************/
+
+/*
+ * Raw VISCA over TCP. Messages are split on the 0xFF terminator and get a
+ * VISCA over IP command header, so they take the same path as datagrams.
+ * Replies are buffered per connection and written without the header once
+ * all messages of a read are handled. Sockets are non-blocking, a client
+ * that does not read its replies is disconnected when its buffer is full.
+ */
+
+/* Longest raw VISCA message, with terminator */
+#define VIP_TCP_MAX_MSG_SIZE (16)
+#define VIP_TCP_RX_SIZE (512)
+#define VIP_TCP_TX_SIZE (4096)
+#define VIP_TCP_MAX_CONNECTIONS (32)
+
+struct vip_tcp_conn {
+  int s;
+  guint in_source;
+  guint out_source;
+  guint free_source;
+  struct vip_session session;
+  guint32 seq;
+  size_t rx_len;
+  size_t tx_len;
+  unsigned char rx[VIP_TCP_RX_SIZE];
+  unsigned char tx[VIP_TCP_TX_SIZE];
+};
+
+static struct vip_tcp_stats tcp_stats;
+
+static gboolean vip_tcp_is_open(const struct vip_tcp_conn *conn)
+{
+  return conn->s >= 0;
+}
+
+static gboolean vip_tcp_free_callback(gpointer data)
+{
+  struct vip_tcp_conn *conn = data;
+
+  conn->free_source = 0;
+
+  if (conn->session.pending == 0) {
+    g_free(conn);
+  }
+
+  return FALSE;
+}
+
+/*
+ * Freed from an idle callback, the connection may be closed while one of
+ * its messages is being handled
+ */
+static void vip_tcp_free(struct vip_tcp_conn *conn)
+{
+  if (!conn->free_source) {
+    conn->free_source = g_idle_add(vip_tcp_free_callback, conn);
+  }
+}
+
+/*
+ * Stop serving a connection. It is kept until movements of the controller
+ * have completed.
+ */
+static void vip_tcp_close(struct vip_tcp_conn *conn)
+{
+  if (!vip_tcp_is_open(conn)) {
+    return;
+  }
+
+  if (conn->in_source) {
+    g_source_remove(conn->in_source);
+    conn->in_source = 0;
+  }
+
+  if (conn->out_source) {
+    g_source_remove(conn->out_source);
+    conn->out_source = 0;
+  }
+
+  close(conn->s);
+  conn->s = -1;
+
+  tcp_stats.connections--;
+
+  LOGR_INFO("Closed TCP controller %u.%u.%u.%u:%d, %u connections",
+    VIP_ADDR_OCTETS(&conn->session.endpoint.sock_addr),
+    ntohs(conn->session.endpoint.sock_addr.sin_port),
+    (guint) tcp_stats.connections);
+
+  if (conn->session.pending == 0) {
+    vip_tcp_free(conn);
+  }
+}
+
+static void vip_tcp_queue(struct vip_tcp_conn *conn,
+                          const unsigned char *buf, size_t len)
+{
+  if (!vip_tcp_is_open(conn)) {
+    return;
+  }
+
+  if (conn->tx_len + len > VIP_TCP_TX_SIZE) {
+    /* Dropping replies would desynchronize the controller */
+    LOGR_WARN("TCP controller not reading replies, disconnecting");
+    tcp_stats.overflows++;
+    vip_tcp_close(conn);
+    return;
+  }
+
+  memcpy(&conn->tx[conn->tx_len], buf, len);
+  conn->tx_len += len;
+}
+
+static gboolean vip_tcp_out_callback(GIOChannel *source,
+                                     GIOCondition cond,
+                                     gpointer data)
+{
+  struct vip_tcp_conn *conn = data;
+
+  conn->out_source = 0;
+  vip_tcp_flush(conn);
+
+  return FALSE;
+}
+
+/*
+ * Write what the socket takes, wait for it to become writable for the rest
+ */
+static void vip_tcp_flush(struct vip_tcp_conn *conn)
+{
+  size_t written = 0;
+
+  if (!vip_tcp_is_open(conn) || conn->out_source) {
+    return;
+  }
+
+  while (written < conn->tx_len) {
+    ssize_t ret = send(conn->s, &conn->tx[written], conn->tx_len - written,
+                       MSG_NOSIGNAL);
+
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOGR_WARN("Failed to write to TCP controller");
+        vip_tcp_close(conn);
+        return;
+      }
+      break;
+    }
+
+    written += ret;
+  }
+
+  memmove(conn->tx, &conn->tx[written], conn->tx_len - written);
+  conn->tx_len -= written;
+
+  if (conn->tx_len > 0) {
+    GIOChannel *channel = g_io_channel_unix_new(conn->s);
+    conn->out_source = g_io_add_watch(channel, G_IO_OUT,
+                                      vip_tcp_out_callback, conn);
+    g_io_channel_unref(channel);
+  }
+}
+
+/*
+ * Wrap one raw message in a VISCA over IP header and handle it like a
+ * datagram. Broadcasts are only Address_Set, answered here, and IF_Clear,
+ * handled as if it was sent to the camera.
+ */
+static void vip_tcp_handle_message(struct vip_tcp_conn *conn,
+                                   const unsigned char *msg, size_t len,
+                                   gint64 rx_time)
+{
+  static const unsigned char address_set[] = { 0x88, 0x30, 0x01, 0xFF };
+  static const unsigned char address_reply[] = { 0x88, 0x30, 0x02, 0xFF };
+  struct vip_packet *pkt;
+  unsigned char *buf;
+
+  tcp_stats.messages++;
+
+  if (len == sizeof(address_set) && memcmp(msg, address_set, len) == 0) {
+    vip_tcp_queue(conn, address_reply, sizeof(address_reply));
+    return;
+  }
+
+  if (!(pkt = vip_packet_get())) {
+    LOGR_WARN("Packet pool exhausted, dropping raw VISCA message");
+    tcp_stats.errors++;
+    return;
+  }
+
+  buf = pkt->data;
+  conn->seq++;
+
+  buf[0] = 0x01;
+  buf[1] = 0x00;
+  buf[2] = 0x00;
+  buf[3] = len;
+  buf[4] = conn->seq >> 24;
+  buf[5] = conn->seq >> 16;
+  buf[6] = conn->seq >> 8;
+  buf[7] = conn->seq;
+
+  memcpy(&buf[VIP_HEADER_SIZE], msg, len);
+
+  if (buf[VIP_RAW_CMD_START_IDX] == 0x88) {
+    buf[VIP_RAW_CMD_START_IDX] = VIP_RAW_RX_DEV_ADDR;
+  }
+
+  pkt->len = VIP_HEADER_SIZE + len;
+  pkt->rx_time = rx_time;
+
+  vip_handle_datagram(&conn->session, pkt);
+}
+
+static gboolean vip_tcp_in_callback(GIOChannel *source,
+                                    GIOCondition cond,
+                                    gpointer data)
+{
+  struct vip_tcp_conn *conn = data;
+  size_t start = 0;
+  size_t i;
+  ssize_t ret;
+  gint64 rx_time;
+
+  ret = recv(conn->s, &conn->rx[conn->rx_len],
+             VIP_TCP_RX_SIZE - conn->rx_len, MSG_DONTWAIT);
+
+  if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == EINTR)) {
+    return TRUE;
+  }
+
+  if (ret <= 0) {
+    conn->in_source = 0;
+    vip_tcp_close(conn);
+    return FALSE;
+  }
+
+  rx_time = g_get_monotonic_time();
+
+  for (i = conn->rx_len; i < conn->rx_len + ret; i++) {
+    if (conn->rx[i] != VIP_RAW_END_MARKER) {
+      continue;
+    }
+
+    if (i + 1 - start > VIP_TCP_MAX_MSG_SIZE ||
+        i + 1 - start < 3) {
+      LOGR_WARN("Invalid raw VISCA message of %d bytes",
+        (int) (i + 1 - start));
+      tcp_stats.errors++;
+    } else {
+      vip_tcp_handle_message(conn, &conn->rx[start], i + 1 - start, rx_time);
+    }
+
+    start = i + 1;
+
+    /* Closed while handling, e.g. its reply buffer overflowed */
+    if (!vip_tcp_is_open(conn)) {
+      return FALSE;
+    }
+  }
+
+  conn->rx_len += ret;
+
+  /* Keep the partial message, a full buffer without terminator is junk */
+  memmove(conn->rx, &conn->rx[start], conn->rx_len - start);
+  conn->rx_len -= start;
+
+  if (conn->rx_len == VIP_TCP_RX_SIZE) {
+    LOGR_WARN("Discarding unterminated raw VISCA data");
+    tcp_stats.errors++;
+    conn->rx_len = 0;
+  }
+
+  vip_tcp_flush(conn);
+
+  return vip_tcp_is_open(conn);
+}
+
+static gboolean vip_tcp_accept_callback(GIOChannel *source,
+                                        GIOCondition cond,
+                                        gpointer data)
+{
+  struct vip_listener *listener = data;
+
+  for (;;) {
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int one = 1;
+    int s = accept4(listener->s, (struct sockaddr *) &addr, &addr_len,
+                    SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if (s == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOGR_WARN("Failed to accept TCP controller");
+      }
+      break;
+    }
+
+    tcp_stats.accepted++;
+
+    if (tcp_stats.connections >= VIP_TCP_MAX_CONNECTIONS) {
+      LOGR_WARN("Too many TCP controllers, refusing connection");
+      tcp_stats.refused++;
+      close(s);
+      continue;
+    }
+
+    /* Replies are a few bytes each and latency sensitive */
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    struct vip_tcp_conn *conn = g_new0(struct vip_tcp_conn, 1);
+    int i;
+
+    conn->s = s;
+    conn->session.conn = conn;
+    conn->session.channel = listener->channel;
+    conn->session.endpoint.s = s;
+    conn->session.endpoint.sock_addr = addr;
+    conn->session.endpoint.addr_slen = addr_len;
+
+    for (i = 0; i < VIP_SESSION_MAX_PENDING; i++) {
+      conn->session.completions[i].session = &conn->session;
+    }
+
+    GIOChannel *channel = g_io_channel_unix_new(s);
+    conn->in_source = g_io_add_watch(channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                     vip_tcp_in_callback, conn);
+    g_io_channel_unref(channel);
+
+    tcp_stats.connections++;
+
+    LOGR_INFO("New TCP controller %u.%u.%u.%u:%d on channel %d",
+      VIP_ADDR_OCTETS(&addr), ntohs(addr.sin_port),
+      ptz_channel_number(listener->channel));
+  }
+
+  return TRUE;
+}
+
+static int vip_tcp_init(struct vip_listener *listener, int port)
+{
+  struct sockaddr_in si_me;
+  int one = 1;
+  int s;
+
+  if ((s = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                  IPPROTO_TCP)) == -1) {
+    g_printf("Could not create TCP socket!\n");
+    return -1;
+  }
+
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  memset((char *) &si_me, 0, sizeof(si_me));
+
+  si_me.sin_family = AF_INET;
+  si_me.sin_port = htons(port);
+  si_me.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (bind(s, (const struct sockaddr *) &si_me, sizeof(si_me)) == -1 ||
+      listen(s, VIP_TCP_MAX_CONNECTIONS) == -1) {
+    g_printf("Failed to listen on TCP port %d!\n", port);
+    close(s);
+    return -1;
+  }
+
+  listener->s = s;
+
+  GIOChannel *channel = g_io_channel_unix_new(s);
+  g_io_add_watch(channel, G_IO_IN, vip_tcp_accept_callback, listener);
+  g_io_channel_unref(channel);
+
+  return 0;
+}
+
+/********************************************/
+
+
+/*
+ * Position telemetry. A controller subscribes with a control message and
+ * gets pan, tilt and zoom pushed instead of polling for them. Every tick of
+ * a channel takes one status sample and builds one frame for all its
+ * subscribers. The frame is only sent when an axis moved more than the
+ * threshold, in VISCA steps, or the keepalive interval has passed.
+ *
+ *   Subscribe    02 00 00 02 <seq> 10 01, 10 00 unsubscribes
+ *   Reply        02 01 00 02 <seq> 10 01 if subscribed, else 10 00
+ *   Frame        02 10 00 10 <seq> 90 50 0p 0p 0p 0p 0p 0t 0t 0t 0t
+ *                0z 0z 0z 0z FF
+ *
+ * The frame sequence number counts frames of the channel. Subscriptions
+ * expire with the session unless renewed within the idle timeout.
+ */
+#define VIP_TELEMETRY_MAX_SUBSCRIBERS (32)
+#define VIP_TELEMETRY_PAYLOAD_SIZE (16)
+#define VIP_TELEMETRY_KEEPALIVE_US (1 * G_USEC_PER_SEC)
+#define VIP_TELEMETRY_MS_DEFAULT (100)
+
+struct vip_telemetry {
+  struct vip_listener *listener;
+  struct vip_session *subscribers[VIP_TELEMETRY_MAX_SUBSCRIBERS];
+  guint num_subscribers;
+  guint source;
+  guint32 seq;
+  gboolean sent;
+  gint64 sent_time;
+  unsigned int pan;
+  unsigned int tilt;
+  unsigned int zoom;
+};
+
+static struct vip_telemetry telemetry[PTZ_MAX_CHANNELS];
+static guint telemetry_ms = VIP_TELEMETRY_MS_DEFAULT;
+static guint telemetry_threshold = 0;
+
+static struct vip_telemetry_stats telemetry_stats;
+
+static struct mmsghdr telemetry_msgs[VIP_TELEMETRY_MAX_SUBSCRIBERS];
+static struct iovec telemetry_iovec;
+
+/*
+ * Distance between two VISCA positions of bits bits, two's complement
+ */
+static guint vip_telemetry_delta(unsigned int a, unsigned int b, int bits)
+{
+  gint32 sa = (gint32) (a << (32 - bits)) >> (32 - bits);
+  gint32 sb = (gint32) (b << (32 - bits)) >> (32 - bits);
+
+  return ABS(sa - sb);
+}
+
+static void vip_telemetry_send(struct vip_telemetry *t,
+                               const unsigned char *frame, size_t len)
+{
+  unsigned int sent = 0;
+  unsigned int errors = 0;
+  guint i;
+
+  telemetry_iovec.iov_base = (void *) frame;
+  telemetry_iovec.iov_len = len;
+
+  for (i = 0; i < t->num_subscribers; i++) {
+    struct vip_endpoint *endpoint = &t->subscribers[i]->endpoint;
+
+    memset(&telemetry_msgs[i], 0, sizeof(telemetry_msgs[i]));
+    telemetry_msgs[i].msg_hdr.msg_name = &endpoint->sock_addr;
+    telemetry_msgs[i].msg_hdr.msg_namelen = endpoint->addr_slen;
+    telemetry_msgs[i].msg_hdr.msg_iov = &telemetry_iovec;
+    telemetry_msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (sent < t->num_subscribers) {
+    int ret = sendmmsg(t->listener->s, &telemetry_msgs[sent],
+                       t->num_subscribers - sent, 0);
+
+    if (ret == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      if (vip_send_error_is_fatal(errno)) {
+        LOGR_WARN("Failed to send telemetry to %u controllers",
+          t->num_subscribers - sent);
+        break;
+      }
+
+      /* Skip this subscriber, send to the rest */
+      sent++;
+      errors++;
+      continue;
+    }
+
+    sent += ret;
+  }
+
+  telemetry_stats.datagrams += sent - errors;
+}
+
+static gboolean vip_telemetry_tick(gpointer data)
+{
+  struct vip_telemetry *t = data;
+  struct ptz_channel *ch = t->listener->channel;
+  const struct conv_tables *conv = ptz_channel_conv(ch);
+  unsigned char frame[VIP_HEADER_SIZE + VIP_TELEMETRY_PAYLOAD_SIZE];
+  unsigned char *payload = &frame[VIP_HEADER_SIZE];
+  gint64 now = g_get_monotonic_time();
+  struct ptz_status pt;
+
+  if (ptz_get_status_estimate(ch, &pt) < 0) {
+    return TRUE;
+  }
+
+  telemetry_stats.samples++;
+
+  if (get_rotation(ch)) {
+    pt.tilt = -pt.tilt;
+  }
+
+  unsigned int pan = conv_pan_to_visca(conv, fx_ftox(pt.pan, FIXMATH_FRAC_BITS));
+  unsigned int tilt = conv_tilt_to_visca(conv, fx_ftox(pt.tilt, FIXMATH_FRAC_BITS));
+  unsigned int zoom = conv_zoom_to_visca(conv, fx_ftox(pt.zoom, FIXMATH_FRAC_BITS));
+
+  if (t->sent && now - t->sent_time < VIP_TELEMETRY_KEEPALIVE_US &&
+      vip_telemetry_delta(pan, t->pan, 20) <= telemetry_threshold &&
+      vip_telemetry_delta(tilt, t->tilt, 16) <= telemetry_threshold &&
+      vip_telemetry_delta(zoom, t->zoom, 16) <= telemetry_threshold) {
+    telemetry_stats.suppressed++;
+    return TRUE;
+  }
+
+  t->seq++;
+
+  frame[0] = 0x02;
+  frame[1] = 0x10;
+  frame[2] = 0x00;
+  frame[3] = VIP_TELEMETRY_PAYLOAD_SIZE;
+  frame[4] = t->seq >> 24;
+  frame[5] = t->seq >> 16;
+  frame[6] = t->seq >> 8;
+  frame[7] = t->seq;
+
+  payload[0] = VIP_RAW_TX_DEV_ADDR;
+  payload[1] = 0x50;
+  conv_put_nibbles(&payload[2], pan, 5);
+  conv_put_nibbles(&payload[7], tilt, 4);
+  conv_put_nibbles(&payload[11], zoom, 4);
+  payload[15] = VIP_RAW_END_MARKER;
+
+  vip_telemetry_send(t, frame, sizeof(frame));
+
+  t->sent = TRUE;
+  t->sent_time = now;
+  t->pan = pan;
+  t->tilt = tilt;
+  t->zoom = zoom;
+  telemetry_stats.frames++;
+
+  return TRUE;
+}
+
+static void vip_telemetry_start(struct vip_telemetry *t)
+{
+  /* First frame of a new subscriber is sent on the next tick */
+  t->sent = FALSE;
+
+  if (!t->source) {
+    t->source = g_timeout_add(telemetry_ms, vip_telemetry_tick, t);
+  }
+}
+
+static gboolean vip_telemetry_subscribe(struct vip_session *session)
+{
+  struct vip_telemetry *t =
+    &telemetry[ptz_channel_index(session->channel)];
+
+  /* Frames are datagrams, raw VISCA over TCP has no way to subscribe */
+  if (session->conn) {
+    return FALSE;
+  }
+
+  if (session->subscribed) {
+    return TRUE;
+  }
+
+  if (t->num_subscribers == VIP_TELEMETRY_MAX_SUBSCRIBERS) {
+    LOGR_WARN("Too many telemetry subscribers, refusing");
+    telemetry_stats.refused++;
+    return FALSE;
+  }
+
+  t->subscribers[t->num_subscribers++] = session;
+  session->subscribed = TRUE;
+  telemetry_stats.subscribers++;
+
+  vip_telemetry_start(t);
+
+  LOGR_INFO("New telemetry subscriber %u.%u.%u.%u:%d on channel %d",
+    VIP_ADDR_OCTETS(&session->endpoint.sock_addr),
+    ntohs(session->endpoint.sock_addr.sin_port),
+    ptz_channel_number(session->channel));
+
+  return TRUE;
+}
+
+static void vip_telemetry_unsubscribe(struct vip_session *session)
+{
+  struct vip_telemetry *t;
+  guint i;
+
+  if (!session->subscribed) {
+    return;
+  }
+
+  t = &telemetry[ptz_channel_index(session->channel)];
+
+  for (i = 0; i < t->num_subscribers; i++) {
+    if (t->subscribers[i] == session) {
+      t->subscribers[i] = t->subscribers[--t->num_subscribers];
+      break;
+    }
+  }
+
+  session->subscribed = FALSE;
+  telemetry_stats.subscribers--;
+
+  if (t->num_subscribers == 0 && t->source) {
+    g_source_remove(t->source);
+    t->source = 0;
+  }
+}
+
+/*
+ * Subscribe or unsubscribe, the reply tells if the controller is subscribed
+ */
+static size_t vip_handle_subscribe(struct vip_session *session,
+                                   unsigned char *buf, size_t len)
+{
+  gboolean subscribed = FALSE;
+
+  if (buf[VIP_RAW_CMD_START_IDX + 1] == 0x01) {
+    LOGR_DEBUG("Got telemetry subscription");
+    subscribed = vip_telemetry_subscribe(session);
+  } else {
+    LOGR_DEBUG("Got telemetry unsubscription");
+    vip_telemetry_unsubscribe(session);
+  }
+
+  buf[0] = 0x02;
+  buf[1] = 0x01;
+  buf[2] = 0x00;
+  buf[3] = 0x02;
+  buf[VIP_RAW_CMD_START_IDX + 1] = subscribed ? 0x01 : 0x00;
+
+  return VIP_HEADER_SIZE + 2;
+}
+
+static void telemetry_rate_param_callback(const gchar *value)
+{
+  gint64 rate_ms = g_ascii_strtoll(value, NULL, 10);
+  guint c;
+
+  g_printf("Got telemetry interval %s ms\n", value);
+
+  telemetry_ms = CLAMP(rate_ms, 10, 1000);
+
+  /* Running ticks restart with the new interval */
+  for (c = 0; c < PTZ_MAX_CHANNELS; c++) {
+    if (telemetry[c].source) {
+      g_source_remove(telemetry[c].source);
+      telemetry[c].source = 0;
+      vip_telemetry_start(&telemetry[c]);
+    }
+  }
+}
+
+static void telemetry_threshold_param_callback(const gchar *value)
+{
+  gint64 threshold = g_ascii_strtoll(value, NULL, 10);
+
+  g_printf("Got telemetry threshold %s\n", value);
+
+  telemetry_threshold = CLAMP(threshold, 0, 0x4000);
+}
+
+/********************************************/
+
+static int vip_udp_init(struct vip_listener *listener, int port)
+{
+  struct sockaddr_in si_me;
+
+  int s;
+
+  if ((s=socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP))==-1) {
+    g_printf("Could not create socket!\n");
+    return -1;
+  }
+
+  memset((char *) &si_me, 0, sizeof(si_me));
+
+  si_me.sin_family = AF_INET;
+  si_me.sin_port = htons(port);
+  si_me.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  if (bind(s, (const struct sockaddr *) &si_me, sizeof(si_me))==-1) {
+    g_printf("Failed to bind socket to port %d!\n", port);
+    close(s);
+    return -1;
+  }
+
+  listener->s = s;
+
+  GIOChannel *channel = g_io_channel_unix_new(s);
+  g_io_add_watch(channel, G_IO_IN, (GIOFunc) vip_cmd_callback, listener);
+  g_io_channel_unref(channel);
+
+  return 0;
+}
+
+/*
+ * Serve all channels, on ports offset from the given ones or on ports
+ * picked by the system if 0
+ */
+static int vip_init_ports(int udp_port, int tcp_port)
+{
+  guint num_channels = ptz_num_channels();
+  guint c;
+  int i;
+
+  if (num_channels == 0) {
+    g_printf("No PTZ channels to serve!\n");
+    return -1;
+  }
+
+  /* Setup receive batch, packets are attached on every receive */
+  vip_pool_init();
+
+  memset(rx_msgs, 0, sizeof(rx_msgs));
+  for (i = 0; i < VIP_BATCH_SIZE; i++) {
+    rx_iovecs[i].iov_len = SBUF_SIZE;
+
+    rx_msgs[i].msg_hdr.msg_iov = &rx_iovecs[i];
+    rx_msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  sessions = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+  g_timeout_add_seconds(VIP_SESSION_EVICT_INTERVAL_S, vip_evict_sessions, NULL);
+
+  for (c = 0; c < num_channels; c++) {
+    struct ptz_channel *ch = ptz_get_channel(c);
+
+    udp_listeners[c].channel = ch;
+    tcp_listeners[c].channel = ch;
+    telemetry[c].listener = &udp_listeners[c];
+
+    if (vip_udp_init(&udp_listeners[c], udp_port ? udp_port + c : 0) < 0) {
+      return -1;
+    }
+
+    /* UDP controllers are still served if TCP is not available */
+    if (vip_tcp_init(&tcp_listeners[c], tcp_port ? tcp_port + c : 0) < 0) {
+      g_printf("Raw VISCA over TCP disabled for channel %d\n",
+        ptz_channel_number(ch));
+    }
+
+    if (udp_port) {
+      g_printf("Channel %d on UDP port %d, TCP port %d\n",
+        ptz_channel_number(ch), udp_port + c, tcp_port + c);
+    }
+  }
+
+  /* Get telemetry interval and change threshold */
+  char telemetry_param[32];
+  if (param_get("TelemetryMs", telemetry_param, sizeof(telemetry_param))) {
+    telemetry_rate_param_callback(telemetry_param);
+  }
+
+  param_register_callback("TelemetryMs", telemetry_rate_param_callback);
+
+  if (param_get("TelemetryThreshold", telemetry_param,
+                sizeof(telemetry_param))) {
+    telemetry_threshold_param_callback(telemetry_param);
+  }
+
+  param_register_callback("TelemetryThreshold",
+    telemetry_threshold_param_callback);
+
+  /* Replies of state only inquiries, rebuilt when the state changes */
+  vip_build_version_reply();
+
+  for (c = 0; c < num_channels; c++) {
+    char focus_param[32];
+    char focus_mode[16];
+
+    g_snprintf(focus_param, sizeof(focus_param), "PTZ.Various.V%d.AutoFocus",
+               ptz_channel_number(ptz_get_channel(c)));
+
+    if (!param_get(focus_param, focus_mode, sizeof(focus_mode))) {
+      focus_mode[0] = '\0';
+    }
+    autofocus_param_callbacks[c](focus_mode);
+
+    param_register_callback(focus_param, autofocus_param_callbacks[c]);
+  }
+
+  return 0;
+}
+
+int vip_init()
+{
+  return vip_init_ports(VIP_UDP_PORT, VIP_TCP_PORT);
+}
+
+gboolean vip_cmd_callback(GIOChannel *source,
+                          GIOCondition cond,
+                          gpointer data)
+{
+  #ifdef VERBOSE
+  g_printf("Received connection from client.\n");
+  #endif
+  struct vip_listener *listener = data;
+  int s = listener->s;
+  int batch;
+  int received;
+  gint64 rx_time;
+  int i;
+
+  /* Attach a packet to every receive slot, slots keep unused packets */
+  for (batch = 0; batch < VIP_BATCH_SIZE; batch++) {
+    struct vip_packet *pkt = rx_packets[batch];
+
+    if (!pkt && !(pkt = rx_packets[batch] = vip_packet_get())) {
+      break;
+    }
+
+    rx_iovecs[batch].iov_base = pkt->data;
+    rx_msgs[batch].msg_hdr.msg_name = &pkt->addr;
+    rx_msgs[batch].msg_hdr.msg_namelen = sizeof(pkt->addr);
+  }
+
+  if (batch == 0) {
+    LOGR_WARN("Packet pool exhausted, not receiving");
+    goto out;
+  }
+
+  /* Drain as many datagrams as are available, up to the batch size */
+  received = recvmmsg(s, rx_msgs, batch, MSG_DONTWAIT, NULL);
+
+  if (received == -1) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      LOGR_WARN("Failed to receive data");
+    }
+    goto out;
+  }
+
+  /* One receive time for the whole batch, latencies include queueing */
+  rx_time = g_get_monotonic_time();
+
+  batch_stats.wakeups++;
+  batch_stats.datagrams += received;
+  batch_stats.batch_size[received]++;
+
+  for (i = 0; i < received; i++) {
+    struct vip_packet *pkt = rx_packets[i];
+
+    /* Owned by the handler from here on */
+    rx_packets[i] = NULL;
+
+    pkt->len = rx_msgs[i].msg_len;
+    pkt->addr_len = rx_msgs[i].msg_hdr.msg_namelen;
+    pkt->rx_time = rx_time;
+
+    struct vip_session *session =
+      vip_session_lookup(listener, &pkt->addr, pkt->addr_len);
+
+    vip_handle_datagram(session, pkt);
+  }
+
+  vip_flush_replies(s);
 
 out:
   return TRUE; 
-}
\ No newline at end of file
+}
+
+void vip_get_batch_stats(struct vip_batch_stats *stats)
+{
+  g_assert(stats);
+
+  *stats = batch_stats;
+}
+
+void vip_get_tcp_stats(struct vip_tcp_stats *stats)
+{
+  g_assert(stats);
+
+  *stats = tcp_stats;
+}
+
+void vip_get_telemetry_stats(struct vip_telemetry_stats *stats)
+{
+  g_assert(stats);
+
+  *stats = telemetry_stats;
+}
+
+void vip_get_pool_stats(struct vip_pool_stats *stats)
+{
+  g_assert(stats);
+
+  *stats = pool_stats;
+}
+
+void vip_get_sequence_stats(guint64 *duplicates, guint64 *resets)
+{
+  if (duplicates) {
+    *duplicates = num_duplicates;
+  }
+  if (resets) {
+    *resets = num_resets;
+  }
+}
@@ -3,10 +3,61 @@
 
 #include <gio/gio.h>
 
+/* Ports of the first PTZ channel, the next channels use the following ports */
+#define VIP_UDP_PORT (52381)
+#define VIP_TCP_PORT (5678)     /* Raw VISCA over TCP */
+
+/* Max number of datagrams handled per main loop wakeup */
+#define VIP_BATCH_SIZE (16)
+
+struct vip_batch_stats {
+  guint64 wakeups;
+  guint64 datagrams;
+  guint64 tx_batches;
+  guint64 tx_datagrams;
+  guint64 tx_errors;      /* Replies that could not be sent */
+  guint64 batch_size[VIP_BATCH_SIZE + 1]; /* Wakeups per datagrams received */
+};
+
+struct vip_tcp_stats {
+  guint64 connections;    /* Currently open */
+  guint64 accepted;
+  guint64 refused;
+  guint64 messages;
+  guint64 errors;
+  guint64 overflows;      /* Disconnected for not reading replies */
+};
+
+struct vip_telemetry_stats {
+  guint64 subscribers;    /* Currently subscribed */
+  guint64 refused;
+  guint64 samples;        /* Status samples taken for all subscribers */
+  guint64 frames;
+  guint64 datagrams;      /* Frames times subscribers */
+  guint64 suppressed;     /* Samples without change worth sending */
+};
+
+struct vip_pool_stats {
+  guint64 size;
+  guint64 in_use;         /* Including packets attached for receiving */
+  guint64 max_in_use;
+  guint64 exhausted;      /* Packets asked for while none were free */
+};
+
 int vip_init();
 
 gboolean vip_cmd_callback(GIOChannel *source,
                          GIOCondition cond,
                          gpointer data);
 
+void vip_get_batch_stats(struct vip_batch_stats *stats);
+
+void vip_get_tcp_stats(struct vip_tcp_stats *stats);
+
+void vip_get_telemetry_stats(struct vip_telemetry_stats *stats);
+
+void vip_get_pool_stats(struct vip_pool_stats *stats);
+
+void vip_get_sequence_stats(guint64 *duplicates, guint64 *resets);
+
 #endif // INCLUSION_GUARD_VIP_H
\ No newline at end of file
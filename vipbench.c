@@ -0,0 +1,458 @@
+/*
+ * Microbenchmarks of the VISCA parse and encode path, run against the
+ * simulated camera in hal_sim.c. vip.c is built into this file so its
+ * static functions can be called directly, everything else is linked from
+ * the host build.
+ *
+ *   vipbench [-n iterations] [-r runs] [-f filter]
+ *
+ * One line is written per case, name, iterations and the best ns/op of all
+ * runs, e.g.
+ *
+ *   digest/pt_absolute        1048576    412.3 ns/op
+ *
+ * Cases are timed in chunks of at most VIP_TX_BATCH_SIZE operations. Between
+ * chunks, untimed, queued replies are dropped instead of sent and the main
+ * loop runs until the actuation threads have executed every movement, so
+ * no queue ever overflows. Sessions have all completion slots taken, no
+ * movement is tracked for completion. Focus and iris commands go to VAPIX
+ * over HTTP and are left out.
+ */
+
+#include "vip.c"
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "actuator.h"
+
+#define BENCH_DEFAULT_ITERATIONS (1 << 20)
+#define BENCH_DEFAULT_RUNS (5)
+#define BENCH_CHUNK (VIP_TX_BATCH_SIZE)
+
+/* Inputs cycled through by the conversion cases */
+#define BENCH_NUM_INPUTS (1024)
+
+/* Request frames, header and raw VISCA */
+#define BENCH_CMD 0x01, 0x00, 0x00
+#define BENCH_SEQ 0x00, 0x00, 0x00, 0x01
+
+struct bench_frame {
+  const char *name;
+  size_t len;
+  unsigned char data[32];
+};
+
+static const struct bench_frame commands[] = {
+  { "clear_if", 13,
+    { BENCH_CMD, 5, BENCH_SEQ, 0x81, 0x01, 0x00, 0x01, 0xFF } },
+  { "pt_drive", 17,
+    { BENCH_CMD, 9, BENCH_SEQ, 0x81, 0x01, 0x06, 0x01, 0x0C, 0x0A, 0x03, 0x01,
+      0xFF } },
+  { "pt_drive_stop", 17,
+    { BENCH_CMD, 9, BENCH_SEQ, 0x81, 0x01, 0x06, 0x01, 0x0C, 0x0A, 0x03, 0x03,
+      0xFF } },
+  { "pt_absolute", 24,
+    { BENCH_CMD, 16, BENCH_SEQ, 0x81, 0x01, 0x06, 0x02, 0x18, 0x14,
+      0x00, 0x04, 0x0D, 0x0E, 0x0F, 0x0F, 0x0E, 0x08, 0x00, 0xFF } },
+  { "pt_relative", 24,
+    { BENCH_CMD, 16, BENCH_SEQ, 0x81, 0x01, 0x06, 0x03, 0x18, 0x14,
+      0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x08, 0x00, 0xFF } },
+  { "pt_home", 13,
+    { BENCH_CMD, 5, BENCH_SEQ, 0x81, 0x01, 0x06, 0x04, 0xFF } },
+  { "zoom_tele", 14,
+    { BENCH_CMD, 6, BENCH_SEQ, 0x81, 0x01, 0x04, 0x07, 0x25, 0xFF } },
+  { "zoom_stop", 14,
+    { BENCH_CMD, 6, BENCH_SEQ, 0x81, 0x01, 0x04, 0x07, 0x00, 0xFF } },
+  { "zoom_direct", 17,
+    { BENCH_CMD, 9, BENCH_SEQ, 0x81, 0x01, 0x04, 0x47, 0x02, 0x00, 0x00, 0x00,
+      0xFF } },
+  { "preset_recall", 15,
+    { BENCH_CMD, 7, BENCH_SEQ, 0x81, 0x01, 0x04, 0x3F, 0x02, 0x01, 0xFF } },
+};
+
+/* Sets the preset recalled by preset_recall, recalls of unset presets fail */
+static const struct bench_frame preset_set =
+  { "preset_set", 15,
+    { BENCH_CMD, 7, BENCH_SEQ, 0x81, 0x01, 0x04, 0x3F, 0x01, 0x01, 0xFF } };
+
+static const struct bench_frame inquiries[] = {
+  { "inq_version", 13,
+    { BENCH_CMD, 5, BENCH_SEQ, 0x81, 0x09, 0x00, 0x02, 0xFF } },
+  { "inq_af", 13,
+    { BENCH_CMD, 5, BENCH_SEQ, 0x81, 0x09, 0x04, 0x38, 0xFF } },
+  { "inq_flip", 13,
+    { BENCH_CMD, 5, BENCH_SEQ, 0x81, 0x09, 0x04, 0x66, 0xFF } },
+  { "inq_zoom", 13,
+    { BENCH_CMD, 5, BENCH_SEQ, 0x81, 0x09, 0x04, 0x47, 0xFF } },
+  { "inq_pt", 13,
+    { BENCH_CMD, 5, BENCH_SEQ, 0x81, 0x09, 0x06, 0x12, 0xFF } },
+};
+
+struct bench_case;
+typedef void (*bench_op) (const struct bench_case *c, guint i);
+
+struct bench_case {
+  gchar *name;
+  bench_op op;
+  const struct bench_frame *frame;
+};
+
+static struct vip_session bench_session;
+static struct vip_packet *bench_pkt;
+static const struct conv_tables *bench_conv;
+
+static unsigned int visca_inputs[BENCH_NUM_INPUTS];
+static fixed_t fixed_inputs[BENCH_NUM_INPUTS];
+static float float_inputs[BENCH_NUM_INPUTS];
+
+/* Results are stored here so the compiler keeps the conversions */
+static volatile unsigned int sink;
+static volatile float float_sink;
+
+/********************************************/
+
+/*
+ * The float conversions used before conv.c, linear 170/90 degrees and zoom
+ * between the limits, as the baseline of the conv cases
+ */
+static float float_visca_to_pan(unsigned int pan)
+{
+  if (pan & 0x80000) {
+    return -(170.0f - (170.0f / 0x09BDE) * (pan - 0xF6422));
+  }
+
+  return (170.0f / 0x09BDE) * pan;
+}
+
+static unsigned int float_pan_to_visca(float pan)
+{
+  if (pan < 0) {
+    return 0xF6422 + ((170.0f + pan) / 170.0f) * 0x09BDE;
+  }
+
+  return 0x09BDE * (pan / 170.0f);
+}
+
+static float float_visca_to_zoom(unsigned int zoom)
+{
+  float min = fx_xtof(bench_conv->zoom.min, FIXMATH_FRAC_BITS);
+  float max = fx_xtof(bench_conv->zoom.max, FIXMATH_FRAC_BITS);
+
+  return min + (max - min) * zoom / 0x4000;
+}
+
+static unsigned int float_zoom_to_visca(float zoom)
+{
+  float min = fx_xtof(bench_conv->zoom.min, FIXMATH_FRAC_BITS);
+  float max = fx_xtof(bench_conv->zoom.max, FIXMATH_FRAC_BITS);
+
+  return 0x4000 * ((zoom - min) / (max - min));
+}
+
+/********************************************/
+
+static void bench_digest(const struct bench_case *c, guint i)
+{
+  /* Replies are built in place, the request is restored every time */
+  memcpy(bench_pkt->data, c->frame->data, c->frame->len);
+  bench_pkt->len = c->frame->len;
+
+  sink = vip_digest_package(&bench_session, bench_pkt);
+}
+
+static void bench_process_command(const struct bench_case *c, guint i)
+{
+  memcpy(bench_pkt->data, c->frame->data, c->frame->len);
+
+  sink = process_command(bench_session.channel,
+                         &bench_pkt->data[VIP_RAW_CMD_START_IDX],
+                         c->frame->len - VIP_RAW_CMD_START_IDX, NULL, NULL);
+}
+
+static void bench_inq_pt(const struct bench_case *c, guint i)
+{
+  sink = vip_inq_PT(bench_session.channel, bench_pkt->data, SBUF_SIZE);
+}
+
+static void bench_inq_zoom(const struct bench_case *c, guint i)
+{
+  sink = vip_inq_Zoom(bench_session.channel, bench_pkt->data, SBUF_SIZE);
+}
+
+static void bench_put_nibbles(const struct bench_case *c, guint i)
+{
+  conv_put_nibbles(bench_pkt->data, visca_inputs[i % BENCH_NUM_INPUTS], 5);
+}
+
+static void bench_conv_visca_to_pan(const struct bench_case *c, guint i)
+{
+  sink = conv_visca_to_pan(bench_conv, visca_inputs[i % BENCH_NUM_INPUTS]);
+}
+
+static void bench_float_visca_to_pan(const struct bench_case *c, guint i)
+{
+  float_sink = float_visca_to_pan(visca_inputs[i % BENCH_NUM_INPUTS]);
+}
+
+static void bench_conv_pan_to_visca(const struct bench_case *c, guint i)
+{
+  sink = conv_pan_to_visca(bench_conv, fixed_inputs[i % BENCH_NUM_INPUTS]);
+}
+
+static void bench_float_pan_to_visca(const struct bench_case *c, guint i)
+{
+  sink = float_pan_to_visca(float_inputs[i % BENCH_NUM_INPUTS]);
+}
+
+static void bench_conv_visca_to_zoom(const struct bench_case *c, guint i)
+{
+  sink = conv_visca_to_zoom(bench_conv,
+                            visca_inputs[i % BENCH_NUM_INPUTS] & 0x3FFF);
+}
+
+static void bench_float_visca_to_zoom(const struct bench_case *c, guint i)
+{
+  float_sink = float_visca_to_zoom(visca_inputs[i % BENCH_NUM_INPUTS] & 0x3FFF);
+}
+
+static void bench_conv_zoom_to_visca(const struct bench_case *c, guint i)
+{
+  sink = conv_zoom_to_visca(bench_conv,
+                            bench_conv->zoom.min +
+                            (fixed_inputs[i % BENCH_NUM_INPUTS] & 0xFFFF));
+}
+
+static void bench_float_zoom_to_visca(const struct bench_case *c, guint i)
+{
+  float min = fx_xtof(bench_conv->zoom.min, FIXMATH_FRAC_BITS);
+
+  float_sink = float_zoom_to_visca(min +
+    fx_xtof(fixed_inputs[i % BENCH_NUM_INPUTS] & 0xFFFF, FIXMATH_FRAC_BITS));
+}
+
+/********************************************/
+
+static guint64 bench_now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (guint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Let the main loop and the actuation threads catch up, and drop the
+ * replies that would have been sent
+ */
+static void bench_settle()
+{
+  struct actuator_stats stats;
+  unsigned int i;
+
+  for (i = 0; i < tx_count; i++) {
+    vip_packet_put(tx_packets[i]);
+    tx_packets[i] = NULL;
+  }
+  tx_count = 0;
+
+  do {
+    while (g_main_context_iteration(NULL, FALSE));
+    actuator_get_stats(&stats);
+  } while (stats.depth > 0);
+
+  /* Results of the last movements */
+  while (g_main_context_iteration(NULL, FALSE));
+}
+
+static gdouble bench_run(const struct bench_case *c, guint iterations)
+{
+  guint64 elapsed = 0;
+  guint i = 0;
+
+  while (i < iterations) {
+    guint end = MIN(i + BENCH_CHUNK, iterations);
+    guint64 start = bench_now_ns();
+
+    for (; i < end; i++) {
+      c->op(c, i);
+    }
+
+    elapsed += bench_now_ns() - start;
+
+    bench_settle();
+  }
+
+  return (gdouble) elapsed / iterations;
+}
+
+static void bench_add(GArray *cases, gchar *name, bench_op op,
+                      const struct bench_frame *frame)
+{
+  struct bench_case c = { name, op, frame };
+
+  g_array_append_val(cases, c);
+}
+
+static GArray *bench_cases()
+{
+  GArray *cases = g_array_new(FALSE, FALSE, sizeof(struct bench_case));
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(commands); i++) {
+    bench_add(cases, g_strdup_printf("digest/%s", commands[i].name),
+              bench_digest, &commands[i]);
+  }
+
+  for (i = 0; i < G_N_ELEMENTS(inquiries); i++) {
+    bench_add(cases, g_strdup_printf("digest/%s", inquiries[i].name),
+              bench_digest, &inquiries[i]);
+  }
+
+  /* Clear_If is handled in vip.c, not a command of ptz.c */
+  for (i = 1; i < G_N_ELEMENTS(commands); i++) {
+    bench_add(cases, g_strdup_printf("command/%s", commands[i].name),
+              bench_process_command, &commands[i]);
+  }
+
+  bench_add(cases, g_strdup("encode/inq_pt"), bench_inq_pt, NULL);
+  bench_add(cases, g_strdup("encode/inq_zoom"), bench_inq_zoom, NULL);
+  bench_add(cases, g_strdup("encode/put_nibbles"), bench_put_nibbles, NULL);
+
+  bench_add(cases, g_strdup("conv/visca_to_pan"),
+            bench_conv_visca_to_pan, NULL);
+  bench_add(cases, g_strdup("float/visca_to_pan"),
+            bench_float_visca_to_pan, NULL);
+  bench_add(cases, g_strdup("conv/pan_to_visca"),
+            bench_conv_pan_to_visca, NULL);
+  bench_add(cases, g_strdup("float/pan_to_visca"),
+            bench_float_pan_to_visca, NULL);
+  bench_add(cases, g_strdup("conv/visca_to_zoom"),
+            bench_conv_visca_to_zoom, NULL);
+  bench_add(cases, g_strdup("float/visca_to_zoom"),
+            bench_float_visca_to_zoom, NULL);
+  bench_add(cases, g_strdup("conv/zoom_to_visca"),
+            bench_conv_zoom_to_visca, NULL);
+  bench_add(cases, g_strdup("float/zoom_to_visca"),
+            bench_float_zoom_to_visca, NULL);
+
+  return cases;
+}
+
+/********************************************/
+
+static void bench_init_inputs()
+{
+  GRand *rand = g_rand_new_with_seed(1);
+  guint i;
+
+  for (i = 0; i < BENCH_NUM_INPUTS; i++) {
+    gint32 pan = g_rand_int_range(rand, -CONV_PAN_MAX, CONV_PAN_MAX + 1);
+
+    visca_inputs[i] = pan & 0xFFFFF;
+    float_inputs[i] = g_rand_double_range(rand, -170.0, 170.0);
+    fixed_inputs[i] = fx_ftox(float_inputs[i], FIXMATH_FRAC_BITS);
+  }
+
+  g_rand_free(rand);
+}
+
+static gboolean bench_init()
+{
+  struct bench_case set = { NULL, NULL, &preset_set };
+  guint i;
+
+  param_init("Axvisca");
+
+  if (!ptz_init() || ptz_num_channels() == 0) {
+    g_printf("Could not set up the simulated PTZ\n");
+    return FALSE;
+  }
+
+  /* What vip_init does, without opening any socket */
+  vip_pool_init();
+  vip_build_version_reply();
+  autofocus_param_callbacks[0]("true");
+
+  memset(&bench_session, 0, sizeof(bench_session));
+  bench_session.channel = ptz_get_channel(0);
+  bench_session.endpoint.s = -1;
+
+  for (i = 0; i < VIP_SESSION_MAX_PENDING; i++) {
+    bench_session.completions[i].session = &bench_session;
+    bench_session.completions[i].in_use = TRUE;
+  }
+  bench_session.pending = VIP_SESSION_MAX_PENDING;
+
+  bench_pkt = vip_packet_get();
+  bench_pkt->rx_time = g_get_monotonic_time();
+
+  bench_conv = ptz_channel_conv(bench_session.channel);
+
+  bench_init_inputs();
+
+  bench_process_command(&set, 0);
+  bench_settle();
+
+  return TRUE;
+}
+
+int main(int argc, char *argv[])
+{
+  guint iterations = BENCH_DEFAULT_ITERATIONS;
+  guint runs = BENCH_DEFAULT_RUNS;
+  const gchar *filter = NULL;
+  GArray *cases;
+  guint i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:f:")) != -1) {
+    switch (opt) {
+    case 'n':
+      iterations = MAX(atoi(optarg), 1);
+      break;
+    case 'r':
+      runs = MAX(atoi(optarg), 1);
+      break;
+    case 'f':
+      filter = optarg;
+      break;
+    default:
+      g_printf("Usage: %s [-n iterations] [-r runs] [-f filter]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (!bench_init()) {
+    return 1;
+  }
+
+  cases = bench_cases();
+
+  for (i = 0; i < cases->len; i++) {
+    const struct bench_case *c = &g_array_index(cases, struct bench_case, i);
+    gdouble best = G_MAXDOUBLE;
+    guint run;
+
+    if (filter && !strstr(c->name, filter)) {
+      continue;
+    }
+
+    for (run = 0; run < runs; run++) {
+      best = MIN(best, bench_run(c, iterations));
+    }
+
+    g_printf("%-24s %10u %10.1f ns/op\n", c->name, iterations, best);
+  }
+
+  for (i = 0; i < cases->len; i++) {
+    g_free(g_array_index(cases, struct bench_case, i).name);
+  }
+  g_array_free(cases, TRUE);
+
+  ptz_cleanup();
+  param_cleanup();
+
+  return 0;
+}
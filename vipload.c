@@ -0,0 +1,590 @@
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+/*
+ * VISCA over IP load generator. Emulates a number of controllers, each with
+ * its own socket and sequence numbers, sending a mix of joystick drives,
+ * position inquiries, preset recalls and focus commands at a fixed rate.
+ * ACK and completion latency, loss and reordering are written as a JSON
+ * report when done.
+ *
+ *   vipload [-a address] [-p port] [-c controllers] [-r rate] [-d seconds]
+ *           [-m mix] [-t timeout_ms] [-s seed] [-o report.json]
+ *
+ * The mix is given as weights, e.g. -m drive=50,pt=20,zoom=20,preset=5,focus=5
+ */
+
+#define VIP_HEADER_SIZE (8)
+#define VIP_BUF_SIZE (64)
+
+/* Requests remembered per controller, for matching replies */
+#define LOAD_WINDOW (4096)
+
+#define LOAD_DEFAULT_PORT (52381)
+#define LOAD_DEFAULT_CONTROLLERS (4)
+#define LOAD_DEFAULT_RATE (30)
+#define LOAD_DEFAULT_DURATION_S (10)
+#define LOAD_DEFAULT_TIMEOUT_MS (2000)
+
+#define LOAD_EXPIRE_INTERVAL_US (100 * 1000)
+
+enum load_class {
+  LOAD_DRIVE,
+  LOAD_PT_INQ,
+  LOAD_ZOOM_INQ,
+  LOAD_PRESET,
+  LOAD_FOCUS,
+  LOAD_NUM_CLASSES
+};
+
+static const char *class_names[LOAD_NUM_CLASSES] = {
+  [LOAD_DRIVE]    = "drive",
+  [LOAD_PT_INQ]   = "pt",
+  [LOAD_ZOOM_INQ] = "zoom",
+  [LOAD_PRESET]   = "preset",
+  [LOAD_FOCUS]    = "focus",
+};
+
+/* Inquiries get a single reply, counted as their completion */
+static const gboolean class_is_command[LOAD_NUM_CLASSES] = {
+  [LOAD_DRIVE]    = TRUE,
+  [LOAD_PRESET]   = TRUE,
+  [LOAD_FOCUS]    = TRUE,
+};
+
+struct load_request {
+  gboolean valid;
+  guint32 seq;
+  enum load_class cls;
+  gint64 sent;
+  gint64 acked;
+  gint64 completed;
+};
+
+struct load_controller {
+  int s;
+  guint32 next_seq;
+  gint64 next_send;
+  gboolean have_reply;
+  guint32 last_reply_seq;
+  struct load_request window[LOAD_WINDOW];
+};
+
+struct load_class_stats {
+  guint64 sent;
+  guint64 acked;
+  guint64 completed;
+  guint64 errors;
+  guint64 lost;
+  GArray *ack_us;
+  GArray *completion_us;
+};
+
+static struct sockaddr_in target;
+static struct load_controller *controllers;
+static struct load_class_stats stats[LOAD_NUM_CLASSES];
+static guint64 num_reordered = 0;
+static guint64 num_unmatched = 0;
+static guint64 num_outstanding = 0;
+
+static int opt_controllers = LOAD_DEFAULT_CONTROLLERS;
+static int opt_rate = LOAD_DEFAULT_RATE;
+static int opt_duration_s = LOAD_DEFAULT_DURATION_S;
+static int opt_timeout_ms = LOAD_DEFAULT_TIMEOUT_MS;
+static guint32 opt_seed = 1;
+static const char *opt_report = NULL;
+static guint mix[LOAD_NUM_CLASSES] = { 50, 20, 20, 5, 5 };
+static guint mix_total = 100;
+
+static guint32 rng_state;
+
+/********************************************/
+
+static guint32 load_random()
+{
+  /* xorshift32, reproducible for a given seed */
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+
+  return rng_state;
+}
+
+static enum load_class load_pick_class()
+{
+  guint r = load_random() % mix_total;
+  int i;
+
+  for (i = 0; i < LOAD_NUM_CLASSES; i++) {
+    if (r < mix[i]) {
+      return i;
+    }
+    r -= mix[i];
+  }
+
+  return LOAD_DRIVE;
+}
+
+static int load_parse_mix(const char *arg)
+{
+  gchar **parts = g_strsplit(arg, ",", -1);
+  int i, j;
+
+  memset(mix, 0, sizeof(mix));
+  mix_total = 0;
+
+  for (i = 0; parts[i]; i++) {
+    gchar *eq = strchr(parts[i], '=');
+
+    if (!eq) {
+      g_strfreev(parts);
+      return -1;
+    }
+
+    *eq = '\0';
+
+    for (j = 0; j < LOAD_NUM_CLASSES; j++) {
+      if (strcmp(parts[i], class_names[j]) == 0) {
+        mix[j] = (guint) g_ascii_strtoull(eq + 1, NULL, 10);
+        mix_total += mix[j];
+        break;
+      }
+    }
+
+    if (j == LOAD_NUM_CLASSES) {
+      g_strfreev(parts);
+      return -1;
+    }
+  }
+
+  g_strfreev(parts);
+
+  return mix_total > 0 ? 0 : -1;
+}
+
+/*
+ * Build the VISCA payload of a request, returns its length
+ */
+static size_t load_build_payload(enum load_class cls, unsigned char *p)
+{
+  static const unsigned char directions[][2] = {
+    { 0x03, 0x01 }, { 0x03, 0x02 }, { 0x01, 0x03 }, { 0x02, 0x03 },
+    { 0x01, 0x01 }, { 0x02, 0x01 }, { 0x01, 0x02 }, { 0x02, 0x02 },
+    { 0x03, 0x03 },
+  };
+  guint32 r = load_random();
+  unsigned int value;
+
+  switch (cls) {
+  case LOAD_DRIVE:
+    /* Pan/Tilt drive, stop every now and then */
+    p[0] = 0x81; p[1] = 0x01; p[2] = 0x06; p[3] = 0x01;
+    p[4] = 1 + r % 0x11;
+    p[5] = 1 + (r >> 8) % 0x11;
+    p[6] = directions[(r >> 16) % G_N_ELEMENTS(directions)][0];
+    p[7] = directions[(r >> 16) % G_N_ELEMENTS(directions)][1];
+    p[8] = 0xFF;
+    return 9;
+  case LOAD_PT_INQ:
+    p[0] = 0x81; p[1] = 0x09; p[2] = 0x06; p[3] = 0x12; p[4] = 0xFF;
+    return 5;
+  case LOAD_ZOOM_INQ:
+    p[0] = 0x81; p[1] = 0x09; p[2] = 0x04; p[3] = 0x47; p[4] = 0xFF;
+    return 5;
+  case LOAD_PRESET:
+    /* Preset recall */
+    p[0] = 0x81; p[1] = 0x01; p[2] = 0x04; p[3] = 0x3F;
+    p[4] = 0x02; p[5] = r % 16; p[6] = 0xFF;
+    return 7;
+  case LOAD_FOCUS:
+    /* Direct focus, 0pqrs */
+    value = 0x1000 + r % (0xC000 - 0x1000);
+    p[0] = 0x81; p[1] = 0x01; p[2] = 0x04; p[3] = 0x48;
+    p[4] = (value >> 12) & 0x0F;
+    p[5] = (value >> 8) & 0x0F;
+    p[6] = (value >> 4) & 0x0F;
+    p[7] = value & 0x0F;
+    p[8] = 0xFF;
+    return 9;
+  default:
+    return 0;
+  }
+}
+
+static void load_put_header(unsigned char *buf, guint8 type0, guint8 type1,
+                            size_t payload_len, guint32 seq)
+{
+  buf[0] = type0;
+  buf[1] = type1;
+  buf[2] = (payload_len >> 8) & 0xFF;
+  buf[3] = payload_len & 0xFF;
+  buf[4] = (seq >> 24) & 0xFF;
+  buf[5] = (seq >> 16) & 0xFF;
+  buf[6] = (seq >> 8) & 0xFF;
+  buf[7] = seq & 0xFF;
+}
+
+/*
+ * Start from sequence number 0, as a controller does when connecting
+ */
+static void load_send_reset(struct load_controller *c)
+{
+  unsigned char buf[VIP_HEADER_SIZE + 1];
+
+  load_put_header(buf, 0x02, 0x00, 1, 0);
+  buf[VIP_HEADER_SIZE] = 0x01;
+
+  if (sendto(c->s, buf, sizeof(buf), 0, (const struct sockaddr *) &target,
+             sizeof(target)) == -1) {
+    g_printf("Failed to send RESET: %s\n", strerror(errno));
+  }
+}
+
+static void load_send_request(struct load_controller *c, gint64 now)
+{
+  unsigned char buf[VIP_BUF_SIZE];
+  enum load_class cls = load_pick_class();
+  size_t len = load_build_payload(cls, &buf[VIP_HEADER_SIZE]);
+  guint32 seq = c->next_seq++;
+  struct load_request *req = &c->window[seq % LOAD_WINDOW];
+
+  /* A request still waiting after a full window is lost */
+  if (req->valid) {
+    stats[req->cls].lost++;
+    num_outstanding--;
+  }
+
+  /* The camera accepts inquiries in a command header, as Tricaster sends */
+  load_put_header(buf, 0x01, 0x00, len, seq);
+
+  memset(req, 0, sizeof(*req));
+  req->valid = TRUE;
+  req->seq = seq;
+  req->cls = cls;
+  req->sent = now;
+
+  stats[cls].sent++;
+  num_outstanding++;
+
+  if (sendto(c->s, buf, VIP_HEADER_SIZE + len, 0,
+             (const struct sockaddr *) &target, sizeof(target)) == -1) {
+    g_printf("Failed to send request: %s\n", strerror(errno));
+  }
+}
+
+static void load_finish_request(struct load_request *req)
+{
+  req->valid = FALSE;
+  num_outstanding--;
+}
+
+static void load_receive(struct load_controller *c)
+{
+  unsigned char buf[VIP_BUF_SIZE];
+  gint64 now;
+  ssize_t len;
+
+  while ((len = recv(c->s, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+    now = g_get_monotonic_time();
+
+    /* Control reply to RESET */
+    if (buf[0] == 0x02) {
+      continue;
+    }
+
+    if (len < VIP_HEADER_SIZE + 3) {
+      num_unmatched++;
+      continue;
+    }
+
+    guint32 seq = ((guint32) buf[4] << 24) | ((guint32) buf[5] << 16) |
+      ((guint32) buf[6] << 8) | buf[7];
+    struct load_request *req = &c->window[seq % LOAD_WINDOW];
+    unsigned char kind = buf[VIP_HEADER_SIZE + 1] & 0xF0;
+
+    if (!req->valid || req->seq != seq) {
+      num_unmatched++;
+      continue;
+    }
+
+    /* Replies should come back in the order the requests were sent */
+    if (c->have_reply && seq < c->last_reply_seq && !req->acked) {
+      num_reordered++;
+    }
+    if (!c->have_reply || seq > c->last_reply_seq) {
+      c->last_reply_seq = seq;
+      c->have_reply = TRUE;
+    }
+
+    struct load_class_stats *st = &stats[req->cls];
+    gint64 latency = now - req->sent;
+
+    if (kind == 0x60) {
+      st->errors++;
+      load_finish_request(req);
+    } else if (kind == 0x40 && class_is_command[req->cls] && !req->acked) {
+      req->acked = now;
+      st->acked++;
+      g_array_append_val(st->ack_us, latency);
+    } else if (kind == 0x50 && !req->completed) {
+      req->completed = now;
+      st->completed++;
+      g_array_append_val(st->completion_us, latency);
+      load_finish_request(req);
+    } else {
+      num_unmatched++;
+    }
+  }
+}
+
+/*
+ * Anything not answered within the timeout is lost
+ */
+static void load_expire(struct load_controller *c, gint64 now, gboolean all)
+{
+  gint64 timeout = (gint64) opt_timeout_ms * 1000;
+  int i;
+
+  for (i = 0; i < LOAD_WINDOW; i++) {
+    struct load_request *req = &c->window[i];
+
+    if (req->valid && (all || now - req->sent > timeout)) {
+      stats[req->cls].lost++;
+      load_finish_request(req);
+    }
+  }
+}
+
+static int load_cmp_gint64(gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static void load_write_percentiles(FILE *f, const char *name, GArray *values)
+{
+  gint64 p50 = 0, p99 = 0, max = 0;
+
+  if (values->len > 0) {
+    g_array_sort(values, load_cmp_gint64);
+    p50 = g_array_index(values, gint64, (values->len - 1) * 50 / 100);
+    p99 = g_array_index(values, gint64, (values->len - 1) * 99 / 100);
+    max = g_array_index(values, gint64, values->len - 1);
+  }
+
+  fprintf(f, "\"%s\": { \"count\": %u, \"p50\": %lld, \"p99\": %lld, "
+          "\"max\": %lld }", name, values->len, (long long) p50,
+          (long long) p99, (long long) max);
+}
+
+static void load_write_report(FILE *f, gint64 elapsed_us)
+{
+  guint64 sent = 0, answered = 0;
+  int i;
+
+  for (i = 0; i < LOAD_NUM_CLASSES; i++) {
+    sent += stats[i].sent;
+    answered += stats[i].completed;
+  }
+
+  fprintf(f, "{\n");
+  fprintf(f, "  \"target\": \"%s:%d\",\n", inet_ntoa(target.sin_addr),
+          ntohs(target.sin_port));
+  fprintf(f, "  \"controllers\": %d,\n", opt_controllers);
+  fprintf(f, "  \"rate_per_controller\": %d,\n", opt_rate);
+  fprintf(f, "  \"duration_us\": %lld,\n", (long long) elapsed_us);
+  fprintf(f, "  \"sent\": %llu,\n", (unsigned long long) sent);
+  fprintf(f, "  \"throughput_rps\": %.1f,\n",
+          elapsed_us > 0 ? answered * (double) G_USEC_PER_SEC / elapsed_us : 0.0);
+  fprintf(f, "  \"reordered\": %llu,\n", (unsigned long long) num_reordered);
+  fprintf(f, "  \"unmatched\": %llu,\n", (unsigned long long) num_unmatched);
+  fprintf(f, "  \"classes\": {\n");
+
+  for (i = 0; i < LOAD_NUM_CLASSES; i++) {
+    struct load_class_stats *st = &stats[i];
+
+    fprintf(f, "    \"%s\": {\n", class_names[i]);
+    fprintf(f, "      \"sent\": %llu, \"acked\": %llu, \"completed\": %llu, "
+            "\"errors\": %llu, \"lost\": %llu,\n",
+            (unsigned long long) st->sent, (unsigned long long) st->acked,
+            (unsigned long long) st->completed,
+            (unsigned long long) st->errors, (unsigned long long) st->lost);
+    fprintf(f, "      ");
+    load_write_percentiles(f, "ack_us", st->ack_us);
+    fprintf(f, ",\n      ");
+    load_write_percentiles(f, "completion_us", st->completion_us);
+    fprintf(f, "\n    }%s\n", i < LOAD_NUM_CLASSES - 1 ? "," : "");
+  }
+
+  fprintf(f, "  }\n}\n");
+}
+
+static void load_usage(const char *prog)
+{
+  g_printf("Usage: %s [-a address] [-p port] [-c controllers] [-r rate] "
+    "[-d seconds] [-m mix] [-t timeout_ms] [-s seed] [-o report.json]\n",
+    prog);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *address = "127.0.0.1";
+  int port = LOAD_DEFAULT_PORT;
+  struct pollfd *fds;
+  int opt;
+  int i;
+
+  while ((opt = getopt(argc, argv, "a:p:c:r:d:m:t:s:o:h")) != -1) {
+    switch (opt) {
+    case 'a': address = optarg; break;
+    case 'p': port = atoi(optarg); break;
+    case 'c': opt_controllers = atoi(optarg); break;
+    case 'r': opt_rate = atoi(optarg); break;
+    case 'd': opt_duration_s = atoi(optarg); break;
+    case 't': opt_timeout_ms = atoi(optarg); break;
+    case 's': opt_seed = (guint32) strtoul(optarg, NULL, 10); break;
+    case 'o': opt_report = optarg; break;
+    case 'm':
+      if (load_parse_mix(optarg) < 0) {
+        g_printf("Invalid mix %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      load_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (opt_controllers < 1 || opt_rate < 1 || opt_duration_s < 1) {
+    load_usage(argv[0]);
+    return 1;
+  }
+
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(port);
+
+  if (inet_pton(AF_INET, address, &target.sin_addr) != 1) {
+    g_printf("Invalid address %s\n", address);
+    return 1;
+  }
+
+  rng_state = opt_seed ? opt_seed : 1;
+
+  for (i = 0; i < LOAD_NUM_CLASSES; i++) {
+    stats[i].ack_us = g_array_new(FALSE, FALSE, sizeof(gint64));
+    stats[i].completion_us = g_array_new(FALSE, FALSE, sizeof(gint64));
+  }
+
+  controllers = g_new0(struct load_controller, opt_controllers);
+  fds = g_new0(struct pollfd, opt_controllers);
+
+  gint64 interval = G_USEC_PER_SEC / opt_rate;
+  gint64 start = g_get_monotonic_time();
+  gint64 end = start + (gint64) opt_duration_s * G_USEC_PER_SEC;
+
+  for (i = 0; i < opt_controllers; i++) {
+    struct load_controller *c = &controllers[i];
+
+    if ((c->s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+      g_printf("Could not create socket!\n");
+      return 1;
+    }
+
+    fds[i].fd = c->s;
+    fds[i].events = POLLIN;
+
+    load_send_reset(c);
+
+    /* Spread the controllers over the send interval */
+    c->next_send = start + interval * i / opt_controllers;
+  }
+
+  g_printf("Sending to %s:%d, %d controllers at %d requests/s for %d s\n",
+    address, port, opt_controllers, opt_rate, opt_duration_s);
+
+  gint64 now = start;
+  gint64 drain_end = end + (gint64) opt_timeout_ms * 1000;
+  gint64 next_expire = start + LOAD_EXPIRE_INTERVAL_US;
+
+  while (now < drain_end) {
+    gint64 next = now < end ? end : drain_end;
+
+    for (i = 0; i < opt_controllers && now < end; i++) {
+      struct load_controller *c = &controllers[i];
+
+      while (c->next_send <= now) {
+        load_send_request(c, now);
+        c->next_send += interval;
+      }
+
+      next = MIN(next, c->next_send);
+    }
+
+    if (now >= end && num_outstanding == 0) {
+      break;
+    }
+
+    int wait_ms = (int) ((next - now + 999) / 1000);
+
+    if (poll(fds, opt_controllers, MAX(wait_ms, 0)) > 0) {
+      for (i = 0; i < opt_controllers; i++) {
+        if (fds[i].revents & POLLIN) {
+          load_receive(&controllers[i]);
+        }
+      }
+    }
+
+    now = g_get_monotonic_time();
+
+    if (now >= next_expire) {
+      for (i = 0; i < opt_controllers; i++) {
+        load_expire(&controllers[i], now, FALSE);
+      }
+      next_expire = now + LOAD_EXPIRE_INTERVAL_US;
+    }
+  }
+
+  for (i = 0; i < opt_controllers; i++) {
+    load_expire(&controllers[i], now, TRUE);
+    close(controllers[i].s);
+  }
+
+  FILE *f = opt_report ? fopen(opt_report, "w") : stdout;
+
+  if (!f) {
+    g_printf("Could not open report %s\n", opt_report);
+    return 1;
+  }
+
+  load_write_report(f, MIN(now, end) - start);
+
+  if (f != stdout) {
+    fclose(f);
+  }
+
+  for (i = 0; i < LOAD_NUM_CLASSES; i++) {
+    g_array_free(stats[i].ack_us, TRUE);
+    g_array_free(stats[i].completion_us, TRUE);
+  }
+
+  g_free(fds);
+  g_free(controllers);
+
+  return 0;
+}